@@ -77,7 +77,8 @@
           'defines': [
             'HAVE_LIBJPEG',
             'GD_JPEG'
-          ]
+          ],
+          'libraries': ['-ljpeg']
         }],
         ["with_fontconfig=='true'", {
           'defines': [
@@ -2,73 +2,162 @@ declare namespace gd {
 
     type Ptr = Buffer | BufferSource;
 
+    // Options of asynchronous functions, passed as the last argument
+
+    type JobOptions = {
+        priority?: 'interactive' | 'batch';
+        signal?: AbortSignal;
+        deadlineMs?: number;
+    };
+
+    type DecodeOptions = JobOptions & DecodeLimits;
+
+    // A file descriptor or FileHandle to save to, with where to write and how to sync
+
+    type SaveFd = number | import('fs/promises').FileHandle;
+
+    type SaveFdOptions = JobOptions & {
+        offset?: number;
+        fsync?: boolean | 'batch';
+    };
+
+    type FileDecodeOptions = DecodeOptions & { mmap?: boolean };
+
+    type JpegScaleOptions = { scaleDenom?: 1 | 2 | 4 | 8; targetWidth?: number; targetHeight?: number };
+
     // Creating and opening graphic images
 
-    function create(width: number, height: number): Promise<gd.Image>;
+    function create(width: number, height: number, options?: JobOptions): Promise<gd.Image>;
 
-    function createTrueColor(width: number, height: number): Promise<gd.Image>;
+    function createTrueColor(width: number, height: number, options?: JobOptions): Promise<gd.Image>;
 
     function createSync(width: number, height: number): gd.Image;
 
     function createTrueColorSync(width: number, height: number): gd.Image;
 
-    function openJpeg(path: string): Promise<gd.Image>;
+    function createTrueColorShared(width: number, height: number, buffer?: SharedArrayBuffer): gd.Image;
+
+    function openJpeg(path: string, options?: FileDecodeOptions & JpegScaleOptions): Promise<gd.Image>;
+
+    function createFromJpeg(path: string, options?: FileDecodeOptions & JpegScaleOptions): Promise<gd.Image>;
+
+    function createFromJpegPtr(data: Ptr, options?: DecodeOptions & JpegScaleOptions): Promise<gd.Image>;
+
+    function openPng(path: string, options?: FileDecodeOptions): Promise<gd.Image>;
+
+    function createFromPng(path: string, options?: FileDecodeOptions): Promise<gd.Image>;
 
-    function createFromJpeg(path: string): Promise<gd.Image>;
+    function createFromPngPtr(data: Ptr, options?: DecodeOptions): Promise<gd.Image>;
 
-    function createFromJpegPtr(data: Ptr): Promise<gd.Image>;
+    function openGif(path: string, options?: FileDecodeOptions): Promise<gd.Image>;
 
-    function openPng(path: string): Promise<gd.Image>;
+    function createFromGif(path: string, options?: FileDecodeOptions): Promise<gd.Image>;
 
-    function createFromPng(path: string): Promise<gd.Image>;
+    function createFromGifPtr(data: Ptr, options?: DecodeOptions): Promise<gd.Image>;
 
-    function createFromPngPtr(data: Ptr): Promise<gd.Image>;
+    function openWBMP(path: string, options?: FileDecodeOptions): Promise<gd.Image>;
 
-    function openGif(path: string): Promise<gd.Image>;
+    function createFromWBMP(path: string, options?: FileDecodeOptions): Promise<gd.Image>;
 
-    function createFromGif(path: string): Promise<gd.Image>;
+    function createFromWBMPPtr(data: Ptr, options?: DecodeOptions): Promise<gd.Image>;
 
-    function createFromGifPtr(data: Ptr): Promise<gd.Image>;
+    function openBmp(path: string, options?: FileDecodeOptions): Promise<gd.Image>;
 
-    function openWBMP(path: string): Promise<gd.Image>;
+    function createFromBmp(path: string, options?: FileDecodeOptions): Promise<gd.Image>;
 
-    function createFromWBMP(path: string): Promise<gd.Image>;
+    function createFromBmpPtr(data: Ptr, options?: DecodeOptions): Promise<gd.Image>;
 
-    function createFromWBMPPtr(data: Ptr): Promise<gd.Image>;
+    function openTiff(path: string, options?: FileDecodeOptions): Promise<gd.Image>;
 
-    function openBmp(path: string): Promise<gd.Image>;
+    function createFromTiff(path: string, options?: FileDecodeOptions): Promise<gd.Image>;
 
-    function createFromBmp(path: string): Promise<gd.Image>;
+    function createFromTiffPtr(data: Ptr, options?: DecodeOptions): Promise<gd.Image>;
 
-    function createFromBmpPtr(data: Ptr): Promise<gd.Image>;
+    function openWebp(path: string, options?: FileDecodeOptions): Promise<gd.Image>;
 
-    function openTiff(path: string): Promise<gd.Image>;
+    function createFromWebp(path: string, options?: FileDecodeOptions): Promise<gd.Image>;
 
-    function createFromTiff(path: string): Promise<gd.Image>;
+    function createFromWebpPtr(data: Ptr, options?: DecodeOptions): Promise<gd.Image>;
 
-    function createFromTiffPtr(data: Ptr): Promise<gd.Image>;
+    function openHeif(path: string, options?: FileDecodeOptions): Promise<gd.Image>;
 
-    function openWebp(path: string): Promise<gd.Image>;
+    function createFromHeif(path: string, options?: FileDecodeOptions): Promise<gd.Image>;
 
-    function createFromWebp(path: string): Promise<gd.Image>;
+    function createFromHeifPtr(data: Ptr, options?: DecodeOptions): Promise<gd.Image>;
 
-    function createFromWebpPtr(data: Ptr): Promise<gd.Image>;
+    function openAvif(path: string, options?: FileDecodeOptions): Promise<gd.Image>;
 
-    function openHeif(path: string): Promise<gd.Image>;
+    function createFromAvif(path: string, options?: FileDecodeOptions): Promise<gd.Image>;
 
-    function createFromHeif(path: string): Promise<gd.Image>;
+    function createFromAvifPtr(data: Ptr, options?: DecodeOptions): Promise<gd.Image>;
 
-    function createFromHeifPtr(data: Ptr): Promise<gd.Image>;
+    function openFile(path: string, options?: FileDecodeOptions): Promise<gd.Image>;
 
-    function openAvif(path: string): Promise<gd.Image>;
+    function createFromFile(path: string, options?: FileDecodeOptions): Promise<gd.Image>;
 
-    function createFromAvif(path: string): Promise<gd.Image>;
+    type StreamFormat = 'jpeg' | 'jpg' | 'png' | 'gif' | 'bmp' | 'wbmp' | 'webp' | 'heif' | 'heic' | 'avif';
 
-    function createFromAvifPtr(data: Ptr): Promise<gd.Image>;
+    function createFromStream(readable: NodeJS.ReadableStream, format: StreamFormat, options?: DecodeOptions & { highWaterMark?: number }): Promise<gd.Image>;
 
-    function openFile(path: string): Promise<gd.Image>;
+    type PixelAlphaMode = 'straight' | 'premultiplied' | 'ignore';
 
-    function createFromFile(path: string): Promise<gd.Image>;
+    type PixelDataOptions = {
+        stride?: number;
+        alphaMode?: PixelAlphaMode;
+    };
+
+    function createFromRGBA(width: number, height: number, data: PixelArray, options?: PixelDataOptions & JobOptions): Promise<gd.Image>;
+
+    function createFromRGBASync(width: number, height: number, data: PixelArray, options?: PixelDataOptions): gd.Image;
+
+    type PipelineStep =
+        | { op: 'resize'; width?: number; height?: number }
+        | { op: 'scale'; width: number; height: number }
+        | { op: 'crop'; x: number; y: number; width: number; height: number }
+        | { op: 'rotate'; angle: number; background?: Color }
+        | { op: 'sharpen'; pct: number }
+        | { op: 'brightness'; brightness: number }
+        | { op: 'contrast'; contrast: number }
+        | { op: 'gaussianBlur' | 'grayscale' | 'negate' | 'flipHorizontal' | 'flipVertical' | 'flipBoth' };
+
+    type PipelineFormat = 'jpeg' | 'jpg' | 'png' | 'gif' | 'bmp' | 'webp' | 'tiff' | 'tif' | 'heif' | 'heic' | 'avif';
+
+    type PipelineOutput = PipelineFormat | {
+        format: PipelineFormat;
+        quality?: number;
+        level?: number;
+        compression?: 0 | 1;
+        speed?: number;
+        codec?: 1 | 4;
+        chroma?: '420' | '422' | '444';
+    };
+
+    type EncodeStreamOptions = JobOptions & {
+        chunkSize?: number;
+        end?: boolean;
+        quality?: number;
+        level?: number;
+        compression?: 0 | 1;
+        speed?: number;
+        codec?: 1 | 4;
+        chroma?: '420' | '422' | '444';
+    };
+
+    function pipeline(input: Buffer | string, steps: PipelineStep[], output: PipelineOutput, options?: DecodeOptions): Promise<Buffer>;
+
+    type ProbeResult = {
+        format: 'jpeg' | 'png' | 'gif' | 'webp' | 'bmp' | 'tiff' | 'heif' | 'avif';
+        width: number;
+        height: number;
+        bitDepth: number;
+        hasAlpha: boolean;
+        trueColor: boolean;
+        frames: number;
+    };
+
+    function probe(input: Buffer | string, options?: JobOptions): Promise<ProbeResult>;
+
+    function probeSync(input: Buffer | string): ProbeResult;
 
     type Color = number;
 
@@ -78,6 +167,65 @@ declare namespace gd {
 
     function getGDVersion(): string;
 
+    // Thread pool
+
+    type QueueStats = {
+        concurrency: number;
+        threads: number;
+        queued: number;
+        running: number;
+        completed: number;
+        aborted: number;
+        pending: number;
+        queuedByPriority: { interactive: number; batch: number };
+        lanes: { [lane: string]: { limit: number; running: number; queued: number } };
+    };
+
+    function setConcurrency(threads: number): void;
+
+    function getQueueStats(): QueueStats;
+
+    function setLaneLimit(lane: string, limit: number): void;
+
+    // Memory
+
+    type ImagePoolStats = {
+        limit: number;
+        bytes: number;
+        images: number;
+        hits: number;
+        misses: number;
+    };
+
+    function setImagePoolLimit(bytes: number): void;
+
+    function getImagePoolStats(): ImagePoolStats;
+
+    type MemoryUsage = {
+        images: number;
+        reserved: number;
+        pool: number;
+        limit: number;
+        mode: 'reject' | 'queue';
+        rejected: number;
+    };
+
+    function setMemoryLimit(bytes: number, mode?: 'reject' | 'queue'): void;
+
+    function memoryUsage(): MemoryUsage;
+
+    type DecodeLimits = {
+        maxPixels?: number;
+        maxWidth?: number;
+        maxHeight?: number;
+    };
+
+    function setDecodeLimits(limits: DecodeLimits): void;
+
+    function setMmapThreshold(bytes: number): void;
+
+    type PixelArray = Uint8ClampedArray | Uint8Array | Uint32Array;
+
     type Point = {
         x: number;
         y: number;
@@ -98,8 +246,12 @@ declare namespace gd {
 
         interlace: boolean;
 
+        readonly sharedBuffer: SharedArrayBuffer | null;
+
         destroy(): void;
 
+        detach(): ImageHandle;
+
         // Drawing
 
         setPixel(x: number, y: number, color: Color): gd.Image;
@@ -108,11 +260,15 @@ declare namespace gd {
 
         dashedLine(x1: number, y1: number, x2: number, y2: number, color: Color): gd.Image;
 
-        polygon(array: Point[], color: Color): gd.Image;
+        drawCommands(commands: Float64Array, strings?: string[]): this;
+
+        drawCommandsAsync(commands: Float64Array, strings?: string[], options?: JobOptions): Promise<this>;
 
-        openPolygon(array: Point[], color: Color): gd.Image;
+        polygon(array: Point[] | Int32Array | Float64Array, color: Color): gd.Image;
 
-        filledPolygon(array: Point[], color: Color): gd.Image;
+        openPolygon(array: Point[] | Int32Array | Float64Array, color: Color): gd.Image;
+
+        filledPolygon(array: Point[] | Int32Array | Float64Array, color: Color): gd.Image;
 
         rectangle(x1: number, y1: number, x2: number, y2: number, color: Color): gd.Image;
 
@@ -167,6 +323,14 @@ declare namespace gd {
 
         getBoundsSafe(x: number, y: number): 0 | 1;
 
+        getImageData<T extends PixelArray = Uint8ClampedArray>(x: number, y: number, width: number, height: number, target?: T): T;
+
+        getImageDataAsync<T extends PixelArray = Uint8ClampedArray>(x: number, y: number, width: number, height: number, target?: T, options?: JobOptions): Promise<T>;
+
+        putImageData(data: PixelArray, x: number, y: number, width: number, height: number, options?: PixelDataOptions): this;
+
+        putImageDataAsync(data: PixelArray, x: number, y: number, width: number, height: number, options?: PixelDataOptions & JobOptions): Promise<this>;
+
         // Font and text
 
         stringFTBBox(color: Color, font: string, size: number, angle: number, x: number, y: number, text: string): [number, number, number, number, number, number, number, number];
@@ -284,27 +448,97 @@ declare namespace gd {
 
         // Saving graphic images
 
-        savePng(path: string, level: number): Promise<boolean>;
-        saveJpeg(path: string, quality: number): Promise<boolean>;
-        saveGif(path: string): Promise<boolean>;
-        saveWBMP(path: string, foreground: 0x000000 | 0xffffff | number): Promise<boolean>;
-        saveBmp(path: string, compression: 0 | 1): Promise<boolean>;
-        saveTiff(path: string): Promise<boolean>;
-        saveWebp(path: string, quality?: number): Promise<boolean>;
-        saveHeif(path: string, quality?: number): Promise<boolean>;
-        saveAvif(path: string, quality?: number): Promise<boolean>;
-
-        png(path: string, level: number): Promise<boolean>;
-        jpeg(path: string, quality: number): Promise<boolean>;
-        gif(path: string): Promise<boolean>;
-        wbmp(path: string, foreground: 0x000000 | 0xffffff | number): Promise<boolean>;
-        bmp(path: string, compression: 0 | 1): Promise<boolean>;
-        tiff(path: string): Promise<boolean>;
-        webp(path: string, quality?: number): Promise<boolean>;
-        heif(path: string, quality?: number): Promise<boolean>;
-        avif(path: string, quality?: number): Promise<boolean>;
-
-        file(path: string): Promise<boolean>;
+        savePng(path: string, level: number, options?: JobOptions): Promise<boolean>;
+        saveJpeg(path: string, quality: number, options?: JobOptions): Promise<boolean>;
+        saveGif(path: string, options?: JobOptions): Promise<boolean>;
+        saveWBMP(path: string, foreground: 0x000000 | 0xffffff | number, options?: JobOptions): Promise<boolean>;
+        saveBmp(path: string, compression: 0 | 1, options?: JobOptions): Promise<boolean>;
+        saveTiff(path: string, options?: JobOptions): Promise<boolean>;
+        saveWebp(path: string, quality?: number, options?: JobOptions): Promise<boolean>;
+        saveHeif(path: string, quality?: number, options?: JobOptions): Promise<boolean>;
+        saveAvif(path: string, quality?: number, options?: JobOptions): Promise<boolean>;
+
+        savePng(fd: SaveFd, level: number, options?: SaveFdOptions): Promise<number>;
+        saveJpeg(fd: SaveFd, quality: number, options?: SaveFdOptions): Promise<number>;
+        saveGif(fd: SaveFd, options?: SaveFdOptions): Promise<number>;
+        saveWBMP(fd: SaveFd, foreground: 0x000000 | 0xffffff | number, options?: SaveFdOptions): Promise<number>;
+        saveBmp(fd: SaveFd, compression: 0 | 1, options?: SaveFdOptions): Promise<number>;
+
+        png(path: string, level: number, options?: JobOptions): Promise<boolean>;
+        jpeg(path: string, quality: number, options?: JobOptions): Promise<boolean>;
+        gif(path: string, options?: JobOptions): Promise<boolean>;
+        wbmp(path: string, foreground: 0x000000 | 0xffffff | number, options?: JobOptions): Promise<boolean>;
+        bmp(path: string, compression: 0 | 1, options?: JobOptions): Promise<boolean>;
+        tiff(path: string, options?: JobOptions): Promise<boolean>;
+        webp(path: string, quality?: number, options?: JobOptions): Promise<boolean>;
+        heif(path: string, quality?: number, options?: JobOptions): Promise<boolean>;
+        avif(path: string, quality?: number, options?: JobOptions): Promise<boolean>;
+
+        png(fd: SaveFd, level: number, options?: SaveFdOptions): Promise<number>;
+        jpeg(fd: SaveFd, quality: number, options?: SaveFdOptions): Promise<number>;
+        gif(fd: SaveFd, options?: SaveFdOptions): Promise<number>;
+        wbmp(fd: SaveFd, foreground: 0x000000 | 0xffffff | number, options?: SaveFdOptions): Promise<number>;
+        bmp(fd: SaveFd, compression: 0 | 1, options?: SaveFdOptions): Promise<number>;
+        tiff(fd: SaveFd, options?: SaveFdOptions): Promise<number>;
+        webp(fd: SaveFd, quality?: number, options?: SaveFdOptions): Promise<number>;
+        heif(fd: SaveFd, quality?: number, options?: SaveFdOptions): Promise<number>;
+        avif(fd: SaveFd, quality?: number, options?: SaveFdOptions): Promise<number>;
+
+        file(path: string, options?: JobOptions): Promise<boolean>;
+
+        // Encoding to a Buffer on the thread pool
+
+        pngPtrAsync(level?: number, options?: JobOptions): Promise<Buffer>;
+        jpegPtrAsync(quality?: number, options?: JobOptions): Promise<Buffer>;
+        gifPtrAsync(options?: JobOptions): Promise<Buffer>;
+        wbmpPtrAsync(foreground: 0x000000 | 0xffffff | number, options?: JobOptions): Promise<Buffer>;
+        bmpPtrAsync(compression?: 0 | 1, options?: JobOptions): Promise<Buffer>;
+        tiffPtrAsync(options?: JobOptions): Promise<Buffer>;
+        webpPtrAsync(quality?: number, options?: JobOptions): Promise<Buffer>;
+        heifPtrAsync(quality?: number, codec?: 1 | 4, chroma?: '420' | '422' | '444', options?: JobOptions): Promise<Buffer>;
+        avifPtrAsync(quality?: number, speed?: number, options?: JobOptions): Promise<Buffer>;
+
+        // Encoding into a stream on the thread pool
+
+        encodeToStream(writable: NodeJS.WritableStream, format: PipelineFormat, options?: EncodeStreamOptions): Promise<number>;
+    }
+
+    type ImageHandle = {
+        id: string;
+        width: number;
+        height: number;
+        trueColor: boolean;
+    };
+
+    const Image: {
+        attach(handle: ImageHandle | string): gd.Image;
+
+        discard(handle: ImageHandle | string): boolean;
+    };
+
+    class DisplayList {
+        static readonly opcodes: Readonly<Record<string, number>>;
+        readonly commands: Float64Array;
+        strings: string[];
+        clear(): this;
+        drawTo(image: gd.Image): gd.Image;
+        drawToAsync(image: gd.Image, options?: JobOptions): Promise<gd.Image>;
+        setPixel(x: number, y: number, color: Color): this;
+        line(x1: number, y1: number, x2: number, y2: number, color: Color): this;
+        dashedLine(x1: number, y1: number, x2: number, y2: number, color: Color): this;
+        rectangle(x1: number, y1: number, x2: number, y2: number, color: Color): this;
+        filledRectangle(x1: number, y1: number, x2: number, y2: number, color: Color): this;
+        ellipse(cx: number, cy: number, width: number, height: number, color: Color): this;
+        filledEllipse(cx: number, cy: number, width: number, height: number, color: Color): this;
+        arc(cx: number, cy: number, width: number, height: number, begin: number, end: number, color: Color): this;
+        filledArc(cx: number, cy: number, width: number, height: number, begin: number, end: number, color: Color, style: number): this;
+        polygon(points: Point[] | Int32Array | Float64Array, color: Color): this;
+        openPolygon(points: Point[] | Int32Array | Float64Array, color: Color): this;
+        filledPolygon(points: Point[] | Int32Array | Float64Array, color: Color): this;
+        stringFT(color: Color, font: string, size: number, angle: number, x: number, y: number, text: string): this;
+        setThickness(thickness: number): this;
+        alphaBlending(flag: boolean | 0 | 1): this;
+        setClip(x1: number, y1: number, x2: number, y2: number): this;
     }
 
     export const enum AutoCrop {
@@ -7,7 +7,9 @@
 
 import gd from './lib/node-gd.js';
 import GifAnim from './lib/GifAnim.js';
+import DisplayList from './lib/DisplayList.js';
 
 gd.GifAnim = GifAnim;
+gd.DisplayList = DisplayList;
 
 export default gd;
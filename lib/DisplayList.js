@@ -0,0 +1,231 @@
+/**
+ * Recorder for lists of drawing commands which are replayed
+ * on a gd.Image in a single call
+ *
+ * MIT Licensed
+ */
+
+import bindings from './bindings.js';
+
+/**
+ * Opcodes of the display list format, mirrored from the
+ * DrawOpcode enum in src/node_gd_workers.cc
+ */
+const opcodes = Object.freeze({
+  SET_PIXEL: 1,
+  LINE: 2,
+  DASHED_LINE: 3,
+  RECTANGLE: 4,
+  FILLED_RECTANGLE: 5,
+  ELLIPSE: 6,
+  FILLED_ELLIPSE: 7,
+  ARC: 8,
+  FILLED_ARC: 9,
+  POLYGON: 10,
+  OPEN_POLYGON: 11,
+  FILLED_POLYGON: 12,
+  STRING_FT: 13,
+  SET_THICKNESS: 14,
+  ALPHA_BLENDING: 15,
+  SET_CLIP: 16,
+});
+
+export default class DisplayList {
+  constructor() {
+    this.buffer = new Float64Array(256);
+    this.length = 0;
+    this.strings = [];
+    this.stringIndexes = new Map();
+  }
+
+  static get opcodes() {
+    return opcodes;
+  }
+
+  /**
+   * The recorded commands, a view on the internal buffer
+   * @returns {Float64Array}
+   */
+  get commands() {
+    return this.buffer.subarray(0, this.length);
+  }
+
+  /**
+   * Remove all recorded commands
+   */
+  clear() {
+    this.length = 0;
+    this.strings = [];
+    this.stringIndexes.clear();
+    return this;
+  }
+
+  /**
+   * Replay the recorded commands on an image
+   * @param {gd.Image} image
+   * @returns {gd.Image}
+   */
+  drawTo(image) {
+    assertImage(image);
+    return image.drawCommands(this.commands, this.strings);
+  }
+
+  /**
+   * Replay the recorded commands on an image on the thread pool
+   * @param {gd.Image} image
+   * @param {object} options Job options such as the priority
+   * @returns {Promise<gd.Image>}
+   */
+  drawToAsync(image, options = {}) {
+    assertImage(image);
+    return image.drawCommandsAsync(this.commands, this.strings, options);
+  }
+
+  setPixel(x, y, color) {
+    return this.push(opcodes.SET_PIXEL, x, y, color);
+  }
+
+  line(x1, y1, x2, y2, color) {
+    return this.push(opcodes.LINE, x1, y1, x2, y2, color);
+  }
+
+  dashedLine(x1, y1, x2, y2, color) {
+    return this.push(opcodes.DASHED_LINE, x1, y1, x2, y2, color);
+  }
+
+  rectangle(x1, y1, x2, y2, color) {
+    return this.push(opcodes.RECTANGLE, x1, y1, x2, y2, color);
+  }
+
+  filledRectangle(x1, y1, x2, y2, color) {
+    return this.push(opcodes.FILLED_RECTANGLE, x1, y1, x2, y2, color);
+  }
+
+  ellipse(cx, cy, width, height, color) {
+    return this.push(opcodes.ELLIPSE, cx, cy, width, height, color);
+  }
+
+  filledEllipse(cx, cy, width, height, color) {
+    return this.push(opcodes.FILLED_ELLIPSE, cx, cy, width, height, color);
+  }
+
+  arc(cx, cy, width, height, begin, end, color) {
+    return this.push(opcodes.ARC, cx, cy, width, height, begin, end, color);
+  }
+
+  filledArc(cx, cy, width, height, begin, end, color, style) {
+    return this.push(
+      opcodes.FILLED_ARC,
+      cx,
+      cy,
+      width,
+      height,
+      begin,
+      end,
+      color,
+      style
+    );
+  }
+
+  polygon(points, color) {
+    return this.pushPolygon(opcodes.POLYGON, points, color);
+  }
+
+  openPolygon(points, color) {
+    return this.pushPolygon(opcodes.OPEN_POLYGON, points, color);
+  }
+
+  filledPolygon(points, color) {
+    return this.pushPolygon(opcodes.FILLED_POLYGON, points, color);
+  }
+
+  stringFT(color, font, size, angle, x, y, text) {
+    return this.push(
+      opcodes.STRING_FT,
+      color,
+      this.stringIndex(font),
+      size,
+      angle,
+      x,
+      y,
+      this.stringIndex(text)
+    );
+  }
+
+  setThickness(thickness) {
+    return this.push(opcodes.SET_THICKNESS, thickness);
+  }
+
+  alphaBlending(flag) {
+    return this.push(opcodes.ALPHA_BLENDING, flag ? 1 : 0);
+  }
+
+  setClip(x1, y1, x2, y2) {
+    return this.push(opcodes.SET_CLIP, x1, y1, x2, y2);
+  }
+
+  /**
+   * Append raw values to the list
+   */
+  push(...values) {
+    this.reserve(values.length);
+    this.buffer.set(values, this.length);
+    this.length += values.length;
+    return this;
+  }
+
+  /**
+   * Points are an array of {x, y} objects or a typed array
+   * of interleaved x and y coordinates
+   */
+  pushPolygon(opcode, points, color) {
+    if (ArrayBuffer.isView(points)) {
+      if (points.length % 2 !== 0) {
+        throw new RangeError('Points must hold pairs of x and y coordinates');
+      }
+      this.push(opcode, points.length / 2, color);
+      this.reserve(points.length);
+      this.buffer.set(points, this.length);
+      this.length += points.length;
+      return this;
+    }
+
+    this.push(opcode, points.length, color);
+    this.reserve(points.length * 2);
+    for (const point of points) {
+      this.buffer[this.length++] = point.x;
+      this.buffer[this.length++] = point.y;
+    }
+    return this;
+  }
+
+  reserve(count) {
+    if (this.length + count <= this.buffer.length) {
+      return;
+    }
+    let size = this.buffer.length * 2;
+    while (size < this.length + count) {
+      size *= 2;
+    }
+    const buffer = new Float64Array(size);
+    buffer.set(this.commands);
+    this.buffer = buffer;
+  }
+
+  stringIndex(string) {
+    string = String(string);
+    let index = this.stringIndexes.get(string);
+    if (index === undefined) {
+      index = this.strings.length;
+      this.strings.push(string);
+      this.stringIndexes.set(string, index);
+    }
+    return index;
+  }
+}
+
+function assertImage(image) {
+  if (!image || image.constructor !== bindings.Image) {
+    throw new Error('Display lists can only be drawn to an instance of gd.Image');
+  }
+}
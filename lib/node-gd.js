@@ -56,8 +56,8 @@ if (gd.GD_WEBP) {
  *                         when gd.openJpeg is called
  */
 function openFormatFn(format) {
-  return function (path = '') {
-    return gd[`createFrom${format}`].call(gd, path);
+  return function (path = '', options = {}) {
+    return gd[`createFrom${format}`].call(gd, path, options);
   };
 }
 
@@ -74,15 +74,23 @@ function saveFormatFn(format) {
       const args = [...arguments];
       const filename = args.shift();
 
+      if (typeof filename !== 'string' && !Buffer.isBuffer(filename) && !(filename instanceof URL)) {
+        // a file descriptor or FileHandle is written from the thread pool
+        return this[format.toLowerCase()](filename, ...args);
+      }
+
       return new Promise((resolve, reject) => {
-        const data = this[`${format.toLowerCase()}Ptr`].apply(this, args);
-
-        fs.writeFile(filename, data, 'latin1', error => {
-          if (error) {
-            return reject(error);
-          }
-          resolve(true);
-        });
+        // encode on the thread pool, not on the main thread
+        this[`${format.toLowerCase()}PtrAsync`]
+          .apply(this, args)
+          .then(data => {
+            fs.writeFile(filename, data, 'latin1', error => {
+              if (error) {
+                return reject(error);
+              }
+              resolve(true);
+            });
+          }, reject);
       });
     },
   }[`save${format}`];
@@ -109,7 +117,7 @@ formats.forEach(format => {
  * @param {string} file  Path of file to open
  * @returns {Promise<gd.Image>}
  */
-function openFile(file) {
+function openFile(file, options = {}) {
   return new Promise((resolve, reject) => {
     const filePath = path.normalize(file);
 
@@ -118,13 +126,203 @@ function openFile(file) {
         return reject(error);
       }
 
-      resolve(gd.createFromFile(filePath));
+      resolve(gd.createFromFile(filePath, options));
     });
   });
 }
 
 gd.openFile = openFile;
 
+/**
+ * Decode an image from a Readable stream while it is being received
+ * Chunks are copied into a bounded buffer which the decoder reads from on
+ * the thread pool. The stream is paused while the buffer is full.
+ *
+ * @param {stream.Readable} readable  Stream of the encoded image
+ * @param {string} format             Format of the image, such as 'jpeg'
+ * @param {object} options            highWaterMark, decode and job options
+ * @returns {Promise<gd.Image>}
+ */
+function createFromStream(readable, format, options = {}) {
+  const { highWaterMark = 256 * 1024, ...decodeOptions } = options;
+  let pending = null;
+  let ended = false;
+  let done = false;
+  let streamError = null;
+
+  const decoder = gd.createStreamDecoder(
+    String(format),
+    highWaterMark,
+    () => {
+      // the decoder made space in the buffer, or is done
+      if (done) {
+        return;
+      }
+      if (pending) {
+        const written = decoder.write(pending);
+        pending = written < pending.length ? pending.subarray(written) : null;
+      }
+      if (pending) {
+        return;
+      }
+      if (ended) {
+        decoder.end();
+      } else {
+        readable.resume();
+      }
+    },
+    decodeOptions
+  );
+
+  function onData(chunk) {
+    const data = typeof chunk === 'string' ? Buffer.from(chunk) : chunk;
+    const written = decoder.write(data);
+    if (written < data.length) {
+      pending = data.subarray(written);
+      readable.pause();
+    }
+  }
+
+  function onEnd() {
+    ended = true;
+    if (!pending) {
+      decoder.end();
+    }
+  }
+
+  function onError(error) {
+    streamError = error;
+    decoder.abort(error.message);
+  }
+
+  function ignoreError() {}
+
+  function cleanup(failed) {
+    done = true;
+    readable.off('data', onData);
+    readable.off('end', onEnd);
+    readable.off('error', onError);
+
+    // an error of the stream after the decoder settled must not crash the
+    // process, the listener stays until the stream is closed
+    readable.on('error', ignoreError);
+    readable.once('close', () => readable.off('error', ignoreError));
+
+    if (failed) {
+      readable.destroy();
+    } else {
+      // drain what the decoder did not need
+      readable.resume();
+    }
+  }
+
+  readable.on('data', onData);
+  readable.once('end', onEnd);
+  readable.once('error', onError);
+
+  return decoder.promise.then(
+    image => {
+      cleanup(false);
+      return image;
+    },
+    error => {
+      cleanup(true);
+      throw streamError || error;
+    }
+  );
+}
+
+gd.createFromStream = createFromStream;
+
+/**
+ * Encode an image into a Writable stream while the encoder is running
+ * The encoder hands over chunks of chunkSize bytes from the thread pool and
+ * waits while the stream asks for it through write() returning false.
+ *
+ * @param {stream.Writable} writable  Destination of the encoded image
+ * @param {string} format             Format to encode to, such as 'png'
+ * @param {object} options            chunkSize, end, encoder and job options
+ * @returns {Promise<number>} Number of bytes written
+ */
+function encodeToStream(writable, format, options = {}) {
+  const { chunkSize = 64 * 1024, end = true, ...encodeOptions } = options;
+  let streamError = null;
+
+  return new Promise((resolve, reject) => {
+    let bytes = null;
+    let flushed = false;
+
+    function finish() {
+      if (bytes === null || !flushed) {
+        return;
+      }
+      cleanup();
+      if (streamError) {
+        return reject(streamError);
+      }
+      if (!end) {
+        return resolve(bytes);
+      }
+      writable.end(() => resolve(bytes));
+    }
+
+    const encoder = this.createStreamEncoder(
+      String(format),
+      chunkSize,
+      chunk => {
+        // null marks the end of the data
+        if (chunk === null) {
+          flushed = true;
+          return finish();
+        }
+        if (streamError) {
+          return;
+        }
+        if (writable.write(chunk)) {
+          encoder.credit();
+        } else {
+          writable.once('drain', encoder.credit);
+        }
+      },
+      encodeOptions
+    );
+
+    function onError(error) {
+      streamError = error;
+      encoder.abort();
+    }
+
+    function cleanup() {
+      writable.off('error', onError);
+      writable.off('drain', encoder.credit);
+    }
+
+    writable.once('error', onError);
+
+    encoder.promise.then(
+      written => {
+        bytes = written;
+        finish();
+      },
+      error => {
+        const reason = streamError || error;
+        writable.off('drain', encoder.credit);
+        if (end && !streamError) {
+          // the error listener stays, it takes the error emitted by destroy()
+          writable.destroy(error instanceof Error ? error : new Error(error));
+        } else {
+          cleanup();
+        }
+        reject(reason);
+      }
+    );
+  });
+}
+
+Object.defineProperty(gd.Image.prototype, 'encodeToStream', {
+  value: encodeToStream,
+});
+
 gd.toString = function toString() {
   return '[object Gd]';
 };
@@ -19,12 +19,26 @@
 #include <napi.h>
 #include <sstream>
 #include <cstring>
+#include <map>
+#include <mutex>
+#include <random>
 #include "node_gd.h"
+#include "node_gd_memory.cc"
+#include "node_gd_probe.cc"
+#include "node_gd_pool.cc"
+#include "node_gd_raster_pool.cc"
+#include "node_gd_stream.cc"
+#include "node_gd_mmap.cc"
+#include "node_gd_jpeg.cc"
+#include "node_gd_fd.cc"
 #include "node_gd_workers.cc"
 #include <gd_errors.h>
 
 Napi::Object Gd::Init(Napi::Env env, Napi::Object exports)
 {
+  // node-gd keeps no state in globals, it is initialized once for every
+  // environment it is loaded in, such as worker threads
+  env.SetInstanceData(new GdInstanceData());
 
   /**
    * Section E - Meta information
@@ -125,6 +139,7 @@ Napi::Object Gd::Init(Napi::Env env, Napi::Object exports)
   exports.Set(Napi::String::New(env, "createTrueColor"), Napi::Function::New(env, ImageCreateTrueColor));
   exports.Set(Napi::String::New(env, "createSync"), Napi::Function::New(env, ImageCreateSync));
   exports.Set(Napi::String::New(env, "createTrueColorSync"), Napi::Function::New(env, ImageCreateTrueColorSync));
+  exports.Set(Napi::String::New(env, "createTrueColorShared"), Napi::Function::New(env, ImageCreateTrueColorShared));
   exports.Set(Napi::String::New(env, "createFromJpeg"), Napi::Function::New(env, CreateFromJpeg));
   exports.Set(Napi::String::New(env, "createFromJpegPtr"), Napi::Function::New(env, CreateFromJpegPtr));
   exports.Set(Napi::String::New(env, "createFromPng"), Napi::Function::New(env, CreateFromPng));
@@ -155,10 +170,30 @@ Napi::Object Gd::Init(Napi::Env env, Napi::Object exports)
 #endif
 
   exports.Set(Napi::String::New(env, "createFromFile"), Napi::Function::New(env, CreateFromFile));
+  exports.Set(Napi::String::New(env, "createStreamDecoder"), Napi::Function::New(env, CreateStreamDecoder));
+  exports.Set(Napi::String::New(env, "createFromRGBA"), Napi::Function::New(env, CreateFromRGBA));
+  exports.Set(Napi::String::New(env, "createFromRGBASync"), Napi::Function::New(env, CreateFromRGBASync));
+  exports.Set(Napi::String::New(env, "pipeline"), Napi::Function::New(env, Pipeline));
+  exports.Set(Napi::String::New(env, "probe"), Napi::Function::New(env, Probe));
+  exports.Set(Napi::String::New(env, "probeSync"), Napi::Function::New(env, ProbeSync));
   exports.Set(Napi::String::New(env, "trueColor"), Napi::Function::New(env, TrueColor));
   exports.Set(Napi::String::New(env, "trueColorAlpha"), Napi::Function::New(env, TrueColorAlpha));
   exports.Set(Napi::String::New(env, "getGDVersion"), Napi::Function::New(env, GdVersionGetter));
 
+  // Thread pool
+  GdPool::Init(env);
+  exports.Set(Napi::String::New(env, "setConcurrency"), Napi::Function::New(env, SetConcurrency));
+  exports.Set(Napi::String::New(env, "getQueueStats"), Napi::Function::New(env, GetQueueStats));
+  exports.Set(Napi::String::New(env, "setLaneLimit"), Napi::Function::New(env, SetLaneLimit));
+
+  // Memory
+  exports.Set(Napi::String::New(env, "setImagePoolLimit"), Napi::Function::New(env, SetImagePoolLimit));
+  exports.Set(Napi::String::New(env, "getImagePoolStats"), Napi::Function::New(env, GetImagePoolStats));
+  exports.Set(Napi::String::New(env, "setMemoryLimit"), Napi::Function::New(env, SetMemoryLimit));
+  exports.Set(Napi::String::New(env, "memoryUsage"), Napi::Function::New(env, MemoryUsage));
+  exports.Set(Napi::String::New(env, "setDecodeLimits"), Napi::Function::New(env, SetDecodeLimits));
+  exports.Set(Napi::String::New(env, "setMmapThreshold"), Napi::Function::New(env, SetMmapThreshold));
+
   Gd::Image::Init(env, exports);
 
   return exports;
@@ -174,6 +209,8 @@ Napi::Value Gd::ImageCreate(const Napi::CallbackInfo &info)
   INT_ARG_RANGE(height, "height");
 
   CreateWorker *worker = new CreateWorker(info.Env(), "CreateWorkerResource", width, height, 0);
+  worker->SetMemoryCost(ImageBytes(width, height, false));
+  JOB_OPTIONS_ARG(2, worker, "");
   worker->Queue();
 
   return worker->_deferred.Promise();
@@ -189,6 +226,8 @@ Napi::Value Gd::ImageCreateTrueColor(const Napi::CallbackInfo &info)
   INT_ARG_RANGE(height, "height");
 
   CreateWorker *worker = new CreateWorker(info.Env(), "CreateWorkerResource", width, height, 1);
+  worker->SetMemoryCost(ImageBytes(width, height, true));
+  JOB_OPTIONS_ARG(2, worker, "");
   worker->Queue();
 
   return worker->_deferred.Promise();
@@ -203,7 +242,9 @@ Napi::Value Gd::ImageCreateSync(const Napi::CallbackInfo &info)
   INT_ARG_RANGE(width, "width");
   INT_ARG_RANGE(height, "height");
 
-  gdImagePtr img = gdImageCreate(width, height);
+  CHECK_MEMORY_LIMIT(ImageBytes(width, height, false));
+
+  gdImagePtr img = RasterPool::Instance().Create(width, height, false);
 
   RETURN_IMAGE(img);
 }
@@ -217,11 +258,107 @@ Napi::Value Gd::ImageCreateTrueColorSync(const Napi::CallbackInfo &info)
   INT_ARG_RANGE(width, "width");
   INT_ARG_RANGE(height, "height");
 
-  gdImagePtr img = gdImageCreateTrueColor(width, height);
+  CHECK_MEMORY_LIMIT(ImageBytes(width, height, true));
+
+  gdImagePtr img = RasterPool::Instance().Create(width, height, true);
 
   RETURN_IMAGE(img);
 }
 
+/**
+ * Create a true color image of which the pixel rows point into data, which
+ * holds width * height pixels without padding. The rows are not owned by
+ * the image and must be detached before gdImageDestroy().
+ */
+static gdImagePtr CreateTrueColorOn(int width, int height, uint8_t *data)
+{
+  // libgd initializes all other members, its single row is replaced
+  gdImagePtr image = gdImageCreateTrueColor(1, 1);
+  if (image == nullptr)
+  {
+    return nullptr;
+  }
+
+  int **rows = (int **)gdMalloc(sizeof(int *) * height);
+  if (rows == nullptr)
+  {
+    gdImageDestroy(image);
+    return nullptr;
+  }
+  for (int y = 0; y < height; y++)
+  {
+    rows[y] = (int *)(data + (size_t)y * width * sizeof(int));
+  }
+
+  gdFree(image->tpixels[0]);
+  gdFree(image->tpixels);
+  image->tpixels = rows;
+  image->sx = width;
+  image->sy = height;
+  image->cx2 = width - 1;
+  image->cy2 = height - 1;
+
+  return image;
+}
+
+Napi::Value Gd::ImageCreateTrueColorShared(const Napi::CallbackInfo &info)
+{
+  REQ_ARGS(2, "width and height.");
+  REQ_INT_ARG(0, width, "A value for 'width' should be supplied.");
+  REQ_INT_ARG(1, height, "A value for 'height' should be supplied.");
+
+  INT_ARG_RANGE(width, "width");
+  INT_ARG_RANGE(height, "height");
+
+  size_t bytes = (size_t)width * height * sizeof(int);
+  if (bytes / sizeof(int) / width != (size_t)height || bytes > (size_t)INT_MAX)
+  {
+    Napi::RangeError::New(info.Env(), "Image dimensions are too large for a SharedArrayBuffer")
+        .ThrowAsJavaScriptException();
+    return info.Env().Null();
+  }
+
+  CHECK_MEMORY_LIMIT(ImageBytes(width, height, true));
+
+  Napi::Function sharedArrayBuffer = info.Env().Global().Get("SharedArrayBuffer").As<Napi::Function>();
+  Napi::Object buffer;
+  if (info.Length() > 2 && !info[2].IsUndefined())
+  {
+    if (!info[2].IsObject() || !info[2].As<Napi::Object>().InstanceOf(sharedArrayBuffer))
+    {
+      Napi::TypeError::New(info.Env(), "Argument 2 must be a SharedArrayBuffer")
+          .ThrowAsJavaScriptException();
+      return info.Env().Null();
+    }
+    buffer = info[2].As<Napi::Object>();
+    if (buffer.Get("byteLength").As<Napi::Number>().DoubleValue() < (double)bytes)
+    {
+      Napi::RangeError::New(info.Env(), "SharedArrayBuffer is too small for an image of this size")
+          .ThrowAsJavaScriptException();
+      return info.Env().Null();
+    }
+  }
+  else
+  {
+    buffer = sharedArrayBuffer.New({Napi::Number::New(info.Env(), (double)bytes)});
+  }
+
+  // N-API cannot read the address of a SharedArrayBuffer, only of a view
+  Napi::TypedArray view = info.Env().Global().Get("Uint8Array").As<Napi::Function>().New({buffer}).As<Napi::TypedArray>();
+
+  gdImagePtr img = CreateTrueColorOn(width, height, TypedArrayBytes(view));
+  if (img == nullptr)
+  {
+    return info.Env().Null();
+  }
+
+  Napi::Value argv = Napi::External<gdImagePtr>::New(info.Env(), &img);
+  Napi::Object instance = Gd::Image::Constructor(info.Env()).New({argv});
+  Napi::ObjectWrap<Gd::Image>::Unwrap(instance)->SetSharedBuffer(buffer);
+
+  return instance;
+}
+
 /**
  * These DECLARE_CREATE_FROM macro calls create functions
  * that return Promises
@@ -253,6 +390,104 @@ Napi::Value Gd::CreateFromFile(const Napi::CallbackInfo &info)
   return CreateFromFileWorker::DoWork(info);
 }
 
+/**
+ * Returns the functions to feed a decoder with stream chunks and its
+ * Promise, gd.createFromStream() in lib/node-gd.js drives it
+ */
+Napi::Value Gd::CreateStreamDecoder(const Napi::CallbackInfo &info)
+{
+  return CreateFromStreamWorker::DoWork(info);
+}
+
+/**
+ * Returns a Promise
+ */
+Napi::Value Gd::CreateFromRGBA(const Napi::CallbackInfo &info)
+{
+  return CreateFromRGBAWorker::DoWork(info);
+}
+
+Napi::Value Gd::CreateFromRGBASync(const Napi::CallbackInfo &info)
+{
+  REQ_ARGS(3, "width, height and pixel data.");
+  REQ_INT_ARG(0, width, "A value for 'width' should be supplied.");
+  REQ_INT_ARG(1, height, "A value for 'height' should be supplied.");
+
+  INT_ARG_RANGE(width, "width");
+  INT_ARG_RANGE(height, "height");
+
+  size_t stride;
+  int alphaMode;
+  if (!PixelOptionsArg(info, 3, width, stride, alphaMode))
+  {
+    return info.Env().Null();
+  }
+
+  Napi::TypedArray source = PixelArrayArg(info, 2, PixelDataLength(width, height, stride), false);
+  if (source.IsEmpty())
+  {
+    return info.Env().Null();
+  }
+
+  CHECK_MEMORY_LIMIT(ImageBytes(width, height, true));
+
+  gdImagePtr img = CreateFromRGBAWorker::CreateImage(width, height, TypedArrayBytes(source),
+                                                     stride, alphaMode);
+
+  RETURN_IMAGE(img);
+}
+
+/**
+ * Returns a Promise resolving to a Buffer
+ */
+Napi::Value Gd::Pipeline(const Napi::CallbackInfo &info)
+{
+  return PipelineWorker::DoWork(info);
+}
+
+/**
+ * Returns a Promise resolving to the header information
+ */
+Napi::Value Gd::Probe(const Napi::CallbackInfo &info)
+{
+  return ProbeWorker::DoWork(info);
+}
+
+Napi::Value Gd::ProbeSync(const Napi::CallbackInfo &info)
+{
+  REQ_ARGS(1, "a Buffer or a path to an image file.");
+
+  ProbeResult result;
+  std::string error;
+  if (info[0].IsBuffer())
+  {
+    Napi::Buffer<unsigned char> buffer = info[0].As<Napi::Buffer<unsigned char> >();
+    ProbeReader in(buffer.Data(), buffer.Length());
+    if (!ProbeImage(in, result))
+    {
+      error = "Cannot read image header";
+    }
+  }
+  else if (info[0].IsString())
+  {
+    ProbeFile(info[0].As<Napi::String>().Utf8Value(), result, error);
+  }
+  else
+  {
+    Napi::TypeError::New(info.Env(), "Argument 0 must be a Buffer or a string.")
+        .ThrowAsJavaScriptException();
+    return info.Env().Null();
+  }
+
+  if (!error.empty())
+  {
+    Napi::Error::New(info.Env(), error).ThrowAsJavaScriptException();
+    return info.Env().Null();
+  }
+
+  return ProbeResultObject(info.Env(), result);
+}
+
 Napi::Value Gd::TrueColor(const Napi::CallbackInfo &info)
 {
   REQ_ARGS(3, "red, green and blue.");
@@ -286,6 +521,188 @@ Napi::Value Gd::GdVersionGetter(const Napi::CallbackInfo &info)
   return s;
 }
 
+/**
+ * Section F - Thread pool
+ */
+Napi::Value Gd::SetConcurrency(const Napi::CallbackInfo &info)
+{
+  REQ_ARGS(1, "amount of threads.");
+  REQ_INT_ARG(0, concurrency, "The amount of threads should be supplied.");
+
+  if (concurrency < 1 || concurrency > 1024)
+  {
+    Napi::RangeError::New(info.Env(), "Value for concurrency must be between 1 and 1024")
+        .ThrowAsJavaScriptException();
+    return info.Env().Null();
+  }
+
+  GdPool::Instance().SetConcurrency(concurrency);
+
+  return info.Env().Undefined();
+}
+
+Napi::Value Gd::GetQueueStats(const Napi::CallbackInfo &info)
+{
+  GdPool::Stats stats = GdPool::Instance().GetStats();
+
+  Napi::Object result = Napi::Object::New(info.Env());
+  result.Set("concurrency", Napi::Number::New(info.Env(), stats.concurrency));
+  result.Set("threads", Napi::Number::New(info.Env(), stats.threads));
+  result.Set("queued", Napi::Number::New(info.Env(), stats.queued));
+  result.Set("running", Napi::Number::New(info.Env(), stats.running));
+  result.Set("completed", Napi::Number::New(info.Env(), (double)stats.completed));
+  result.Set("aborted", Napi::Number::New(info.Env(), (double)stats.aborted));
+  result.Set("pending", Napi::Number::New(info.Env(), GdPool::Pending(info.Env())));
+
+  Napi::Object priorities = Napi::Object::New(info.Env());
+  priorities.Set("interactive", Napi::Number::New(info.Env(), stats.queuedByPriority[GD_PRIORITY_INTERACTIVE]));
+  priorities.Set("batch", Napi::Number::New(info.Env(), stats.queuedByPriority[GD_PRIORITY_BATCH]));
+  result.Set("queuedByPriority", priorities);
+
+  Napi::Object lanes = Napi::Object::New(info.Env());
+  for (auto &entry : stats.lanes)
+  {
+    Napi::Object lane = Napi::Object::New(info.Env());
+    lane.Set("limit", Napi::Number::New(info.Env(), entry.second.limit));
+    lane.Set("running", Napi::Number::New(info.Env(), entry.second.running));
+    lane.Set("queued", Napi::Number::New(info.Env(), entry.second.queued));
+    lanes.Set(entry.first, lane);
+  }
+  result.Set("lanes", lanes);
+
+  return result;
+}
+
+Napi::Value Gd::SetLaneLimit(const Napi::CallbackInfo &info)
+{
+  REQ_ARGS(2, "lane and maximum amount of running jobs.");
+  REQ_STR_ARG(0, lane, "The lane, an image format like 'avif', should be supplied.");
+  REQ_INT_ARG(1, limit, "The maximum amount of running jobs should be supplied, 0 for no limit.");
+
+  if (limit < 0)
+  {
+    Napi::RangeError::New(info.Env(), "Value for limit must be 0 or greater")
+        .ThrowAsJavaScriptException();
+    return info.Env().Null();
+  }
+
+  std::transform(lane.begin(), lane.end(), lane.begin(), ::tolower);
+  GdPool::Instance().SetLaneLimit(lane, limit);
+
+  return info.Env().Undefined();
+}
+
+/**
+ * Section G - Memory
+ */
+Napi::Value Gd::SetImagePoolLimit(const Napi::CallbackInfo &info)
+{
+  REQ_ARGS(1, "maximum amount of bytes.");
+  REQ_DOUBLE_ARG(0, limit);
+
+  if (!(limit >= 0))
+  {
+    Napi::RangeError::New(info.Env(), "Value for limit must be 0 or greater")
+        .ThrowAsJavaScriptException();
+    return info.Env().Null();
+  }
+
+  RasterPool::Instance().SetLimit((size_t)std::min(limit, (double)SIZE_MAX));
+
+  return info.Env().Undefined();
+}
+
+Napi::Value Gd::GetImagePoolStats(const Napi::CallbackInfo &info)
+{
+  RasterPool::Stats stats = RasterPool::Instance().GetStats();
+
+  Napi::Object result = Napi::Object::New(info.Env());
+  result.Set("limit", Napi::Number::New(info.Env(), (double)stats.limit));
+  result.Set("bytes", Napi::Number::New(info.Env(), (double)stats.bytes));
+  result.Set("images", Napi::Number::New(info.Env(), (double)stats.rasters));
+  result.Set("hits", Napi::Number::New(info.Env(), (double)stats.hits));
+  result.Set("misses", Napi::Number::New(info.Env(), (double)stats.misses));
+
+  return result;
+}
+
+Napi::Value Gd::SetMemoryLimit(const Napi::CallbackInfo &info)
+{
+  REQ_ARGS(1, "maximum amount of bytes.");
+  REQ_DOUBLE_ARG(0, limit);
+  OPT_STR_ARG(1, mode, "reject");
+
+  if (!(limit >= 0))
+  {
+    Napi::RangeError::New(info.Env(), "Value for limit must be 0 or greater")
+        .ThrowAsJavaScriptException();
+    return info.Env().Null();
+  }
+  if (mode != "reject" && mode != "queue")
+  {
+    Napi::RangeError::New(info.Env(), "Value for mode must be 'reject' (default) or 'queue'")
+        .ThrowAsJavaScriptException();
+    return info.Env().Null();
+  }
+
+  MemoryBudget::Instance().SetLimit((size_t)std::min(limit, (double)SIZE_MAX),
+                                    mode == "queue" ? MemoryBudget::MEMORY_LIMIT_QUEUE
+                                                    : MemoryBudget::MEMORY_LIMIT_REJECT);
+
+  return info.Env().Undefined();
+}
+
+Napi::Value Gd::MemoryUsage(const Napi::CallbackInfo &info)
+{
+  MemoryBudget::Usage usage = MemoryBudget::Instance().GetUsage();
+
+  Napi::Object result = Napi::Object::New(info.Env());
+  result.Set("images", Napi::Number::New(info.Env(), (double)usage.images));
+  result.Set("reserved", Napi::Number::New(info.Env(), (double)usage.reserved));
+  result.Set("pool", Napi::Number::New(info.Env(), (double)RasterPool::Instance().GetStats().bytes));
+  result.Set("limit", Napi::Number::New(info.Env(), (double)usage.limit));
+  result.Set("mode", Napi::String::New(info.Env(), usage.mode == MemoryBudget::MEMORY_LIMIT_QUEUE ? "queue" : "reject"));
+  result.Set("rejected", Napi::Number::New(info.Env(), (double)usage.rejected));
+
+  return result;
+}
+
+Napi::Value Gd::SetDecodeLimits(const Napi::CallbackInfo &info)
+{
+  if (info.Length() < 1 || !info[0].IsObject())
+  {
+    Napi::TypeError::New(info.Env(), "Argument 0 must be an object with maxPixels, maxWidth or maxHeight.")
+        .ThrowAsJavaScriptException();
+    return info.Env().Null();
+  }
+
+  DecodeLimits limits{0, 0, 0};
+  if (!ReadDecodeLimitsObject(info.Env(), info[0].As<Napi::Object>(), limits))
+  {
+    return info.Env().Null();
+  }
+  DecodeLimits::SetDefault(limits);
+
+  return info.Env().Undefined();
+}
+
+Napi::Value Gd::SetMmapThreshold(const Napi::CallbackInfo &info)
+{
+  REQ_ARGS(1, "minimum size in bytes.");
+  REQ_DOUBLE_ARG(0, bytes);
+
+  if (!(bytes >= 0))
+  {
+    Napi::RangeError::New(info.Env(), "Value for threshold must be 0 or greater")
+        .ThrowAsJavaScriptException();
+    return info.Env().Null();
+  }
+
+  MmapThreshold::Set((uint64_t)std::min(bytes, (double)UINT64_MAX));
+
+  return info.Env().Undefined();
+}
+
 /**
  * Image is a subclass of Gd
  */
@@ -296,37 +713,50 @@ Napi::Object Gd::Image::Init(Napi::Env env, Napi::Object exports)
   Napi::Function func =
       DefineClass(env, "Image", {
         InstanceMethod("destroy", &Gd::Image::Destroy),
+            InstanceMethod("detach", &Gd::Image::Detach),
+            StaticMethod("attach", &Gd::Image::Attach),
+            StaticMethod("discard", &Gd::Image::Discard),
 
             /**
              * Type transform functions
              */
             InstanceMethod("jpeg", &Gd::Image::Jpeg),
             InstanceMethod("jpegPtr", &Gd::Image::JpegPtr),
+            InstanceMethod("jpegPtrAsync", &Gd::Image::JpegPtrAsync),
             InstanceMethod("png", &Gd::Image::Png),
             InstanceMethod("pngPtr", &Gd::Image::PngPtr),
+            InstanceMethod("pngPtrAsync", &Gd::Image::PngPtrAsync),
             InstanceMethod("gif", &Gd::Image::Gif),
             InstanceMethod("gifPtr", &Gd::Image::GifPtr),
+            InstanceMethod("gifPtrAsync", &Gd::Image::GifPtrAsync),
             InstanceMethod("wbmp", &Gd::Image::WBMP),
             InstanceMethod("wbmpPtr", &Gd::Image::WBMPPtr),
+            InstanceMethod("wbmpPtrAsync", &Gd::Image::WBMPPtrAsync),
 #if HAS_LIBWEBP
             InstanceMethod("webp", &Gd::Image::Webp),
             InstanceMethod("webpPtr", &Gd::Image::WebpPtr),
+            InstanceMethod("webpPtrAsync", &Gd::Image::WebpPtrAsync),
 #endif
             InstanceMethod("bmp", &Gd::Image::Bmp),
             InstanceMethod("bmpPtr", &Gd::Image::BmpPtr),
+            InstanceMethod("bmpPtrAsync", &Gd::Image::BmpPtrAsync),
 #if HAS_LIBHEIF
             InstanceMethod("heif", &Gd::Image::Heif),
             InstanceMethod("heifPtr", &Gd::Image::HeifPtr),
+            InstanceMethod("heifPtrAsync", &Gd::Image::HeifPtrAsync),
 #endif
 #if HAS_LIBAVIF
             InstanceMethod("avif", &Gd::Image::Avif),
             InstanceMethod("avifPtr", &Gd::Image::AvifPtr),
+            InstanceMethod("avifPtrAsync", &Gd::Image::AvifPtrAsync),
 #endif
 #if HAS_LIBTIFF
             InstanceMethod("tiff", &Gd::Image::Tiff),
             InstanceMethod("tiffPtr", &Gd::Image::TiffPtr),
+            InstanceMethod("tiffPtrAsync", &Gd::Image::TiffPtrAsync),
 #endif
             InstanceMethod("file", &Gd::Image::File),
+            InstanceMethod("createStreamEncoder", &Gd::Image::CreateStreamEncoder),
 
             /**
              * Drawing Functions
@@ -356,6 +786,8 @@ Napi::Object Gd::Image::Init(Napi::Env env, Napi::Object exports)
             InstanceMethod("setClip", &Gd::Image::SetClip),
             InstanceMethod("getClip", &Gd::Image::GetClip),
             InstanceMethod("setResolution", &Gd::Image::SetResolution),
+            InstanceMethod("drawCommands", &Gd::Image::DrawCommands),
+            InstanceMethod("drawCommandsAsync", &Gd::Image::DrawCommandsAsync),
 
             /**
              * Query Functions
@@ -364,6 +796,10 @@ Napi::Object Gd::Image::Init(Napi::Env env, Napi::Object exports)
             InstanceMethod("getTrueColorPixel", &Gd::Image::GetTrueColorPixel),
             InstanceMethod("imageColorAt", &Gd::Image::ImageColorAt),
             InstanceMethod("getBoundsSafe", &Gd::Image::GetBoundsSafe),
+            InstanceMethod("getImageData", &Gd::Image::GetImageData),
+            InstanceMethod("getImageDataAsync", &Gd::Image::GetImageDataAsync),
+            InstanceMethod("putImageData", &Gd::Image::PutImageData),
+            InstanceMethod("putImageDataAsync", &Gd::Image::PutImageDataAsync),
 
             /**
              * Font and Text Handling Functions
@@ -458,11 +894,11 @@ Napi::Object Gd::Image::Init(Napi::Env env, Napi::Object exports)
             InstanceAccessor("resX", &Gd::Image::ResolutionXGetter, nullptr, napi_enumerable, nullptr),
             InstanceAccessor("resY", &Gd::Image::ResolutionYGetter, nullptr, napi_enumerable, nullptr),
             InstanceAccessor("interlace", &Gd::Image::InterlaceGetter, &Gd::Image::InterlaceSetter, static_cast<napi_property_attributes>(napi_writable | napi_enumerable), nullptr),
-            InstanceAccessor("colorsTotal", &Gd::Image::ColorsTotalGetter, nullptr, napi_enumerable, nullptr)
+            InstanceAccessor("colorsTotal", &Gd::Image::ColorsTotalGetter, nullptr, napi_enumerable, nullptr),
+            InstanceAccessor("sharedBuffer", &Gd::Image::SharedBufferGetter, nullptr, napi_enumerable, nullptr)
       });
 
-  constructor = Napi::Persistent(func);
-  constructor.SuppressDestruct();
+  env.GetInstanceData<GdInstanceData>()->imageConstructor = Napi::Persistent(func);
   exports.Set("Image", func);
   return exports;
 }
@@ -482,32 +918,312 @@ Gd::Image::Image(const Napi::CallbackInfo &info)
 
   this->_image = *imgPtr;
   this->_isDestroyed = false;
+
+  UpdateExternalMemory(info.Env());
 }
 
 Gd::Image::~Image()
 {
   if (this->_image != nullptr)
   {
-    gdImageDestroy(this->_image);
+    FreeImage();
 
     this->_isDestroyed = true;
     this->_image = nullptr;
   }
+
+  UpdateExternalMemory(Env());
+}
+
+void Gd::Image::FreeImage()
+{
+  if (!this->_sharedBuffer.IsEmpty())
+  {
+    // the rows belong to the SharedArrayBuffer, gdFree() skips them
+    for (int y = 0; y < gdImageSY(this->_image); y++)
+    {
+      this->_image->tpixels[y] = nullptr;
+    }
+    this->_sharedBuffer.Reset();
+
+    gdImageDestroy(this->_image);
+    return;
+  }
+
+  RasterPool::Instance().Destroy(this->_image);
+}
+
+void Gd::Image::SetSharedBuffer(Napi::Object buffer)
+{
+  this->_sharedBuffer = Napi::Persistent(buffer);
+
+  // the memory is already known to V8 as the SharedArrayBuffer
+  UpdateExternalMemory(buffer.Env());
+}
+
+/**
+ * Size in bytes of the pixel rows and row pointers libgd allocated for image
+ */
+int64_t Gd::Image::MemorySize(gdImagePtr image)
+{
+  if (image == nullptr)
+  {
+    return 0;
+  }
+
+  int64_t pixels = (int64_t)gdImageSX(image) * gdImageSY(image);
+  int64_t rows = (int64_t)gdImageSY(image) * sizeof(void *);
+
+  if (gdImageTrueColor(image))
+  {
+    return pixels * sizeof(int) + rows;
+  }
+
+  return pixels * sizeof(unsigned char) + rows;
+}
+
+/**
+ * Let V8 know how much native memory this image holds, so that the garbage
+ * collector takes it into account. Call after every change of _image or of
+ * its pixel storage.
+ */
+void Gd::Image::UpdateExternalMemory(Napi::Env env)
+{
+  int64_t pixels = MemorySize(this->_image);
+
+  if (pixels != this->_pixelMemory)
+  {
+    MemoryBudget::Instance().Adjust(pixels - this->_pixelMemory);
+    this->_pixelMemory = pixels;
+  }
+
+  int64_t size = this->_sharedBuffer.IsEmpty() ? pixels : 0;
+
+  if (size != this->_externalMemory)
+  {
+    Napi::MemoryManagement::AdjustExternalMemory(env, size - this->_externalMemory);
+    this->_externalMemory = size;
+  }
 }
 
 /**
  * Destruction, Loading and Saving Functions
  */
 Napi::Value Gd::Image::Destroy(const Napi::CallbackInfo &info)
+{
+  this->_isDestroyed = true;
+
+  // jobs on the thread pool still use the image, the last one to finish
+  // destroys it
+  if (this->_readers > 0 || this->_writer)
+  {
+    this->_destroyPending = true;
+    return info.Env().Undefined();
+  }
+
+  DestroyImage(info.Env());
+
+  return info.Env().Undefined();
+}
+
+void Gd::Image::DestroyImage(Napi::Env env)
 {
   if (this->_image != nullptr)
   {
-    gdImageDestroy(this->_image);
+    FreeImage();
   }
 
-  this->_isDestroyed = true;
   this->_image = nullptr;
-  return info.Env().Undefined();
+  this->_destroyPending = false;
+
+  UpdateExternalMemory(env);
+}
+
+bool Gd::Image::AcquireLease(bool exclusive)
+{
+  if (this->_writer || (exclusive && this->_readers > 0))
+  {
+    return false;
+  }
+
+  if (exclusive)
+  {
+    this->_writer = true;
+  }
+  else
+  {
+    this->_readers++;
+  }
+  return true;
+}
+
+void Gd::Image::ReleaseLease(Napi::Env env, bool exclusive)
+{
+  if (exclusive)
+  {
+    this->_writer = false;
+  }
+  else
+  {
+    this->_readers--;
+  }
+
+  if (this->_destroyPending && this->_readers == 0 && !this->_writer)
+  {
+    DestroyImage(env);
+  }
+}
+
+/**
+ * Images detached from a gd.Image, waiting to be attached in any thread
+ *
+ * Handles are random, so a handle of an image which was attached or
+ * discarded cannot be mistaken for another image later on.
+ */
+class ImageRegistry
+{
+public:
+  static ImageRegistry &Instance()
+  {
+    static ImageRegistry *registry = new ImageRegistry();
+    return *registry;
+  }
+
+  std::string Add(gdImagePtr image)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::string id;
+    do
+    {
+      std::ostringstream stream;
+      stream << std::hex << _random() << _random();
+      id = stream.str();
+    } while (_images.count(id) > 0);
+
+    _images[id] = image;
+    return id;
+  }
+
+  /**
+   * Remove the image of id from the registry, or return nullptr
+   */
+  gdImagePtr Take(const std::string &id)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = _images.find(id);
+    if (it == _images.end())
+    {
+      return nullptr;
+    }
+
+    gdImagePtr image = it->second;
+    _images.erase(it);
+    return image;
+  }
+
+private:
+  ImageRegistry() : _random(std::random_device()())
+  {
+  }
+
+  std::mutex _mutex;
+
+  std::mt19937_64 _random;
+
+  std::map<std::string, gdImagePtr> _images;
+};
+
+/**
+ * The id of a handle returned by detach(), or the id itself
+ */
+static bool ImageHandleArg(const Napi::CallbackInfo &info, std::string &id)
+{
+  if (info.Length() > 0 && info[0].IsString())
+  {
+    id = info[0].As<Napi::String>().Utf8Value();
+    return true;
+  }
+  if (info.Length() > 0 && info[0].IsObject() && info[0].As<Napi::Object>().Get("id").IsString())
+  {
+    id = info[0].As<Napi::Object>().Get("id").As<Napi::String>().Utf8Value();
+    return true;
+  }
+
+  Napi::TypeError::New(info.Env(), "Argument 0 must be a handle returned by detach()")
+      .ThrowAsJavaScriptException();
+  return false;
+}
+
+Napi::Value Gd::Image::Detach(const Napi::CallbackInfo &info)
+{
+  CHECK_IMAGE_WRITABLE;
+
+  if (!this->_sharedBuffer.IsEmpty())
+  {
+    Napi::Error::New(info.Env(), "Images on a SharedArrayBuffer cannot be detached, pass their sharedBuffer instead")
+        .ThrowAsJavaScriptException();
+    return info.Env().Null();
+  }
+
+  gdImagePtr image = this->_image;
+  this->_image = nullptr;
+  this->_isDestroyed = true;
+  // the pixels stay in the memory budget until the image is attached or
+  // discarded, only the external memory of this thread is given back
+  this->_pixelMemory = 0;
+  UpdateExternalMemory(info.Env());
+
+  Napi::Object handle = Napi::Object::New(info.Env());
+  handle.Set("id", Napi::String::New(info.Env(), ImageRegistry::Instance().Add(image)));
+  handle.Set("width", Napi::Number::New(info.Env(), gdImageSX(image)));
+  handle.Set("height", Napi::Number::New(info.Env(), gdImageSY(image)));
+  handle.Set("trueColor", Napi::Boolean::New(info.Env(), gdImageTrueColor(image)));
+
+  return handle;
+}
+
+Napi::Value Gd::Image::Attach(const Napi::CallbackInfo &info)
+{
+  std::string id;
+  if (!ImageHandleArg(info, id))
+  {
+    return info.Env().Null();
+  }
+
+  gdImagePtr image = ImageRegistry::Instance().Take(id);
+  if (image == nullptr)
+  {
+    Napi::Error::New(info.Env(), "Image handle is unknown or was already attached")
+        .ThrowAsJavaScriptException();
+    return info.Env().Null();
+  }
+
+  Napi::Value argv = Napi::External<gdImagePtr>::New(info.Env(), &image);
+  Napi::Object instance = Gd::Image::Constructor(info.Env()).New({argv});
+
+  // counted again by the new gd.Image
+  MemoryBudget::Instance().Adjust(-MemorySize(image));
+  return instance;
+}
+
+Napi::Value Gd::Image::Discard(const Napi::CallbackInfo &info)
+{
+  std::string id;
+  if (!ImageHandleArg(info, id))
+  {
+    return info.Env().Null();
+  }
+
+  gdImagePtr image = ImageRegistry::Instance().Take(id);
+  if (image != nullptr)
+  {
+    MemoryBudget::Instance().Adjust(-MemorySize(image));
+    RasterPool::Instance().Destroy(image);
+  }
+
+  return Napi::Boolean::New(info.Env(), image != nullptr);
 }
 
 Napi::Value Gd::Image::Jpeg(const Napi::CallbackInfo &info)
@@ -528,6 +1244,13 @@ Napi::Value Gd::Image::JpegPtr(const Napi::CallbackInfo &info)
   RETURN_DATA;
 }
 
+Napi::Value Gd::Image::JpegPtrAsync(const Napi::CallbackInfo &info)
+{
+  CHECK_IMAGE_EXISTS;
+
+  return JpegPtrWorker::DoWork(info, this->_image);
+}
+
 Napi::Value Gd::Image::Gif(const Napi::CallbackInfo &info)
 {
   CHECK_IMAGE_EXISTS;
@@ -542,7 +1265,14 @@ Napi::Value Gd::Image::GifPtr(const Napi::CallbackInfo &info)
   int size;
   char *data = (char *)gdImageGifPtr(this->_image, &size);
 
-  RETURN_DATA;
+  RETURN_DATA;
+}
+
+Napi::Value Gd::Image::GifPtrAsync(const Napi::CallbackInfo &info)
+{
+  CHECK_IMAGE_EXISTS;
+
+  return GifPtrWorker::DoWork(info, this->_image);
 }
 
 Napi::Value Gd::Image::Png(const Napi::CallbackInfo &info)
@@ -564,6 +1294,13 @@ Napi::Value Gd::Image::PngPtr(const Napi::CallbackInfo &info)
   RETURN_DATA
 }
 
+Napi::Value Gd::Image::PngPtrAsync(const Napi::CallbackInfo &info)
+{
+  CHECK_IMAGE_EXISTS;
+
+  return PngPtrWorker::DoWork(info, this->_image);
+}
+
 Napi::Value Gd::Image::WBMP(const Napi::CallbackInfo &info)
 {
   CHECK_IMAGE_EXISTS;
@@ -583,6 +1320,13 @@ Napi::Value Gd::Image::WBMPPtr(const Napi::CallbackInfo &info)
   RETURN_DATA
 }
 
+Napi::Value Gd::Image::WBMPPtrAsync(const Napi::CallbackInfo &info)
+{
+  CHECK_IMAGE_EXISTS;
+
+  return WBMPPtrWorker::DoWork(info, this->_image);
+}
+
 #if HAS_LIBWEBP
 Napi::Value Gd::Image::Webp(const Napi::CallbackInfo &info)
 {
@@ -602,6 +1346,13 @@ Napi::Value Gd::Image::WebpPtr(const Napi::CallbackInfo &info)
 
   RETURN_DATA
 }
+
+Napi::Value Gd::Image::WebpPtrAsync(const Napi::CallbackInfo &info)
+{
+  CHECK_IMAGE_EXISTS;
+
+  return WebpPtrWorker::DoWork(info, this->_image);
+}
 #endif
 
 Napi::Value Gd::Image::Bmp(const Napi::CallbackInfo &info)
@@ -623,6 +1374,13 @@ Napi::Value Gd::Image::BmpPtr(const Napi::CallbackInfo &info)
   RETURN_DATA
 }
 
+Napi::Value Gd::Image::BmpPtrAsync(const Napi::CallbackInfo &info)
+{
+  CHECK_IMAGE_EXISTS;
+
+  return BmpPtrWorker::DoWork(info, this->_image);
+}
+
 #if HAS_LIBTIFF
 Napi::Value Gd::Image::Tiff(const Napi::CallbackInfo &info)
 {
@@ -640,6 +1398,13 @@ Napi::Value Gd::Image::TiffPtr(const Napi::CallbackInfo &info)
 
   RETURN_DATA
 }
+
+Napi::Value Gd::Image::TiffPtrAsync(const Napi::CallbackInfo &info)
+{
+  CHECK_IMAGE_EXISTS;
+
+  return TiffPtrWorker::DoWork(info, this->_image);
+}
 #endif
 
 #if HAS_LIBHEIF
@@ -690,6 +1455,13 @@ Napi::Value Gd::Image::HeifPtr(const Napi::CallbackInfo &info)
 
   RETURN_DATA
 }
+
+Napi::Value Gd::Image::HeifPtrAsync(const Napi::CallbackInfo &info)
+{
+  CHECK_IMAGE_EXISTS;
+
+  return HeifPtrWorker::DoWork(info, this->_image);
+}
 #endif
 
 #if HAS_LIBAVIF
@@ -711,6 +1483,13 @@ Napi::Value Gd::Image::AvifPtr(const Napi::CallbackInfo &info)
 
   RETURN_DATA
 }
+
+Napi::Value Gd::Image::AvifPtrAsync(const Napi::CallbackInfo &info)
+{
+  CHECK_IMAGE_EXISTS;
+
+  return AvifPtrWorker::DoWork(info, this->_image);
+}
 #endif
 
 Napi::Value Gd::Image::File(const Napi::CallbackInfo &info)
@@ -720,12 +1499,19 @@ Napi::Value Gd::Image::File(const Napi::CallbackInfo &info)
   return FileWorker::DoWork(info, this->_image);
 }
 
+Napi::Value Gd::Image::CreateStreamEncoder(const Napi::CallbackInfo &info)
+{
+  CHECK_IMAGE_EXISTS;
+
+  return StreamEncodeWorker::DoWork(info, this->_image);
+}
+
 /**
  * Drawing Functions
  */
 Napi::Value Gd::Image::SetPixel(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(3, "x coordinate, y coordinate and color number.");
   REQ_INT_ARG(0, x, "A value for the x coordinate should be supplied.");
@@ -739,7 +1525,7 @@ Napi::Value Gd::Image::SetPixel(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::Line(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(5, "x1, y1, x2, y2 and a color value.");
   REQ_INT_ARG(0, x1, "A value for the x1 coordinate should be supplied.");
@@ -755,7 +1541,7 @@ Napi::Value Gd::Image::Line(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::DashedLine(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(5, "x1, y1, x2, y2 and a color value.");
   REQ_INT_ARG(0, x1, "A value for the x1 coordinate should be supplied.");
@@ -771,133 +1557,61 @@ Napi::Value Gd::Image::DashedLine(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::Polygon(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(2, "an array of coordinates and a color value.");
   REQ_INT_ARG(1, color, "A color number should supplied.");
 
-  if (!info[0].IsArray())
+  PolygonPoints points;
+  if (!points.Read(info, 0))
   {
-    Napi::TypeError::New(info.Env(), "Arguments 0 must be an array").ThrowAsJavaScriptException();
     return info.Env().Null();
   }
 
-  Napi::String x = Napi::String::New(info.Env(), "x");
-  Napi::String y = Napi::String::New(info.Env(), "y");
-
-  Napi::Array array = info[0].As<Napi::Array>();
-  unsigned int len = array.Length(), _len = 0;
-  gdPoint *points = new gdPoint[len];
-
-  for (unsigned int i = 0; i < len; i++)
-  {
-    Napi::Value v = array.Get(i);
-    if (!v.IsObject())
-      continue;
-
-    Napi::Object o = v.ToObject();
-    if (!o.Has(x) || !o.Has(y))
-      continue;
-
-    points[i].x = o.Get(x).As<Napi::Number>().Int32Value();
-    points[i].y = o.Get(y).As<Napi::Number>().Int32Value();
-    _len++;
-  }
-
-  gdImagePolygon(this->_image, points, _len, color);
-
-  delete[] points;
+  gdImagePolygon(this->_image, points.Data(), points.Count(), color);
 
   return info.This();
 }
 
 Napi::Value Gd::Image::OpenPolygon(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(2, "an array of coordinates and a color value.");
   REQ_INT_ARG(1, color, "A color number should supplied.");
 
-  if (!info[0].IsArray())
+  PolygonPoints points;
+  if (!points.Read(info, 0))
   {
-    Napi::TypeError::New(info.Env(), "Arguments 0 must be an array").ThrowAsJavaScriptException();
     return info.Env().Null();
   }
 
-  Napi::String x = Napi::String::New(info.Env(), "x");
-  Napi::String y = Napi::String::New(info.Env(), "y");
-
-  Napi::Array array = info[0].As<Napi::Array>();
-  unsigned int len = array.Length(), _len = 0;
-  gdPoint *points = new gdPoint[len];
-
-  for (unsigned int i = 0; i < len; i++)
-  {
-    Napi::Value v = array.Get(i);
-    if (!v.IsObject())
-      continue;
-
-    Napi::Object o = v.ToObject();
-    if (!o.Has(x) || !o.Has(y))
-      continue;
-
-    points[i].x = o.Get(x).As<Napi::Number>().Int32Value();
-    points[i].y = o.Get(y).As<Napi::Number>().Int32Value();
-    _len++;
-  }
-
-  gdImageOpenPolygon(this->_image, points, _len, color);
-
-  delete[] points;
+  gdImageOpenPolygon(this->_image, points.Data(), points.Count(), color);
 
   return info.This();
 }
 
 Napi::Value Gd::Image::FilledPolygon(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(2, "an array of coordinates and a color value.");
   REQ_INT_ARG(1, color, "A color number should supplied.");
 
-  if (!info[0].IsArray())
+  PolygonPoints points;
+  if (!points.Read(info, 0))
   {
-    Napi::TypeError::New(info.Env(), "Arguments 0 must be an array").ThrowAsJavaScriptException();
     return info.Env().Null();
   }
 
-  Napi::String x = Napi::String::New(info.Env(), "x");
-  Napi::String y = Napi::String::New(info.Env(), "y");
-
-  Napi::Array array = info[0].As<Napi::Array>();
-  unsigned int len = array.Length(), _len = 0;
-  gdPoint *points = new gdPoint[len];
-
-  for (unsigned int i = 0; i < len; i++)
-  {
-    Napi::Value v = array.Get(i);
-    if (!v.IsObject())
-      continue;
-
-    Napi::Object o = v.ToObject();
-    if (!o.Has(x) || !o.Has(y))
-      continue;
-
-    points[i].x = o.Get(x).As<Napi::Number>().Int32Value();
-    points[i].y = o.Get(y).As<Napi::Number>().Int32Value();
-    _len++;
-  }
-
-  gdImageFilledPolygon(this->_image, points, _len, color);
-
-  delete[] points;
+  gdImageFilledPolygon(this->_image, points.Data(), points.Count(), color);
 
   return info.This();
 }
 
 Napi::Value Gd::Image::Rectangle(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(5, "for x1, y1, x2, y2 and a color value.");
   REQ_INT_ARG(0, x1, "A value for the x1 coordinate should be supplied.");
@@ -913,7 +1627,7 @@ Napi::Value Gd::Image::Rectangle(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::FilledRectangle(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(5, "for x1, y1, x2, y2 and a color value.");
   REQ_INT_ARG(0, x1, "A value for the x1 coordinate should be supplied.");
@@ -929,7 +1643,7 @@ Napi::Value Gd::Image::FilledRectangle(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::Arc(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(7, "center x, center y, width, height, begin degrees, end degrees and color value.");
   REQ_INT_ARG(0, cx, "A value for the center x coordinate should be supplied.");
@@ -947,7 +1661,7 @@ Napi::Value Gd::Image::Arc(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::FilledArc(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(8, "center x, center y, width, height, begin degrees, end degrees, color value and style.");
   REQ_INT_ARG(0, cx, "A value for the center x coordinate should be supplied.");
@@ -966,7 +1680,7 @@ Napi::Value Gd::Image::FilledArc(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::Ellipse(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(5, "center x, center y, width, height and color value.");
   REQ_INT_ARG(0, cx, "A value for the center x coordinate should be supplied.");
@@ -982,7 +1696,7 @@ Napi::Value Gd::Image::Ellipse(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::FilledEllipse(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(5, "center x, center y, width, height and color value.");
   REQ_INT_ARG(0, cx, "A value for the center x coordinate should be supplied.");
@@ -998,7 +1712,7 @@ Napi::Value Gd::Image::FilledEllipse(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::FillToBorder(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(4, "x coordinate, y coordinate, border offset and color value.");
   REQ_INT_ARG(0, x, "A value for the x coordinate should be supplied.");
@@ -1013,7 +1727,7 @@ Napi::Value Gd::Image::FillToBorder(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::Fill(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(3, "x coordinate, y coordinate and a color value.");
   REQ_INT_ARG(0, x, "A value for the x coordinate should be supplied.");
@@ -1027,7 +1741,7 @@ Napi::Value Gd::Image::Fill(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::SetAntiAliased(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_INT_ARG(0, color, "A color number should supplied.");
 
@@ -1038,7 +1752,7 @@ Napi::Value Gd::Image::SetAntiAliased(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::SetAntiAliasedDontBlend(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(2, "a color number and a color value not to blend");
   REQ_INT_ARG(0, color, "A color number should supplied.");
@@ -1051,9 +1765,9 @@ Napi::Value Gd::Image::SetAntiAliasedDontBlend(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::SetBrush(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
-  REQ_IMG_ARG(0, brush)
+  REQ_READABLE_IMG_ARG(0, brush)
   gdImageSetBrush(this->_image, brush);
 
   return info.This();
@@ -1061,9 +1775,9 @@ Napi::Value Gd::Image::SetBrush(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::SetTile(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
-  REQ_IMG_ARG(0, tile)
+  REQ_READABLE_IMG_ARG(0, tile)
   gdImageSetTile(this->_image, tile);
 
   return info.This();
@@ -1071,7 +1785,7 @@ Napi::Value Gd::Image::SetTile(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::SetStyle(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   if (info.Length() < 1 || !info[0].IsArray())
   {
@@ -1102,7 +1816,7 @@ Napi::Value Gd::Image::SetStyle(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::SetThickness(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_INT_ARG(0, thickness, "Thickness value in pixels should be supplied.");
 
@@ -1113,7 +1827,7 @@ Napi::Value Gd::Image::SetThickness(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::AlphaBlending(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_INT_ARG(0, blending, "A value of 0..4 for the alpha blending effect should be supplied. 0 = replace, 1 = alpha blend, 2 = normal, 3 = overlay, 4 = multiply");
   gdImageAlphaBlending(this->_image, blending);
@@ -1123,7 +1837,7 @@ Napi::Value Gd::Image::AlphaBlending(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::SaveAlpha(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_INT_ARG(0, saveFlag, "A value of 0 or 1 should be supplied to whether or not save the alpha channel of the pixles.")
   gdImageSaveAlpha(this->_image, saveFlag);
@@ -1133,7 +1847,7 @@ Napi::Value Gd::Image::SaveAlpha(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::SetClip(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(4, "x1 coordinate, y1 coordinate, x2 coordinate and y2 coordinate.");
   REQ_INT_ARG(0, x1, "A value for the x1 coordinate should be supplied.");
@@ -1164,7 +1878,7 @@ Napi::Value Gd::Image::GetClip(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::SetResolution(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(2, "horizontal resolution and vertical resolution values. 96 dpi by default, values should be bigger than 0.");
   REQ_INT_ARG(0, res_x, "The horizontal resolution in DPI should be supplied.");
@@ -1175,6 +1889,39 @@ Napi::Value Gd::Image::SetResolution(const Napi::CallbackInfo &info)
   return info.This();
 }
 
+/**
+ * Replay a display list of drawing commands in one call
+ */
+Napi::Value Gd::Image::DrawCommands(const Napi::CallbackInfo &info)
+{
+  CHECK_IMAGE_WRITABLE;
+
+  const double *commands;
+  size_t length;
+  std::vector<std::string> strings;
+
+  if (!DisplayListArgs(info, commands, length, strings))
+  {
+    return info.Env().Null();
+  }
+
+  const char *error = RunDisplayList(this->_image, commands, length, strings);
+  if (error)
+  {
+    Napi::Error::New(info.Env(), error).ThrowAsJavaScriptException();
+    return info.Env().Null();
+  }
+
+  return info.This();
+}
+
+Napi::Value Gd::Image::DrawCommandsAsync(const Napi::CallbackInfo &info)
+{
+  CHECK_IMAGE_EXISTS;
+
+  return DrawCommandsWorker::DoWork(info, this->_image);
+}
+
 /**
  * Query Functions
  */
@@ -1289,6 +2036,85 @@ Napi::Value Gd::Image::GetBoundsSafe(const Napi::CallbackInfo &info)
   return result;
 }
 
+/**
+ * Copy a rectangle of pixels as RGBA bytes into a typed array in one call
+ */
+Napi::Value Gd::Image::GetImageData(const Napi::CallbackInfo &info)
+{
+  CHECK_IMAGE_EXISTS;
+
+  REQ_ARGS(4, "x coordinate, y coordinate, width and height.");
+  REQ_INT_ARG(0, x, "A value for the x coordinate should be supplied.");
+  REQ_INT_ARG(1, y, "A value for the y coordinate should be supplied.");
+  REQ_INT_ARG(2, width, "A value for 'width' should be supplied.");
+  REQ_INT_ARG(3, height, "A value for 'height' should be supplied.");
+
+  if (!CheckPixelRegion(info.Env(), this->_image, x, y, width, height))
+  {
+    return info.Env().Null();
+  }
+
+  Napi::TypedArray target = PixelArrayArg(info, 4, (size_t)width * height * 4, true);
+  if (target.IsEmpty())
+  {
+    return info.Env().Null();
+  }
+
+  CopyImageData(this->_image, x, y, width, height, TypedArrayBytes(target));
+
+  return target;
+}
+
+Napi::Value Gd::Image::GetImageDataAsync(const Napi::CallbackInfo &info)
+{
+  CHECK_IMAGE_EXISTS;
+
+  return GetImageDataWorker::DoWork(info, this->_image);
+}
+
+/**
+ * Write RGBA bytes from a typed array into a rectangle of pixels in one call
+ */
+Napi::Value Gd::Image::PutImageData(const Napi::CallbackInfo &info)
+{
+  CHECK_IMAGE_WRITABLE;
+
+  REQ_ARGS(5, "pixel data, x coordinate, y coordinate, width and height.");
+  REQ_INT_ARG(1, x, "A value for the x coordinate should be supplied.");
+  REQ_INT_ARG(2, y, "A value for the y coordinate should be supplied.");
+  REQ_INT_ARG(3, width, "A value for 'width' should be supplied.");
+  REQ_INT_ARG(4, height, "A value for 'height' should be supplied.");
+
+  if (!CheckPixelRegion(info.Env(), this->_image, x, y, width, height))
+  {
+    return info.Env().Null();
+  }
+
+  size_t stride;
+  int alphaMode;
+  if (!PixelOptionsArg(info, 5, width, stride, alphaMode))
+  {
+    return info.Env().Null();
+  }
+
+  Napi::TypedArray source = PixelArrayArg(info, 0, PixelDataLength(width, height, stride), false);
+  if (source.IsEmpty())
+  {
+    return info.Env().Null();
+  }
+
+  ::PutImageData(this->_image, x, y, width, height, TypedArrayBytes(source), stride, alphaMode);
+
+  return info.This();
+}
+
+Napi::Value Gd::Image::PutImageDataAsync(const Napi::CallbackInfo &info)
+{
+  CHECK_IMAGE_EXISTS;
+
+  return PutImageDataWorker::DoWork(info, this->_image);
+}
+
 Napi::Value Gd::Image::WidthGetter(const Napi::CallbackInfo &info)
 {
   CHECK_IMAGE_EXISTS;
@@ -1297,6 +2123,17 @@ Napi::Value Gd::Image::WidthGetter(const Napi::CallbackInfo &info)
   return result;
 }
 
+Napi::Value Gd::Image::SharedBufferGetter(const Napi::CallbackInfo &info)
+{
+  CHECK_IMAGE_EXISTS;
+
+  if (this->_sharedBuffer.IsEmpty())
+  {
+    return info.Env().Null();
+  }
+  return this->_sharedBuffer.Value();
+}
+
 Napi::Value Gd::Image::HeightGetter(const Napi::CallbackInfo &info)
 {
   CHECK_IMAGE_EXISTS;
@@ -1343,6 +2180,14 @@ void Gd::Image::InterpolationIdSetter(const Napi::CallbackInfo &info, const Napi
   {
     Napi::Error::New(info.Env(), "Image is already destroyed.")
         .ThrowAsJavaScriptException();
+    return;
+  }
+
+  if (!IsWritable())
+  {
+    Napi::Error::New(info.Env(), "Image is in use by an asynchronous operation and cannot be modified")
+        .ThrowAsJavaScriptException();
+    return;
   }
 
   if (value.IsNumber())
@@ -1399,7 +2244,7 @@ Napi::Value Gd::Image::StringFTBBox(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::StringFT(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(7, "color value, font list, font size, angle, x coordinate, y coordinate and text to render (optionally 8th argument if the rectangle coordinates should be returnd).");
   REQ_INT_ARG(0, color, "A color number should supplied.");
@@ -1446,7 +2291,7 @@ Napi::Value Gd::Image::StringFT(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::StringFTEx(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(8, "color number, font list, font size, angle, x coordinate, y coordinate, text to render, object containing options.");
   REQ_INT_ARG(0, color, "A color number should supplied.");
@@ -1657,7 +2502,7 @@ Napi::Value Gd::Image::StringFTEx(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::StringFTCircle(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(9, "center x coordinate, center y coordinate, radius, text radius, fill portion, font list, font size, top distance, bottom distance, color number.");
   REQ_INT_ARG(0, cx, "A value for the center x coordinate should be supplied.");
@@ -1692,7 +2537,7 @@ Napi::Value Gd::Image::StringFTCircle(const Napi::CallbackInfo &info)
  */
 Napi::Value Gd::Image::ColorAllocate(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   OPT_INT_ARG(0, r, 0);
   OPT_INT_ARG(1, g, 0);
@@ -1704,7 +2549,7 @@ Napi::Value Gd::Image::ColorAllocate(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::ColorAllocateAlpha(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   OPT_INT_ARG(0, r, 0);
   OPT_INT_ARG(1, g, 0);
@@ -1779,7 +2624,7 @@ Napi::Value Gd::Image::ColorExactAlpha(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::ColorResolve(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   OPT_INT_ARG(0, r, 0);
   OPT_INT_ARG(1, g, 0);
@@ -1791,7 +2636,7 @@ Napi::Value Gd::Image::ColorResolve(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::ColorResolveAlpha(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   OPT_INT_ARG(0, r, 0);
   OPT_INT_ARG(1, g, 0);
@@ -1874,6 +2719,14 @@ void Gd::Image::InterlaceSetter(const Napi::CallbackInfo &info, const Napi::Valu
   {
     Napi::Error::New(info.Env(), "Image is already destroyed.")
         .ThrowAsJavaScriptException();
+    return;
+  }
+
+  if (!IsWritable())
+  {
+    Napi::Error::New(info.Env(), "Image is in use by an asynchronous operation and cannot be modified")
+        .ThrowAsJavaScriptException();
+    return;
   }
 
   if (value.IsBoolean())
@@ -1894,7 +2747,7 @@ Napi::Value Gd::Image::GetTransparent(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::ColorDeallocate(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_INT_ARG(0, color, "A color number should supplied.");
   gdImageColorDeallocate(this->_image, color);
@@ -1904,7 +2757,7 @@ Napi::Value Gd::Image::ColorDeallocate(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::ColorTransparent(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_INT_ARG(0, color, "A color number should supplied.");
   gdImageColorTransparent(this->_image, color);
@@ -1914,7 +2767,7 @@ Napi::Value Gd::Image::ColorTransparent(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::ColorReplace(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(2, "'from' color value and 'to' color value.");
   REQ_INT_ARG(0, fromColor, "A 'from' color number should supplied.");
@@ -1927,7 +2780,7 @@ Napi::Value Gd::Image::ColorReplace(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::ColorReplaceThreshold(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(3, "'from' color value, 'to' color value and threshold");
   REQ_INT_ARG(0, fromColor, "A 'from' color number should supplied.");
@@ -1942,7 +2795,7 @@ Napi::Value Gd::Image::ColorReplaceThreshold(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::ColorReplaceArray(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_ARGS(2, "array of 'from' colors, array of 'to' colors.");
 
@@ -1984,7 +2837,7 @@ Napi::Value Gd::Image::ColorReplaceArray(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::GrayScale(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   gdImageGrayScale(this->_image);
 
@@ -1993,7 +2846,7 @@ Napi::Value Gd::Image::GrayScale(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::GaussianBlur(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   gdImageGaussianBlur(this->_image);
 
@@ -2002,7 +2855,7 @@ Napi::Value Gd::Image::GaussianBlur(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::Negate(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   gdImageNegate(this->_image);
 
@@ -2011,7 +2864,7 @@ Napi::Value Gd::Image::Negate(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::Brightness(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_INT_ARG(0, brightness, "A value between -255 and 255 should be supplied for brightness.");
 
@@ -2022,7 +2875,7 @@ Napi::Value Gd::Image::Brightness(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::Contrast(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_DOUBLE_ARG(0, contrast);
 
@@ -2033,7 +2886,7 @@ Napi::Value Gd::Image::Contrast(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::SelectiveBlur(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   gdImageSelectiveBlur(this->_image);
   return info.This();
@@ -2041,7 +2894,7 @@ Napi::Value Gd::Image::SelectiveBlur(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::FlipHorizontal(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   gdImageFlipHorizontal(this->_image);
   return info.This();
@@ -2049,7 +2902,7 @@ Napi::Value Gd::Image::FlipHorizontal(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::FlipVertical(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   gdImageFlipVertical(this->_image);
   return info.This();
@@ -2057,7 +2910,7 @@ Napi::Value Gd::Image::FlipVertical(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::FlipBoth(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   gdImageFlipBoth(this->_image);
   return info.This();
@@ -2080,6 +2933,11 @@ Napi::Value Gd::Image::Crop(const Napi::CallbackInfo &info)
   rect->width = (width == 0) ? 100 : width;
   rect->height = (height == 0) ? 100 : height;
 
+  // libgd clips the rectangle to the image
+  CHECK_MEMORY_LIMIT(ImageBytes(std::max(0, std::min(rect->width, gdImageSX(this->_image))),
+                                std::max(0, std::min(rect->height, gdImageSY(this->_image))),
+                                gdImageTrueColor(this->_image)));
+
   gdImagePtr newImage = gdImageCrop(this->_image, rect);
 
   RETURN_IMAGE(newImage);
@@ -2098,6 +2956,8 @@ Napi::Value Gd::Image::CropAuto(const Napi::CallbackInfo &info)
     return info.Env().Null();
   }
 
+  CHECK_MEMORY_LIMIT(ImageBytes(gdImageSX(this->_image), gdImageSY(this->_image), gdImageTrueColor(this->_image)));
+
   gdImagePtr newImage = gdImageCropAuto(this->_image, mode);
 
   RETURN_IMAGE(newImage);
@@ -2110,13 +2970,15 @@ Napi::Value Gd::Image::CropThreshold(const Napi::CallbackInfo &info)
   REQ_INT_ARG(0, color, "A color number should supplied.");
   REQ_DOUBLE_ARG(1, threshold);
 
+  CHECK_MEMORY_LIMIT(ImageBytes(gdImageSX(this->_image), gdImageSY(this->_image), gdImageTrueColor(this->_image)));
+
   gdImagePtr newImage = gdImageCropThreshold(this->_image, color, threshold);
   RETURN_IMAGE(newImage);
 }
 
 Napi::Value Gd::Image::Emboss(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   gdImageEmboss(this->_image);
   return info.This();
@@ -2130,7 +2992,7 @@ Napi::Value Gd::Image::Copy(const Napi::CallbackInfo &info)
   CHECK_IMAGE_EXISTS;
 
   REQ_ARGS(7, "destination image, dest x coordinate, dest y coordinate, source x cooridinate, source y coordinate, width and height.");
-  REQ_IMG_ARG(0, dest);
+  REQ_WRITABLE_IMG_ARG(0, dest);
   REQ_INT_ARG(1, dstX, "A value for the destination x coordinate should be supplied.");
   REQ_INT_ARG(2, dstY, "A value for the destination y coordinate should be supplied.");
   REQ_INT_ARG(3, srcX, "A value for the source x coordinate should be supplied.");
@@ -2148,7 +3010,7 @@ Napi::Value Gd::Image::CopyResized(const Napi::CallbackInfo &info)
   CHECK_IMAGE_EXISTS;
 
   REQ_ARGS(9, "destination image, dest x coordinate, dest y coordinate, source x cooridinate, source y coordinate, destination width, destination height, source width and source height.");
-  REQ_IMG_ARG(0, dest);
+  REQ_WRITABLE_IMG_ARG(0, dest);
   REQ_INT_ARG(1, dstX, "A value for the destination x coordinate should be supplied.");
   REQ_INT_ARG(2, dstY, "A value for the destination y coordinate should be supplied.");
   REQ_INT_ARG(3, srcX, "A value for the source x coordinate should be supplied.");
@@ -2168,7 +3030,7 @@ Napi::Value Gd::Image::CopyResampled(const Napi::CallbackInfo &info)
   CHECK_IMAGE_EXISTS;
 
   REQ_ARGS(9, "destination image, dest x coordinate, dest y coordinate, source x cooridinate, source y coordinate, destination width, destination height, source width and source height.");
-  REQ_IMG_ARG(0, dest);
+  REQ_WRITABLE_IMG_ARG(0, dest);
   REQ_INT_ARG(1, dstX, "A value for the destination x coordinate should be supplied.");
   REQ_INT_ARG(2, dstY, "A value for the destination y coordinate should be supplied.");
   REQ_INT_ARG(3, srcX, "A value for the source x coordinate should be supplied.");
@@ -2188,7 +3050,7 @@ Napi::Value Gd::Image::CopyRotated(const Napi::CallbackInfo &info)
   CHECK_IMAGE_EXISTS;
 
   REQ_ARGS(8, "destination image, dest x coordinate, dest y coordinate, source x cooridinate, source y coordinate, destination width, destination height and angle in degrees.");
-  REQ_IMG_ARG(0, dest);
+  REQ_WRITABLE_IMG_ARG(0, dest);
   REQ_DOUBLE_ARG(1, dstX);
   REQ_DOUBLE_ARG(2, dstY);
   REQ_INT_ARG(3, srcX, "A value for the source x coordinate should be supplied.");
@@ -2207,7 +3069,7 @@ Napi::Value Gd::Image::CopyMerge(const Napi::CallbackInfo &info)
   CHECK_IMAGE_EXISTS;
 
   REQ_ARGS(8, "destination image, dest x coordinate, dest y coordinate, source x cooridinate, source y coordinate, width, height and percentage value.");
-  REQ_IMG_ARG(0, dest);
+  REQ_WRITABLE_IMG_ARG(0, dest);
   REQ_INT_ARG(1, dstX, "A value for the destination x coordinate should be supplied.");
   REQ_INT_ARG(2, dstY, "A value for the destination y coordinate should be supplied.");
   REQ_INT_ARG(3, srcX, "A value for the source x coordinate should be supplied.");
@@ -2226,7 +3088,7 @@ Napi::Value Gd::Image::CopyMergeGray(const Napi::CallbackInfo &info)
   CHECK_IMAGE_EXISTS;
 
   REQ_ARGS(8, "destination image, destination x coordinate, destination y coordinate, source x coordinate, source y coordinate, width, height and percentage value.");
-  REQ_IMG_ARG(0, dest);
+  REQ_WRITABLE_IMG_ARG(0, dest);
   REQ_INT_ARG(1, dstX, "A value for the destination x coordinate should be supplied.");
   REQ_INT_ARG(2, dstY, "A value for the destination y coordinate should be supplied.");
   REQ_INT_ARG(3, srcX, "A value for the source x coordinate should be supplied.");
@@ -2244,7 +3106,7 @@ Napi::Value Gd::Image::PaletteCopy(const Napi::CallbackInfo &info)
 {
   CHECK_IMAGE_EXISTS;
 
-  REQ_IMG_ARG(0, dest);
+  REQ_WRITABLE_IMG_ARG(0, dest);
 
   gdImagePaletteCopy(dest, this->_image);
 
@@ -2264,7 +3126,7 @@ Napi::Value Gd::Image::SquareToCircle(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::Sharpen(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_INT_ARG(0, pct, "A percentage value for sharpening should be supplied. This can be greater than 100.");
 
@@ -2280,6 +3142,8 @@ Napi::Value Gd::Image::CreatePaletteFromTrueColor(const Napi::CallbackInfo &info
   OPT_INT_ARG(0, ditherFlag, 0);
   OPT_INT_ARG(1, colorsWanted, 256);
 
+  CHECK_MEMORY_LIMIT(ImageBytes(gdImageSX(this->_image), gdImageSY(this->_image), false));
+
   gdImagePtr newImage = gdImageCreatePaletteFromTrueColor(this->_image, ditherFlag, colorsWanted);
 
   RETURN_IMAGE(newImage);
@@ -2287,29 +3151,43 @@ Napi::Value Gd::Image::CreatePaletteFromTrueColor(const Napi::CallbackInfo &info
 
 Napi::Value Gd::Image::TrueColorToPalette(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   OPT_INT_ARG(0, ditherFlag, 0);
   OPT_INT_ARG(1, colorsWanted, 256);
 
+  if (!this->_sharedBuffer.IsEmpty())
+  {
+    Napi::Error::New(info.Env(), "Images on a SharedArrayBuffer cannot be converted to palette images")
+        .ThrowAsJavaScriptException();
+    return info.Env().Null();
+  }
+
   Napi::Number result = Napi::Number::New(info.Env(), gdImageTrueColorToPalette(this->_image, ditherFlag, colorsWanted));
+
+  // pixel storage has been replaced by libgd
+  UpdateExternalMemory(info.Env());
+
   return result;
 }
 
 Napi::Value Gd::Image::PaletteToTrueColor(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   Napi::Number result = Napi::Number::New(info.Env(), gdImagePaletteToTrueColor(this->_image));
 
+  // pixel storage has been replaced by libgd
+  UpdateExternalMemory(info.Env());
+
   return result;
 }
 
 Napi::Value Gd::Image::ColorMatch(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
-  REQ_IMG_ARG(0, palette);
+  REQ_WRITABLE_IMG_ARG(0, palette);
 
   int gdResult = gdImageColorMatch(this->_image, palette);
 
@@ -2347,6 +3225,8 @@ Napi::Value Gd::Image::Scale(const Napi::CallbackInfo &info)
   REQ_INT_ARG(0, new_width, "A value for 'width' should be supplied.");
   REQ_INT_ARG(1, new_height, "A value for 'height' should be supplied.");
 
+  CHECK_MEMORY_LIMIT(ImageBytes(std::max(new_width, 0), std::max(new_height, 0), true));
+
   gdImagePtr newImage = gdImageScale(this->_image, new_width, new_height);
 
   RETURN_IMAGE(newImage);
@@ -2354,7 +3234,7 @@ Napi::Value Gd::Image::Scale(const Napi::CallbackInfo &info)
 
 Napi::Value Gd::Image::Pixelate(const Napi::CallbackInfo &info)
 {
-  CHECK_IMAGE_EXISTS;
+  CHECK_IMAGE_WRITABLE;
 
   REQ_INT_ARG(0, block_size, "Pixel block size");
   REQ_INT_ARG(1, mode, "Mode, 0 or 1, upperleft or average");
@@ -2372,6 +3252,15 @@ Napi::Value Gd::Image::RotateInterpolated(const Napi::CallbackInfo &info)
   REQ_DOUBLE_ARG(0, angle);
   REQ_INT_ARG(1, bgcolor, "A background color value should be supplied.");
 
+  // the bounding box of the rotated image
+  double radians = angle * std::acos(-1.0) / 180;
+  double width = gdImageSX(this->_image);
+  double height = gdImageSY(this->_image);
+  double cos = std::fabs(std::cos(radians));
+  double sin = std::fabs(std::sin(radians));
+  CHECK_MEMORY_LIMIT(ImageBytes((int)std::min(std::ceil(width * cos + height * sin), (double)INT_MAX),
+                                (int)std::min(std::ceil(width * sin + height * cos), (double)INT_MAX), true));
+
   gdImagePtr newImage = gdImageRotateInterpolated(this->_image, angle, bgcolor);
 
   RETURN_IMAGE(newImage);
@@ -2464,10 +3353,18 @@ Napi::Value Gd::Image::Compare(const Napi::CallbackInfo &info)
 
   Gd::Image *_obj_ = Napi::ObjectWrap<Gd::Image>::Unwrap(info[0].As<Napi::Object>());
   gdImagePtr im2 = _obj_->getGdImagePtr();
+  if (!_obj_->IsReadable())
+  {
+    Napi::Error::New(info.Env(), "Argument 0 is being modified asynchronously").ThrowAsJavaScriptException();
+    return info.Env().Null();
+  }
 
   Napi::Number result = Napi::Number::New(info.Env(), gdImageCompare(this->_image, im2));
 
   return result;
 }
 
-Napi::FunctionReference Gd::Image::constructor;
+Napi::FunctionReference &Gd::Image::Constructor(Napi::Env env)
+{
+  return env.GetInstanceData<GdInstanceData>()->imageConstructor;
+}
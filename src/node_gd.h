@@ -20,6 +20,7 @@
 
 #include <napi.h>
 #include <gd.h>
+#include <memory>
 
 #define SUPPORTS_GD_2_3_3 (GD_MINOR_VERSION == 3 && GD_RELEASE_VERSION >= 3)
 
@@ -29,12 +30,58 @@
 #define HAS_LIBAVIF (HAVE_LIBAVIF && SUPPORTS_GD_2_3_3)
 #define HAS_LIBTIFF (HAVE_LIBTIFF)
 #define HAS_LIBWEBP (HAVE_LIBWEBP)
+#define HAS_LIBJPEG (HAVE_LIBJPEG)
 
 // Since gd 2.0.28, these are always built in
 #define GD_GIF 1
 #define GD_GIFANIM 1
 #define GD_OPENPOLYGON 1
 
+class GdDelivery;
+
+/**
+ * State of node-gd per environment. It is stored as instance data of the
+ * environment, so the addon can be loaded by several worker threads at once.
+ */
+struct GdInstanceData
+{
+  Napi::FunctionReference imageConstructor;
+
+  // jobs are delivered back to the environment through this, see
+  // node_gd_pool.cc
+  std::shared_ptr<GdDelivery> delivery;
+
+  // jobs queued from the environment of which the Promise has not settled
+  size_t pending{0};
+};
+
+/**
+ * Finalizer of Buffers which wrap memory allocated by libgd, e.g. the output
+ * of gdImagePngPtr(). Buffer::NewOrCopy() hands the allocation over to the
+ * Buffer without copying, or copies and calls this right away when the
+ * runtime does not allow external buffers.
+ */
+inline void FreeGdData(Napi::Env env, char *data)
+{
+  gdFree(data);
+}
+
+/**
+ * Whether argument I is the trailing options object of an async function,
+ * e.g. { priority: 'batch' }. Optional arguments before it may be left out.
+ */
+inline bool IsJobOptions(const Napi::CallbackInfo &info, size_t I)
+{
+  if (info.Length() != I + 1)
+  {
+    return false;
+  }
+
+  Napi::Value value = info[I];
+  return value.IsObject() && !value.IsArray() && !value.IsBuffer() &&
+         !value.IsTypedArray() && !value.IsArrayBuffer() && !value.IsFunction();
+}
+
 #define COLOR_ANTIALIASED gdAntiAliased
 #define COLOR_BRUSHED gdBrushed
 #define COLOR_STYLED gdStyled
@@ -114,6 +161,26 @@
       Napi::ObjectWrap<Gd::Image>::Unwrap(info[I].As<Napi::Object>()); \
   gdImagePtr VAR = _obj_->getGdImagePtr();
 
+#define REQ_READABLE_IMG_ARG(I, VAR)                                          \
+  REQ_IMG_ARG(I, VAR)                                                         \
+  if (!_obj_->IsReadable())                                                   \
+  {                                                                           \
+    Napi::Error::New(info.Env(),                                              \
+                     "Argument " #I " is being modified asynchronously")      \
+        .ThrowAsJavaScriptException();                                        \
+    return info.Env().Null();                                                 \
+  }
+
+#define REQ_WRITABLE_IMG_ARG(I, VAR)                                          \
+  REQ_IMG_ARG(I, VAR)                                                         \
+  if (!_obj_->IsWritable())                                                   \
+  {                                                                           \
+    Napi::Error::New(info.Env(),                                              \
+                     "Argument " #I " is in use by an asynchronous operation") \
+        .ThrowAsJavaScriptException();                                        \
+    return info.Env().Null();                                                 \
+  }
+
 #define OPT_INT_ARG(I, VAR, DEFAULT)                                  \
   int VAR;                                                            \
   if (info.Length() <= (I))                                           \
@@ -168,6 +235,113 @@
     return info.Env().Null();                                          \
   }
 
+// The async variants take a trailing job options object for an optional
+// argument which was left out
+#define OPT_INT_ARG_JOB(I, VAR, DEFAULT)                              \
+  int VAR;                                                            \
+  if (info.Length() <= (I) || IsJobOptions(info, I))                  \
+  {                                                                   \
+    VAR = (DEFAULT);                                                  \
+  }                                                                   \
+  else if (info[I].IsNumber())                                        \
+  {                                                                   \
+    VAR = info[I].ToNumber();                                         \
+  }                                                                   \
+  else                                                                \
+  {                                                                   \
+    Napi::TypeError::New(info.Env(),                                  \
+                         "Optional argument " #I " must be a Number") \
+        .ThrowAsJavaScriptException();                                \
+    return info.Env().Null();                                         \
+  }
+
+#define OPT_STR_ARG_JOB(I, VAR, DEFAULT)                              \
+  std::string VAR;                                                    \
+  if (info.Length() <= (I) || IsJobOptions(info, I))                  \
+  {                                                                   \
+    VAR = (DEFAULT);                                                  \
+  }                                                                   \
+  else if (info[I].IsString())                                        \
+  {                                                                   \
+    VAR = info[I].As<Napi::String>().Utf8Value().c_str();             \
+  }                                                                   \
+  else                                                                \
+  {                                                                   \
+    Napi::TypeError::New(info.Env(),                                  \
+                         "Optional argument " #I " must be a String") \
+        .ThrowAsJavaScriptException();                                \
+    return info.Env().Null();                                         \
+  }
+
+#define OPT_BOOL_ARG_JOB(I, VAR, DEFAULT)                              \
+  bool VAR;                                                            \
+  if (info.Length() <= (I) || IsJobOptions(info, I))                   \
+  {                                                                    \
+    VAR = (DEFAULT);                                                   \
+  }                                                                    \
+  else if (info[I].IsBoolean())                                        \
+  {                                                                    \
+    VAR = info[I].ToBoolean();                                         \
+  }                                                                    \
+  else                                                                 \
+  {                                                                    \
+    Napi::TypeError::New(info.Env(),                                   \
+                         "Optional argument " #I " must be a Boolean") \
+        .ThrowAsJavaScriptException();                                 \
+    return info.Env().Null();                                          \
+  }
+
+#define JOB_OPTIONS_ARG(I, WORKER, LANE)            \
+  if (!(WORKER)->ReadJobOptions(info, (I), (LANE))) \
+  {                                                 \
+    delete (WORKER);                                \
+    return info.Env().Null();                       \
+  }
+
+#define DECODE_LIMITS_ARG(WORKER)                 \
+  if (!ReadDecodeLimits(info, (WORKER)->_limits)) \
+  {                                               \
+    delete (WORKER);                              \
+    return info.Env().Null();                     \
+  }
+
+#define SAVE_TARGET_ARG(I, VAR, MSG)          \
+  SaveTarget VAR;                             \
+  if (!ReadSaveTarget(info, (I), VAR, MSG))   \
+  {                                           \
+    return info.Env().Null();                 \
+  }
+
+#define JPEG_SCALE_ARG(WORKER)                  \
+  if (!ReadJpegScale(info, (WORKER)->_scale)) \
+  {                                           \
+    delete (WORKER);                          \
+    return info.Env().Null();                 \
+  }
+
+#define MMAP_ARG(WORKER)                     \
+  if (!ReadMmapMode(info, (WORKER)->_mmap)) \
+  {                                         \
+    delete (WORKER);                        \
+    return info.Env().Null();               \
+  }
+
+#define CHECK_MEMORY_LIMIT(BYTES)                                  \
+  if (!MemoryBudget::Instance().Fits(BYTES))                       \
+  {                                                                \
+    MemoryBudget::Instance().Rejected();                           \
+    Napi::Error::New(info.Env(), "Memory limit of node-gd exceeded") \
+        .ThrowAsJavaScriptException();                             \
+    return info.Env().Null();                                      \
+  }
+
+#define LEASE_IMAGE(WORKER, EXCLUSIVE)            \
+  if (!(WORKER)->LeaseImage(info, (EXCLUSIVE))) \
+  {                                             \
+    delete (WORKER);                            \
+    return info.Env().Null();                   \
+  }
+
 #define RETURN_IMAGE(IMG)                                       \
   if (!IMG)                                                     \
   {                                                             \
@@ -177,7 +351,8 @@
   {                                                             \
     Napi::Value argv =                                          \
         Napi::External<gdImagePtr>::New(info.Env(), &IMG);      \
-    Napi::Object instance = Gd::Image::constructor.New({argv}); \
+    Napi::Object instance =                                     \
+        Gd::Image::Constructor(info.Env()).New({argv});         \
     return instance;                                            \
   }
 
@@ -188,14 +363,9 @@
   }                                                                     \
   Napi::Value Gd::CreateFrom##TYPE##Ptr(const Napi::CallbackInfo &info) \
   {                                                                     \
-    REQ_ARGS(1, "of type Buffer.");                                     \
-    ASSERT_IS_BUFFER(info[0]);                                          \
-    gdImagePtr im;                                                      \
-    Napi::Buffer<char> buffer = info[0].As<Napi::Buffer<char> >();      \
-    char *buffer_data = buffer.Data();                                  \
-    size_t buffer_length = buffer.Length();                             \
-    im = gdImageCreateFrom##TYPE##Ptr(buffer_length, buffer_data);      \
-    RETURN_IMAGE(im)                                                    \
+    return CreateFromPtrWorker::DoWork(info,                            \
+                                       gdImageCreateFrom##TYPE##Ptr,    \
+                                       #TYPE);                          \
   }
 
 #define ASSERT_IS_BUFFER(val)                                 \
@@ -206,11 +376,15 @@
     return info.Env().Null();                                 \
   }
 
-#define RETURN_DATA                                     \
-  Napi::Buffer<char> result =                           \
-      Napi::Buffer<char>::Copy(info.Env(), data, size); \
-  gdFree(data);                                         \
-  return result;
+#define RETURN_DATA                                                     \
+  if (data == nullptr)                                                  \
+  {                                                                     \
+    Napi::Error::New(info.Env(), "Cannot encode image")                 \
+        .ThrowAsJavaScriptException();                                  \
+    return info.Env().Null();                                           \
+  }                                                                     \
+  return Napi::Buffer<char>::NewOrCopy(info.Env(), data, (size_t)size,  \
+                                       FreeGdData);
 
 
 #define CHECK_IMAGE_EXISTS                                     \
@@ -225,6 +399,23 @@
     Napi::Error::New(info.Env(), "Image does not exist")       \
         .ThrowAsJavaScriptException();                         \
     return info.Env().Undefined();                             \
+  }                                                            \
+  if (_writer)                                                 \
+  {                                                            \
+    Napi::Error::New(info.Env(),                               \
+                     "Image is being modified asynchronously") \
+        .ThrowAsJavaScriptException();                         \
+    return info.Env().Undefined();                             \
+  }
+
+#define CHECK_IMAGE_WRITABLE                                          \
+  CHECK_IMAGE_EXISTS                                                  \
+  if (_readers > 0)                                                   \
+  {                                                                   \
+    Napi::Error::New(info.Env(), "Image is in use by an asynchronous " \
+                                 "operation and cannot be modified")  \
+        .ThrowAsJavaScriptException();                                \
+    return info.Env().Undefined();                                    \
   }
 
 class Gd : public Napi::ObjectWrap<Gd>
@@ -240,49 +431,110 @@ public:
     Image(const Napi::CallbackInfo &info);
     ~Image();
 
-    static Napi::FunctionReference constructor;
+    /**
+     * The gd.Image class of env
+     */
+    static Napi::FunctionReference &Constructor(Napi::Env env);
 
     gdImagePtr getGdImagePtr() const { return _image; }
 
+    /**
+     * Leases mark the image in use by jobs on the thread pool: any amount
+     * of shared leases for jobs reading the image, or a single exclusive
+     * lease for a job modifying it. Leases are taken and released on the
+     * JavaScript thread only.
+     */
+    bool AcquireLease(bool exclusive);
+
+    void ReleaseLease(Napi::Env env, bool exclusive);
+
+    bool IsWritable() const { return _readers == 0 && !_writer; }
+
+    bool IsReadable() const { return !_writer; }
+
+    /**
+     * Mark the pixel rows of the image as living in buffer, a
+     * SharedArrayBuffer which is kept alive as long as the image
+     */
+    void SetSharedBuffer(Napi::Object buffer);
+
   private:
     gdImagePtr _image{nullptr};
 
     bool _isDestroyed{true};
 
+    // amount of shared leases and whether the exclusive lease is taken
+    int _readers{0};
+
+    bool _writer{false};
+
+    // destroy() was called while leases were held
+    bool _destroyPending{false};
+
+    void DestroyImage(Napi::Env env);
+
+    // the SharedArrayBuffer holding the pixel rows of a shared image
+    Napi::ObjectReference _sharedBuffer;
+
+    void FreeImage();
+
+    // bytes of pixel memory currently reported to V8 for this image
+    int64_t _externalMemory{0};
+
+    // bytes of pixel memory currently counted in the memory budget
+    int64_t _pixelMemory{0};
+
     operator gdImagePtr() const { return _image; }
 
+    static int64_t MemorySize(gdImagePtr image);
+
+    void UpdateExternalMemory(Napi::Env env);
+
     /**
      * Destruction, Loading and Saving Functions
      */
     Napi::Value Destroy(const Napi::CallbackInfo &info);
+    Napi::Value Detach(const Napi::CallbackInfo &info);
+    static Napi::Value Attach(const Napi::CallbackInfo &info);
+    static Napi::Value Discard(const Napi::CallbackInfo &info);
     Napi::Value Jpeg(const Napi::CallbackInfo &info);
     Napi::Value JpegPtr(const Napi::CallbackInfo &info);
+    Napi::Value JpegPtrAsync(const Napi::CallbackInfo &info);
     Napi::Value Gif(const Napi::CallbackInfo &info);
     Napi::Value GifPtr(const Napi::CallbackInfo &info);
+    Napi::Value GifPtrAsync(const Napi::CallbackInfo &info);
     Napi::Value Png(const Napi::CallbackInfo &info);
     Napi::Value PngPtr(const Napi::CallbackInfo &info);
+    Napi::Value PngPtrAsync(const Napi::CallbackInfo &info);
     Napi::Value WBMP(const Napi::CallbackInfo &info);
     Napi::Value WBMPPtr(const Napi::CallbackInfo &info);
+    Napi::Value WBMPPtrAsync(const Napi::CallbackInfo &info);
 #if HAS_LIBWEBP
     Napi::Value Webp(const Napi::CallbackInfo &info);
     Napi::Value WebpPtr(const Napi::CallbackInfo &info);
+    Napi::Value WebpPtrAsync(const Napi::CallbackInfo &info);
 #endif
     Napi::Value Bmp(const Napi::CallbackInfo &info);
     Napi::Value BmpPtr(const Napi::CallbackInfo &info);
+    Napi::Value BmpPtrAsync(const Napi::CallbackInfo &info);
 #if HAS_LIBHEIF
     Napi::Value Heif(const Napi::CallbackInfo &info);
     Napi::Value HeifPtr(const Napi::CallbackInfo &info);
+    Napi::Value HeifPtrAsync(const Napi::CallbackInfo &info);
 #endif
 #if HAS_LIBAVIF
     Napi::Value Avif(const Napi::CallbackInfo &info);
     Napi::Value AvifPtr(const Napi::CallbackInfo &info);
+    Napi::Value AvifPtrAsync(const Napi::CallbackInfo &info);
 #endif
 
 #if HAS_LIBTIFF
     Napi::Value Tiff(const Napi::CallbackInfo &info);
     Napi::Value TiffPtr(const Napi::CallbackInfo &info);
+    Napi::Value TiffPtrAsync(const Napi::CallbackInfo &info);
 #endif
     Napi::Value File(const Napi::CallbackInfo &info);
+    Napi::Value CreateStreamEncoder(const Napi::CallbackInfo &info);
 
     /**
      * Drawing Functions
@@ -312,6 +564,8 @@ public:
     Napi::Value SetClip(const Napi::CallbackInfo &info);
     Napi::Value GetClip(const Napi::CallbackInfo &info);
     Napi::Value SetResolution(const Napi::CallbackInfo &info);
+    Napi::Value DrawCommands(const Napi::CallbackInfo &info);
+    Napi::Value DrawCommandsAsync(const Napi::CallbackInfo &info);
 
     /**
      * Query Functions
@@ -321,11 +575,16 @@ public:
     // This is implementation of the PHP-GD specific method imagecolorat
     Napi::Value ImageColorAt(const Napi::CallbackInfo &info);
     Napi::Value GetBoundsSafe(const Napi::CallbackInfo &info);
+    Napi::Value GetImageData(const Napi::CallbackInfo &info);
+    Napi::Value GetImageDataAsync(const Napi::CallbackInfo &info);
+    Napi::Value PutImageData(const Napi::CallbackInfo &info);
+    Napi::Value PutImageDataAsync(const Napi::CallbackInfo &info);
     Napi::Value WidthGetter(const Napi::CallbackInfo &info);
     Napi::Value HeightGetter(const Napi::CallbackInfo &info);
     Napi::Value ResolutionXGetter(const Napi::CallbackInfo &info);
     Napi::Value ResolutionYGetter(const Napi::CallbackInfo &info);
     Napi::Value TrueColorGetter(const Napi::CallbackInfo &info);
+    Napi::Value SharedBufferGetter(const Napi::CallbackInfo &info);
     Napi::Value InterpolationIdGetter(const Napi::CallbackInfo &info);
     void InterpolationIdSetter(const Napi::CallbackInfo &info, const Napi::Value &value);
     /**
@@ -411,6 +670,7 @@ private:
   static Napi::Value ImageCreateTrueColor(const Napi::CallbackInfo &info);
   static Napi::Value ImageCreateSync(const Napi::CallbackInfo &info);
   static Napi::Value ImageCreateTrueColorSync(const Napi::CallbackInfo &info);
+  static Napi::Value ImageCreateTrueColorShared(const Napi::CallbackInfo &info);
 
   /**
    * Section B - Creation of image in memory from a source (either file or Buffer)
@@ -449,6 +709,28 @@ private:
    */
   static Napi::Value CreateFromFile(const Napi::CallbackInfo &info);
 
+  /**
+   * Creation of image in memory from the chunks of a stream
+   */
+  static Napi::Value CreateStreamDecoder(const Napi::CallbackInfo &info);
+
+  /**
+   * Creation of image in memory from RGBA pixel data in a typed array
+   */
+  static Napi::Value CreateFromRGBA(const Napi::CallbackInfo &info);
+  static Napi::Value CreateFromRGBASync(const Napi::CallbackInfo &info);
+
+  /**
+   * Decode, transform and encode in one go on the thread pool
+   */
+  static Napi::Value Pipeline(const Napi::CallbackInfo &info);
+
+  /**
+   * Format, size and depth of an image from its headers, without decoding
+   */
+  static Napi::Value Probe(const Napi::CallbackInfo &info);
+  static Napi::Value ProbeSync(const Napi::CallbackInfo &info);
+
   /**
    * Section D - Calculate functions
    */
@@ -459,6 +741,23 @@ private:
    * Section E - Meta information
    */
   static Napi::Value GdVersionGetter(const Napi::CallbackInfo &info);
+
+  /**
+   * Section F - Thread pool
+   */
+  static Napi::Value SetConcurrency(const Napi::CallbackInfo &info);
+  static Napi::Value GetQueueStats(const Napi::CallbackInfo &info);
+  static Napi::Value SetLaneLimit(const Napi::CallbackInfo &info);
+
+  /**
+   * Section G - Memory
+   */
+  static Napi::Value SetImagePoolLimit(const Napi::CallbackInfo &info);
+  static Napi::Value GetImagePoolStats(const Napi::CallbackInfo &info);
+  static Napi::Value SetMemoryLimit(const Napi::CallbackInfo &info);
+  static Napi::Value MemoryUsage(const Napi::CallbackInfo &info);
+  static Napi::Value SetDecodeLimits(const Napi::CallbackInfo &info);
+  static Napi::Value SetMmapThreshold(const Napi::CallbackInfo &info);
 };
 
 #endif
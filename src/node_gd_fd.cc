@@ -0,0 +1,425 @@
+/**
+ * Copyright (c) 2020, Vincent Bruijn <vebruijn@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <napi.h>
+#include <gd.h>
+#include <gd_io.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "node_gd.h"
+
+enum FsyncMode
+{
+  FSYNC_NONE,
+  FSYNC_EACH,
+  FSYNC_BATCH
+};
+
+/**
+ * Where a save worker writes to: a path, or an open file descriptor at an
+ * offset. Without an offset the descriptor is written at its current
+ * position.
+ */
+struct SaveTarget
+{
+  std::string path;
+  int fd{-1};
+  double offset{-1};
+  FsyncMode fsync{FSYNC_NONE};
+  // the FileHandle the descriptor was taken from, if any
+  Napi::Object handle;
+};
+
+/**
+ * Read the offset and fsync properties of the options object of a save to
+ * a file descriptor. Throws and returns false for invalid values.
+ */
+static bool ReadSaveOptions(Napi::Object options, SaveTarget &target)
+{
+  Napi::Value offset = options.Get("offset");
+  if (!offset.IsUndefined())
+  {
+    double number = offset.IsNumber() ? offset.As<Napi::Number>().DoubleValue() : -1;
+    if (!(number >= 0 && number <= 9007199254740991.0) || number != (double)(int64_t)number)
+    {
+      Napi::RangeError::New(options.Env(), "Value for offset must be an integer of 0 or greater")
+          .ThrowAsJavaScriptException();
+      return false;
+    }
+    target.offset = number;
+  }
+
+  Napi::Value fsync = options.Get("fsync");
+  if (fsync.IsBoolean())
+  {
+    target.fsync = fsync.As<Napi::Boolean>().Value() ? FSYNC_EACH : FSYNC_NONE;
+  }
+  else if (fsync.IsString() && fsync.As<Napi::String>().Utf8Value() == "batch")
+  {
+    target.fsync = FSYNC_BATCH;
+  }
+  else if (!fsync.IsUndefined())
+  {
+    Napi::RangeError::New(options.Env(), "Value for fsync must be a Boolean or 'batch'")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Read the destination argument I of a save function, a path, a file
+ * descriptor or a FileHandle, and the offset and fsync properties of the
+ * trailing options object. Throws and returns false for invalid values.
+ *
+ * Only descriptors of regular files are accepted: sockets and pipes of
+ * Node.js are non-blocking and written through the queues of libuv, which
+ * writes from the thread pool would bypass.
+ */
+static bool ReadSaveTarget(const Napi::CallbackInfo &info, size_t I, SaveTarget &target, const char *message)
+{
+  Napi::Value value = info.Length() > I ? info[I] : info.Env().Undefined();
+
+  if (value.IsString())
+  {
+    target.path = value.As<Napi::String>().Utf8Value();
+    return true;
+  }
+  if (value.IsObject() && value.As<Napi::Object>().Get("fd").IsNumber())
+  {
+    // a FileHandle of fs/promises, it must stay open until the job is done
+    // and is referenced by the worker so it is not closed when collected
+    target.handle = value.As<Napi::Object>();
+    value = target.handle.Get("fd");
+  }
+  if (!value.IsNumber())
+  {
+    Napi::TypeError::New(info.Env(), std::string("Argument ") + std::to_string(I) +
+                                         " must be a string, a file descriptor or a FileHandle. " + message)
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+
+#ifdef _WIN32
+  Napi::TypeError::New(info.Env(), "Saving to a file descriptor is not supported on this platform")
+      .ThrowAsJavaScriptException();
+  return false;
+#else
+  double fd = value.As<Napi::Number>().DoubleValue();
+  if (!(fd >= 0 && fd <= INT_MAX) || fd != (int)fd)
+  {
+    Napi::RangeError::New(info.Env(), "Value for file descriptor must be an integer of 0 or greater")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+  target.fd = (int)fd;
+
+  if (info.Length() > I + 1 && IsJobOptions(info, info.Length() - 1) &&
+      !ReadSaveOptions(info[info.Length() - 1].As<Napi::Object>(), target))
+  {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(target.fd, &st) != 0)
+  {
+    Napi::Error::New(info.Env(), std::string("Cannot save to file descriptor: ") + strerror(errno))
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+  if (!S_ISREG(st.st_mode))
+  {
+    Napi::TypeError::New(info.Env(), "File descriptor must be of a regular file")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+  return true;
+#endif
+}
+
+/**
+ * gdIOCtx writing to the file descriptor of a regular file from the thread
+ * pool
+ *
+ * Output is gathered in a buffer and written with pwrite() at the offset
+ * plus the position of the encoder, so seeking works as for a file.
+ */
+struct FdWriteCtx
+{
+  // first member, libgd passes a pointer to it to the callbacks
+  gdIOCtx ctx;
+
+  int fd;
+
+  int64_t offset;
+
+  // position of the encoder, and the end of what it wrote
+  int64_t position;
+
+  int64_t length;
+
+  std::vector<unsigned char> buffer;
+
+  // position of the first byte in buffer
+  int64_t bufferPosition;
+
+  int error;
+};
+
+static const size_t FD_BUFFER_SIZE = 64 * 1024;
+
+#ifndef _WIN32
+static bool FdFlush(FdWriteCtx *out)
+{
+  size_t done = 0;
+  while (done < out->buffer.size() && out->error == 0)
+  {
+    ssize_t written = pwrite(out->fd, out->buffer.data() + done, out->buffer.size() - done,
+                             (off_t)(out->offset + out->bufferPosition + (int64_t)done));
+    if (written < 0)
+    {
+      if (errno != EINTR)
+      {
+        out->error = errno;
+      }
+      continue;
+    }
+    done += (size_t)written;
+  }
+  out->bufferPosition += (int64_t)out->buffer.size();
+  out->buffer.clear();
+  return out->error == 0;
+}
+
+static int FdPutBuf(gdIOCtx *ctx, const void *buf, int size)
+{
+  FdWriteCtx *out = (FdWriteCtx *)ctx;
+  if (out->error != 0)
+  {
+    return 0;
+  }
+  if (out->buffer.size() + (size_t)size > FD_BUFFER_SIZE && !FdFlush(out))
+  {
+    return 0;
+  }
+  if (out->buffer.empty())
+  {
+    out->bufferPosition = out->position;
+  }
+  out->buffer.insert(out->buffer.end(), (const unsigned char *)buf, (const unsigned char *)buf + size);
+  out->position += size;
+  out->length = std::max(out->length, out->position);
+  return size;
+}
+
+static void FdPutC(gdIOCtx *ctx, int c)
+{
+  unsigned char byte = (unsigned char)c;
+  FdPutBuf(ctx, &byte, 1);
+}
+
+static int FdSeek(gdIOCtx *ctx, const int position)
+{
+  FdWriteCtx *out = (FdWriteCtx *)ctx;
+  if (position == out->position)
+  {
+    return 1;
+  }
+  if (position < 0 || !FdFlush(out))
+  {
+    return 0;
+  }
+  out->position = position;
+  return 1;
+}
+
+static long FdTell(gdIOCtx *ctx)
+{
+  return (long)((FdWriteCtx *)ctx)->position;
+}
+
+static void FdFreeCtx(gdIOCtx *ctx)
+{
+  // owned by the worker
+}
+
+/**
+ * Set up a gdIOCtx writing to the file descriptor of target. A descriptor
+ * without an offset is written from its current position, which is moved
+ * past the output by FinishFdWriteCtx().
+ */
+static void InitFdWriteCtx(FdWriteCtx &out, const SaveTarget &target)
+{
+  memset(&out.ctx, 0, sizeof(out.ctx));
+  out.ctx.putC = FdPutC;
+  out.ctx.putBuf = FdPutBuf;
+  out.ctx.seek = FdSeek;
+  out.ctx.tell = FdTell;
+  out.ctx.gd_free = FdFreeCtx;
+  out.fd = target.fd;
+  out.position = 0;
+  out.length = 0;
+  out.bufferPosition = 0;
+  out.error = 0;
+  out.buffer.reserve(FD_BUFFER_SIZE);
+
+  if (target.offset >= 0)
+  {
+    out.offset = (int64_t)target.offset;
+    return;
+  }
+  off_t current = lseek(target.fd, 0, SEEK_CUR);
+  out.offset = current >= 0 ? (int64_t)current : 0;
+  if (current < 0)
+  {
+    out.error = errno;
+  }
+}
+
+/**
+ * Write what is left in the buffer. Returns 0 or the errno of the first
+ * failed write.
+ */
+static int FinishFdWriteCtx(FdWriteCtx &out, const SaveTarget &target)
+{
+  FdFlush(&out);
+  if (out.error == 0 && target.offset < 0 &&
+      lseek(out.fd, (off_t)(out.offset + out.length), SEEK_SET) < 0)
+  {
+    out.error = errno;
+  }
+  return out.error;
+}
+
+static int SyncFd(int fd)
+{
+#ifdef __linux__
+  int result = fdatasync(fd);
+#else
+  int result = fsync(fd);
+#endif
+  return result == 0 ? 0 : errno;
+}
+
+/**
+ * Groups the fsyncs of save jobs which ask for fsync: 'batch'
+ *
+ * The jobs hand their descriptor over and leave the thread pool. A thread
+ * of its own waits a short window after the first descriptor of a group
+ * for others to join, then syncs every descriptor of the group once and
+ * reports the result to each job. Many small images written into a few
+ * files then cost a few syncs instead of one each.
+ */
+class FsyncBatch
+{
+public:
+  typedef std::function<void(int)> Callback;
+
+  static FsyncBatch &Instance()
+  {
+    static FsyncBatch *batch = new FsyncBatch();
+    return *batch;
+  }
+
+  /**
+   * Sync fd with the next group, then call done with 0 or the errno of
+   * the sync, on the thread of the batch
+   */
+  void Add(int fd, Callback done)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_jobs == 0)
+    {
+      _opened = std::chrono::steady_clock::now();
+    }
+    _pending[fd].push_back(std::move(done));
+    _jobs++;
+
+    if (!_started)
+    {
+      _started = true;
+      std::thread(&FsyncBatch::Run, this).detach();
+    }
+    _changed.notify_one();
+  }
+
+private:
+  static constexpr int WINDOW_MS = 2;
+
+  static constexpr int MAX_JOBS = 256;
+
+  FsyncBatch()
+  {
+  }
+
+  void Run()
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true)
+    {
+      _changed.wait(lock, [this]()
+                    { return _jobs > 0; });
+      _changed.wait_until(lock, _opened + std::chrono::milliseconds(WINDOW_MS), [this]()
+                          { return _jobs >= MAX_JOBS; });
+
+      // later jobs start the next group while this one syncs
+      std::map<int, std::vector<Callback> > group;
+      group.swap(_pending);
+      _jobs = 0;
+      lock.unlock();
+
+      for (auto &entry : group)
+      {
+        int error = SyncFd(entry.first);
+        for (Callback &done : entry.second)
+        {
+          done(error);
+        }
+      }
+
+      lock.lock();
+    }
+  }
+
+  std::mutex _mutex;
+
+  std::condition_variable _changed;
+
+  std::map<int, std::vector<Callback> > _pending;
+
+  int _jobs{0};
+
+  std::chrono::steady_clock::time_point _opened;
+
+  bool _started{false};
+};
+#endif
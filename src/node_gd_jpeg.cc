@@ -0,0 +1,340 @@
+/**
+ * Copyright (c) 2020, Vincent Bruijn <vebruijn@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <napi.h>
+#include <gd.h>
+#include <climits>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#if HAS_LIBJPEG
+#include <jpeglib.h>
+#endif
+#include "node_gd.h"
+
+/**
+ * Shrink-on-load of JPEG images: a fixed denominator of 2, 4 or 8, or the
+ * size the image is wanted at, for which the largest denominator is picked
+ * that still decodes at least that size. 0 leaves a value unset.
+ */
+struct JpegScale
+{
+  int scaleDenom{0};
+  int targetWidth{0};
+  int targetHeight{0};
+
+  bool Any() const
+  {
+    return scaleDenom > 1 || targetWidth > 0 || targetHeight > 0;
+  }
+};
+
+/**
+ * Read scaleDenom, targetWidth and targetHeight of the trailing options
+ * object. Throws and returns false for invalid values.
+ */
+static bool ReadJpegScale(const Napi::CallbackInfo &info, JpegScale &scale)
+{
+  if (info.Length() == 0 || !IsJobOptions(info, info.Length() - 1))
+  {
+    return true;
+  }
+  Napi::Object options = info[info.Length() - 1].As<Napi::Object>();
+
+  const char *names[] = {"scaleDenom", "targetWidth", "targetHeight"};
+  int *values[] = {&scale.scaleDenom, &scale.targetWidth, &scale.targetHeight};
+  for (int i = 0; i < 3; i++)
+  {
+    Napi::Value value = options.Get(names[i]);
+    if (value.IsUndefined())
+    {
+      continue;
+    }
+    double number = value.IsNumber() ? value.As<Napi::Number>().DoubleValue() : -1;
+    if (!(number >= 1 && number <= INT_MAX) || number != (int)number)
+    {
+      Napi::RangeError::New(info.Env(), std::string("Value for ") + names[i] + " must be an integer of 1 or greater")
+          .ThrowAsJavaScriptException();
+      return false;
+    }
+    *values[i] = (int)number;
+  }
+
+  if (scale.scaleDenom != 0 && scale.scaleDenom != 1 && scale.scaleDenom != 2 &&
+      scale.scaleDenom != 4 && scale.scaleDenom != 8)
+  {
+    Napi::RangeError::New(info.Env(), "Value for scaleDenom must be 1, 2, 4 or 8")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+  if (scale.scaleDenom != 0 && (scale.targetWidth > 0 || scale.targetHeight > 0))
+  {
+    Napi::TypeError::New(info.Env(), "Use either scaleDenom or targetWidth and targetHeight")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Size libjpeg decodes a side of length to at 1/denom
+ */
+static uint32_t JpegScaledLength(uint32_t length, int denom)
+{
+  return (uint32_t)(((uint64_t)length + denom - 1) / denom);
+}
+
+/**
+ * The denominator to decode an image of width x height at
+ */
+static int JpegScaleDenom(const JpegScale &scale, uint32_t width, uint32_t height)
+{
+  if (scale.scaleDenom > 0)
+  {
+    return scale.scaleDenom;
+  }
+  for (int denom = 8; denom > 1; denom /= 2)
+  {
+    if (JpegScaledLength(width, denom) >= (uint32_t)scale.targetWidth &&
+        JpegScaledLength(height, denom) >= (uint32_t)scale.targetHeight)
+    {
+      return denom;
+    }
+  }
+  return 1;
+}
+
+/**
+ * The header of the image a scaled decode creates, to admit it to the
+ * memory limit with the size it really takes
+ */
+static ProbeResult JpegScaledHeader(const ProbeResult &header, const JpegScale &scale)
+{
+  ProbeResult scaled = header;
+  int denom = JpegScaleDenom(scale, header.width, header.height);
+  scaled.width = JpegScaledLength(header.width, denom);
+  scaled.height = JpegScaledLength(header.height, denom);
+  scaled.trueColor = true;
+  return scaled;
+}
+
+#if HAS_LIBJPEG
+/**
+ * libjpeg reports fatal errors by calling error_exit, which must not
+ * return. It jumps back into DecodeJpegScaled() instead.
+ */
+struct JpegErrorManager
+{
+  struct jpeg_error_mgr pub;
+  jmp_buf jump;
+  char message[JMSG_LENGTH_MAX];
+};
+
+static void JpegErrorExit(j_common_ptr cinfo)
+{
+  JpegErrorManager *error = (JpegErrorManager *)cinfo->err;
+  (*cinfo->err->format_message)(cinfo, error->message);
+  longjmp(error->jump, 1);
+}
+
+static void JpegOutputMessage(j_common_ptr cinfo)
+{
+  // warnings of corrupt data are not printed, like libgd does by default
+}
+
+/**
+ * Source manager reading from memory, jpeg_mem_src() is missing from
+ * libjpeg before version 8
+ */
+static void JpegMemInit(j_decompress_ptr cinfo)
+{
+}
+
+static boolean JpegMemFill(j_decompress_ptr cinfo)
+{
+  // a truncated image ends in an end of image marker, as libjpeg does
+  static const JOCTET eoi[2] = {0xFF, JPEG_EOI};
+  cinfo->src->next_input_byte = eoi;
+  cinfo->src->bytes_in_buffer = 2;
+  return TRUE;
+}
+
+static void JpegMemSkip(j_decompress_ptr cinfo, long count)
+{
+  if (count <= 0)
+  {
+    return;
+  }
+  if ((size_t)count > cinfo->src->bytes_in_buffer)
+  {
+    JpegMemFill(cinfo);
+    return;
+  }
+  cinfo->src->next_input_byte += count;
+  cinfo->src->bytes_in_buffer -= (size_t)count;
+}
+
+static void JpegMemTerm(j_decompress_ptr cinfo)
+{
+}
+
+static void JpegMemSource(j_decompress_ptr cinfo, struct jpeg_source_mgr *source,
+                          const void *data, size_t length)
+{
+  source->init_source = JpegMemInit;
+  source->fill_input_buffer = JpegMemFill;
+  source->skip_input_data = JpegMemSkip;
+  source->resync_to_restart = jpeg_resync_to_restart;
+  source->term_source = JpegMemTerm;
+  source->next_input_byte = (const JOCTET *)data;
+  source->bytes_in_buffer = length;
+  cinfo->src = source;
+}
+
+/**
+ * Decode a JPEG image at a reduced size with the DCT scaling of libjpeg,
+ * into a true color image. Only the scaled image is ever allocated, and
+ * most of the inverse DCT is skipped. setSource attaches the input.
+ */
+static gdImagePtr DecodeJpegScaled(const std::function<void(j_decompress_ptr)> &setSource,
+                                   const JpegScale &scale, std::string &error)
+{
+  struct jpeg_decompress_struct cinfo;
+  JpegErrorManager jerr;
+  gdImagePtr volatile image = nullptr;
+  JSAMPROW volatile row = nullptr;
+
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = JpegErrorExit;
+  jerr.pub.output_message = JpegOutputMessage;
+  jerr.message[0] = '\0';
+
+  if (setjmp(jerr.jump))
+  {
+    error = std::string("Cannot read JPEG data: ") + jerr.message;
+    jpeg_destroy_decompress(&cinfo);
+    free(row);
+    if (image != nullptr)
+    {
+      gdImageDestroy(image);
+    }
+    return nullptr;
+  }
+
+  jpeg_create_decompress(&cinfo);
+  setSource(&cinfo);
+  jpeg_read_header(&cinfo, TRUE);
+
+  int denom = JpegScaleDenom(scale, cinfo.image_width, cinfo.image_height);
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = (unsigned int)denom;
+
+  bool cmyk = cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK;
+  cinfo.out_color_space = cmyk ? JCS_CMYK : JCS_RGB;
+  jpeg_start_decompress(&cinfo);
+
+  if (cinfo.output_width > INT_MAX || cinfo.output_height > INT_MAX ||
+      (double)cinfo.output_width * cinfo.output_height > INT_MAX)
+  {
+    error = "Image is too large to decode";
+    jpeg_destroy_decompress(&cinfo);
+    return nullptr;
+  }
+
+  image = RasterPool::Instance().Create((int)cinfo.output_width, (int)cinfo.output_height, true);
+  row = (JSAMPROW)malloc((size_t)cinfo.output_width * cinfo.output_components);
+  if (image == nullptr || row == nullptr)
+  {
+    error = "Cannot allocate the JPEG image";
+    jpeg_destroy_decompress(&cinfo);
+    free(row);
+    if (image != nullptr)
+    {
+      gdImageDestroy(image);
+    }
+    return nullptr;
+  }
+  if (cinfo.progressive_mode)
+  {
+    gdImageInterlace(image, 1);
+  }
+
+  // Adobe writes CMYK inverted, libgd assumes the same
+  bool inverted = cmyk && cinfo.saw_Adobe_marker;
+  JSAMPROW rows[1] = {row};
+  while (cinfo.output_scanline < cinfo.output_height)
+  {
+    int y = (int)cinfo.output_scanline;
+    jpeg_read_scanlines(&cinfo, rows, 1);
+
+    int *pixels = image->tpixels[y];
+    const JSAMPLE *in = row;
+    for (JDIMENSION x = 0; x < cinfo.output_width; x++)
+    {
+      if (cmyk)
+      {
+        int c = inverted ? 255 - in[0] : in[0];
+        int m = inverted ? 255 - in[1] : in[1];
+        int ye = inverted ? 255 - in[2] : in[2];
+        int k = inverted ? 255 - in[3] : in[3];
+        pixels[x] = gdTrueColor((255 - c) * (255 - k) / 255, (255 - m) * (255 - k) / 255,
+                                (255 - ye) * (255 - k) / 255);
+        in += 4;
+      }
+      else
+      {
+        pixels[x] = gdTrueColor(in[0], in[1], in[2]);
+        in += 3;
+      }
+    }
+  }
+
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  free(row);
+  return image;
+}
+
+static gdImagePtr DecodeJpegScaled(FILE *in, const JpegScale &scale, std::string &error)
+{
+  return DecodeJpegScaled([in](j_decompress_ptr cinfo)
+                          { jpeg_stdio_src(cinfo, in); },
+                          scale, error);
+}
+
+static gdImagePtr DecodeJpegScaled(const void *data, size_t length, const JpegScale &scale,
+                                   std::string &error)
+{
+  struct jpeg_source_mgr source;
+  return DecodeJpegScaled([&source, data, length](j_decompress_ptr cinfo)
+                          { JpegMemSource(cinfo, &source, data, length); },
+                          scale, error);
+}
+#else
+static gdImagePtr DecodeJpegScaled(FILE *in, const JpegScale &scale, std::string &error)
+{
+  error = "Scaled JPEG decoding needs node-gd to be built with libjpeg";
+  return nullptr;
+}
+
+static gdImagePtr DecodeJpegScaled(const void *data, size_t length, const JpegScale &scale,
+                                   std::string &error)
+{
+  error = "Scaled JPEG decoding needs node-gd to be built with libjpeg";
+  return nullptr;
+}
+#endif
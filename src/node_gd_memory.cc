@@ -0,0 +1,193 @@
+/**
+ * Copyright (c) 2020, Vincent Bruijn <vebruijn@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <napi.h>
+#include <algorithm>
+#include <mutex>
+#include "node_gd.h"
+
+/**
+ * Bytes of the pixel rows and row pointers of an image
+ */
+static inline size_t ImageBytes(int width, int height, bool trueColor)
+{
+  size_t pixel = trueColor ? sizeof(int) : sizeof(unsigned char);
+  return (size_t)height * (sizeof(void *) + (size_t)width * pixel);
+}
+
+/**
+ * Wake the thread pool, so jobs waiting for memory are looked at again
+ */
+static void WakeGdPool();
+
+/**
+ * Process-wide budget of pixel memory
+ *
+ * Counts the bytes of the pixels of every live gd.Image, and the bytes
+ * reserved by jobs which create images while they are running. With a
+ * limit set, jobs which create images are only started when their image
+ * fits within the limit. Otherwise they are rejected, or wait in the queue
+ * until memory is freed. Decoders of a Buffer are admitted with the size
+ * in the header of their image. Decoders of a file are started as long as
+ * the limit has not been reached yet, and reserve the size in the header
+ * once they have read it.
+ */
+class MemoryBudget
+{
+public:
+  enum Mode
+  {
+    MEMORY_LIMIT_REJECT,
+    MEMORY_LIMIT_QUEUE
+  };
+
+  struct Usage
+  {
+    size_t images;
+    size_t reserved;
+    size_t limit;
+    Mode mode;
+    uint64_t rejected;
+  };
+
+  static MemoryBudget &Instance()
+  {
+    static MemoryBudget *budget = new MemoryBudget();
+    return *budget;
+  }
+
+  /**
+   * Change the bytes of live images by delta
+   */
+  void Adjust(int64_t delta)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _images = (size_t)std::max<int64_t>(0, (int64_t)_images + delta);
+    }
+    if (delta < 0)
+    {
+      WakeGdPool();
+    }
+  }
+
+  /**
+   * Whether an image of bytes fits within the limit now. An unknown size
+   * of 0 fits as long as the limit has not been reached.
+   */
+  bool Fits(size_t bytes)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return FitsLocked(bytes);
+  }
+
+  /**
+   * Whether an image of bytes can never fit, so waiting for memory is
+   * pointless
+   */
+  bool Exceeds(size_t bytes)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _limit > 0 && bytes > _limit;
+  }
+
+  /**
+   * Reserve bytes for a job which is about to create an image. Returns
+   * false when they do not fit.
+   */
+  bool Reserve(size_t bytes)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (!FitsLocked(bytes))
+    {
+      return false;
+    }
+    _reserved += bytes;
+    return true;
+  }
+
+  void Release(size_t bytes)
+  {
+    if (bytes == 0)
+    {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _reserved -= std::min(bytes, _reserved);
+    }
+    WakeGdPool();
+  }
+
+  void Rejected()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _rejected++;
+  }
+
+  bool HasLimit()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _limit > 0;
+  }
+
+  bool Queues()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _mode == MEMORY_LIMIT_QUEUE;
+  }
+
+  /**
+   * Change the limit, 0 removes it
+   */
+  void SetLimit(size_t limit, Mode mode)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _limit = limit;
+      _mode = mode;
+    }
+    WakeGdPool();
+  }
+
+  Usage GetUsage()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return Usage{_images, _reserved, _limit, _mode, _rejected};
+  }
+
+private:
+  MemoryBudget()
+  {
+  }
+
+  bool FitsLocked(size_t bytes) const
+  {
+    return _limit == 0 || _images + _reserved + std::max<size_t>(bytes, 1) <= _limit;
+  }
+
+  std::mutex _mutex;
+
+  size_t _images{0};
+
+  size_t _reserved{0};
+
+  size_t _limit{0};
+
+  Mode _mode{MEMORY_LIMIT_REJECT};
+
+  uint64_t _rejected{0};
+};
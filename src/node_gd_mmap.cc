@@ -0,0 +1,245 @@
+/**
+ * Copyright (c) 2020, Vincent Bruijn <vebruijn@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <napi.h>
+#include <gd.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <climits>
+#include <string>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "node_gd.h"
+
+/**
+ * How a file decoder reads its file: through a memory mapping when the file
+ * is at least as large as the mmap threshold, or as picked by the mmap
+ * option of the call
+ */
+enum MmapMode
+{
+  MMAP_AUTO,
+  MMAP_ALWAYS,
+  MMAP_NEVER
+};
+
+/**
+ * Process-wide size from which files are mapped, 0 maps no file unless
+ * asked for. Off by default: reading a mapped file which another process
+ * truncates raises SIGBUS, which ends the process.
+ */
+class MmapThreshold
+{
+public:
+  static uint64_t Get()
+  {
+    return Value().load();
+  }
+
+  static void Set(uint64_t bytes)
+  {
+    Value().store(bytes);
+  }
+
+private:
+  static std::atomic<uint64_t> &Value()
+  {
+    static std::atomic<uint64_t> *value = new std::atomic<uint64_t>(0);
+    return *value;
+  }
+};
+
+/**
+ * Read the mmap option of the trailing options object. Throws and returns
+ * false for an invalid value.
+ */
+static bool ReadMmapMode(const Napi::CallbackInfo &info, MmapMode &mode)
+{
+  mode = MMAP_AUTO;
+  if (info.Length() == 0 || !IsJobOptions(info, info.Length() - 1))
+  {
+    return true;
+  }
+
+  Napi::Value value = info[info.Length() - 1].As<Napi::Object>().Get("mmap");
+  if (value.IsUndefined())
+  {
+    return true;
+  }
+  if (!value.IsBoolean())
+  {
+    Napi::TypeError::New(info.Env(), "Value for mmap must be a Boolean")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+  mode = value.As<Napi::Boolean>().Value() ? MMAP_ALWAYS : MMAP_NEVER;
+  return true;
+}
+
+/**
+ * A file mapped read-only into memory
+ *
+ * The pages are read from the page cache by the decoder itself, without
+ * the copies and small reads of stdio. The mapping is advised as
+ * sequential, so the kernel reads ahead and drops pages behind.
+ */
+class MappedFile
+{
+public:
+  MappedFile() = default;
+
+  MappedFile(const MappedFile &) = delete;
+
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile()
+  {
+#ifndef _WIN32
+    if (_data != nullptr)
+    {
+      munmap(_data, _length);
+    }
+#endif
+  }
+
+  /**
+   * Map path when mode asks for it. Returns false when the file should be
+   * read through stdio instead: the mapping is not wanted, the file is
+   * empty or too large for the *Ptr decoders of libgd, or mmap failed.
+   */
+  bool Open(const std::string &path, MmapMode mode)
+  {
+#ifndef _WIN32
+    if (mode == MMAP_NEVER || (mode == MMAP_AUTO && MmapThreshold::Get() == 0))
+    {
+      return false;
+    }
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+      return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+        (uint64_t)st.st_size > INT_MAX ||
+        (mode == MMAP_AUTO && (uint64_t)st.st_size < MmapThreshold::Get()))
+    {
+      close(fd);
+      return false;
+    }
+
+    void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps its own reference to the file
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+      return false;
+    }
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    _data = data;
+    _length = (size_t)st.st_size;
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void *Data() const
+  {
+    return _data;
+  }
+
+  size_t Length() const
+  {
+    return _length;
+  }
+
+private:
+  void *_data{nullptr};
+
+  size_t _length{0};
+};
+
+typedef gdImagePtr (*MappedDecodeFunction)(int size, void *data);
+
+/**
+ * The *Ptr decoder of libgd for the extension of path, following the
+ * choice gdImageCreateFromFile() makes. Returns nullptr for formats which
+ * are only read through stdio.
+ */
+static MappedDecodeFunction DecoderForExtension(const std::string &path)
+{
+  size_t dot = path.find_last_of('.');
+  if (dot == std::string::npos)
+  {
+    return nullptr;
+  }
+  std::string ext = path.substr(dot + 1);
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+  if (ext == "jpg" || ext == "jpeg")
+  {
+    return gdImageCreateFromJpegPtr;
+  }
+  if (ext == "png")
+  {
+    return gdImageCreateFromPngPtr;
+  }
+  if (ext == "gif")
+  {
+    return gdImageCreateFromGifPtr;
+  }
+  if (ext == "bmp")
+  {
+    return gdImageCreateFromBmpPtr;
+  }
+  if (ext == "wbmp")
+  {
+    return gdImageCreateFromWBMPPtr;
+  }
+#if HAS_LIBWEBP
+  if (ext == "webp")
+  {
+    return gdImageCreateFromWebpPtr;
+  }
+#endif
+#if HAS_LIBTIFF
+  if (ext == "tiff" || ext == "tif")
+  {
+    return gdImageCreateFromTiffPtr;
+  }
+#endif
+#if HAS_LIBHEIF
+  if (ext == "heif" || ext == "heic")
+  {
+    return gdImageCreateFromHeifPtr;
+  }
+#endif
+#if HAS_LIBAVIF
+  if (ext == "avif")
+  {
+    return gdImageCreateFromAvifPtr;
+  }
+#endif
+  return nullptr;
+}
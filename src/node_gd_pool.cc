@@ -0,0 +1,1030 @@
+/**
+ * Copyright (c) 2020, Vincent Bruijn <vebruijn@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <napi.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "node_gd.h"
+
+/**
+ * Thread pool of node-gd
+ *
+ * Image work runs on threads owned by node-gd instead of the libuv pool, so
+ * slow encodes do not hold up fs, dns and zlib work of the rest of the
+ * process. The pool is shared by all threads of the process. Results are
+ * delivered to the JavaScript thread through a thread-safe function.
+ *
+ * Jobs are either interactive, the default, or batch. Queued interactive
+ * jobs always go first and batch jobs leave one thread free for interactive
+ * work. Jobs can also belong to a lane, the format they decode or encode,
+ * and the amount of running jobs per lane can be capped.
+ *
+ * Jobs can be aborted with an AbortSignal or a deadline. Queued jobs are
+ * dropped without running and long running jobs stop between units of work.
+ */
+class GdWorker;
+
+enum GdPriority
+{
+  GD_PRIORITY_INTERACTIVE,
+  GD_PRIORITY_BATCH,
+  GD_PRIORITY_COUNT
+};
+
+class GdPool
+{
+public:
+  struct LaneStats
+  {
+    size_t limit;
+    size_t running;
+    size_t queued;
+  };
+
+  struct Stats
+  {
+    size_t concurrency;
+    size_t threads;
+    size_t queued;
+    size_t running;
+    uint64_t completed;
+    uint64_t aborted;
+    size_t queuedByPriority[GD_PRIORITY_COUNT];
+    std::map<std::string, LaneStats> lanes;
+  };
+
+  /**
+   * The pool is created on first use and never destroyed: its threads are
+   * detached and may still be running when the process exits.
+   */
+  static GdPool &Instance()
+  {
+    static GdPool *pool = new GdPool();
+    return *pool;
+  }
+
+  /**
+   * Create the thread-safe function jobs of env are delivered through
+   */
+  static void Init(Napi::Env env);
+
+  /**
+   * Count a job of env as pending. The event loop of env is kept alive while
+   * any of its jobs is pending.
+   */
+  static void Ref(Napi::Env env);
+
+  static void Unref(Napi::Env env);
+
+  /**
+   * Amount of jobs queued from env which have not been delivered back yet
+   */
+  static size_t Pending(Napi::Env env)
+  {
+    return env.GetInstanceData<GdInstanceData>()->pending;
+  }
+
+  void Submit(GdWorker *job);
+
+  /**
+   * Take job off the queue. Returns false when it is not queued, because it
+   * is running or has already run.
+   */
+  bool Cancel(GdWorker *job);
+
+  /**
+   * Called on the JavaScript thread when env is torn down, before its
+   * gd.Image objects and Buffers are freed. Queued jobs of env are dropped
+   * and its running jobs, which may still use them, are waited for.
+   */
+  void Teardown(napi_env env);
+
+  /**
+   * Change the maximum amount of threads. Extra threads are started on
+   * demand and surplus threads exit once they are idle.
+   */
+  void SetConcurrency(size_t concurrency)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _concurrency = concurrency;
+    while (_threads < _concurrency && _threads - _idle < Queued())
+    {
+      _threads++;
+      std::thread(&GdPool::Run, this).detach();
+    }
+    _wake.notify_all();
+  }
+
+  /**
+   * Cap the amount of running jobs of a lane, 0 removes the cap
+   */
+  void SetLaneLimit(const std::string &lane, size_t limit)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _lanes[lane].limit = limit;
+    _wake.notify_all();
+  }
+
+  Stats GetStats();
+
+  /**
+   * Look at queued jobs again, for instance after memory was freed
+   */
+  void Wake()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _wake.notify_all();
+  }
+
+private:
+  GdPool()
+  {
+    unsigned int cores = std::thread::hardware_concurrency();
+    _concurrency = cores > 0 ? cores : 4;
+  }
+
+  struct Lane
+  {
+    size_t limit{0};
+    size_t running{0};
+  };
+
+  void Run();
+
+  /**
+   * Take the next job which may run now off the queues, or return nullptr.
+   * Must be called with _mutex locked.
+   */
+  GdWorker *Next();
+
+  /**
+   * Book keeping after a job has been executed, with _mutex locked
+   */
+  void Finish(GdWorker *job);
+
+  size_t Queued() const
+  {
+    return _queues[GD_PRIORITY_INTERACTIVE].size() + _queues[GD_PRIORITY_BATCH].size();
+  }
+
+  std::mutex _mutex;
+
+  std::condition_variable _wake;
+
+  std::deque<GdWorker *> _queues[GD_PRIORITY_COUNT];
+
+  std::map<std::string, Lane> _lanes;
+
+  size_t _runningBatch{0};
+
+  // keys of the running jobs which are serialized
+  std::set<int> _serialRunning;
+
+  std::set<GdWorker *> _running;
+
+  // signalled when a job has finished running
+  std::condition_variable _finished;
+
+  size_t _concurrency;
+
+  size_t _threads{0};
+
+  size_t _idle{0};
+
+  std::atomic<uint64_t> _completed{0};
+
+  std::atomic<uint64_t> _aborted{0};
+};
+
+/**
+ * GdDelivery holds the thread-safe function of an environment
+ *
+ * Threads of the pool may still hold on to it after the environment has
+ * been torn down, for instance when a worker thread exits while its jobs
+ * run. The thread-safe function is released by then, so it is only called
+ * while the environment is open.
+ */
+class GdDelivery
+{
+public:
+  Napi::ThreadSafeFunction tsfn;
+
+  /**
+   * Hand job over to the JavaScript thread of the environment. When the
+   * environment is closed the job can no longer be delivered and is left
+   * behind on purpose, its references belong to that JavaScript thread.
+   */
+  void Call(GdWorker *job);
+
+  void Close()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _closed = true;
+  }
+
+private:
+  std::mutex _mutex;
+
+  bool _closed{false};
+};
+
+/**
+ * GdWorker is the base class of all node-gd workers
+ *
+ * It has the interface of Napi::AsyncWorker, but Execute() runs on the
+ * thread pool of node-gd. OnOK() or OnError() are called on the JavaScript
+ * thread afterwards, after which the worker deletes itself.
+ */
+class GdWorker
+{
+public:
+  GdWorker(napi_env env, const char *resource_name)
+      : _env(env), _context(env, resource_name)
+  {
+  }
+
+  virtual ~GdWorker()
+  {
+    ReleaseImage();
+  }
+
+  Napi::Env Env() const
+  {
+    return _env;
+  }
+
+  void Queue()
+  {
+    GdPool::Ref(_env);
+    _delivery = _env.GetInstanceData<GdInstanceData>()->delivery;
+
+    if (_cancelled)
+    {
+      // the signal was aborted before the call
+      _aborted = true;
+      _delivery->Call(this);
+      return;
+    }
+
+    if (!_signal.IsEmpty())
+    {
+      Napi::Object signal = _signal.Value();
+      _listener = Napi::Persistent(Napi::Function::New(_env, OnAbortSignal, "onabort", this));
+      signal.Get("addEventListener").As<Napi::Function>().Call(signal, {Napi::String::New(_env, "abort"), _listener.Value()});
+    }
+
+    // the pool only sees the deadline when a thread looks at the queue, the
+    // timer rejects the job while all threads are busy
+    if (_deadlineMs >= 0 && _deadlineMs <= INT_MAX)
+    {
+      Napi::Object global = _env.Global();
+      Napi::Function onDeadline = Napi::Function::New(_env, OnDeadline, "ondeadline", this);
+      _timer = Napi::Persistent(global.Get("setTimeout").As<Napi::Function>().Call(global, {onDeadline, Napi::Number::New(_env, _deadlineMs)}).As<Napi::Object>());
+    }
+
+    GdPool::Instance().Submit(this);
+  }
+
+  /**
+   * Put the worker in lane, the format it works on, and read the priority,
+   * signal and deadline from the trailing options object of an async
+   * function, which is only looked for from argument first on. Throws and
+   * returns false when an option is invalid.
+   */
+  bool ReadJobOptions(const Napi::CallbackInfo &info, size_t first, const std::string &lane)
+  {
+    _lane = lane;
+    std::transform(_lane.begin(), _lane.end(), _lane.begin(), ::tolower);
+
+    if (info.Length() <= first || !IsJobOptions(info, info.Length() - 1))
+    {
+      return true;
+    }
+
+    Napi::Object options = info[info.Length() - 1].As<Napi::Object>();
+
+    Napi::Value priority = options.Get("priority");
+    if (!priority.IsUndefined())
+    {
+      std::string value = priority.ToString().Utf8Value();
+      if (value == "interactive")
+      {
+        _priority = GD_PRIORITY_INTERACTIVE;
+      }
+      else if (value == "batch")
+      {
+        _priority = GD_PRIORITY_BATCH;
+      }
+      else
+      {
+        Napi::RangeError::New(info.Env(), "Value for priority must be 'interactive' (default) or 'batch'")
+            .ThrowAsJavaScriptException();
+        return false;
+      }
+    }
+
+    Napi::Value deadline = options.Get("deadlineMs");
+    if (!deadline.IsUndefined())
+    {
+      double ms = deadline.IsNumber() ? deadline.As<Napi::Number>().DoubleValue() : -1;
+      if (!(ms >= 0))
+      {
+        Napi::RangeError::New(info.Env(), "Value for deadlineMs must be a Number of 0 or greater")
+            .ThrowAsJavaScriptException();
+        return false;
+      }
+      _deadline = Clock::now() + std::chrono::microseconds((int64_t)(std::min(ms, 1e12) * 1000));
+      _deadlineMs = ms;
+    }
+
+    Napi::Value signal = options.Get("signal");
+    if (!signal.IsUndefined())
+    {
+      if (!signal.IsObject() || !signal.As<Napi::Object>().Get("addEventListener").IsFunction())
+      {
+        Napi::TypeError::New(info.Env(), "Value for signal must be an AbortSignal")
+            .ThrowAsJavaScriptException();
+        return false;
+      }
+      _signal = Napi::Persistent(signal.As<Napi::Object>());
+      _cancelled = signal.As<Napi::Object>().Get("aborted").ToBoolean().Value();
+    }
+    return true;
+  }
+
+  /**
+   * Run the job only while no other job with the same key runs, and not
+   * before the jobs with that key queued before it
+   */
+  void SerializeOn(int key)
+  {
+    _serialKey = key;
+  }
+
+  /**
+   * Make the job subject to the memory limit, as it creates an image of
+   * bytes, or of an unknown size when 0
+   */
+  void SetMemoryCost(size_t bytes)
+  {
+    _admission = true;
+    _memoryCost = bytes;
+  }
+
+  /**
+   * Take a lease on the Gd::Image the method was called on for as long as
+   * the job is pending, shared for reading or exclusive for modifying it.
+   * Throws and returns false when the image is in use in a conflicting
+   * way.
+   */
+  bool LeaseImage(const Napi::CallbackInfo &info, bool exclusive)
+  {
+    Napi::Object self = info.This().As<Napi::Object>();
+    Gd::Image *image = Napi::ObjectWrap<Gd::Image>::Unwrap(self);
+
+    if (!image->AcquireLease(exclusive))
+    {
+      Napi::Error::New(info.Env(), exclusive ? "Image is in use by an asynchronous operation and cannot be modified"
+                                             : "Image is being modified asynchronously")
+          .ThrowAsJavaScriptException();
+      return false;
+    }
+
+    _leased = image;
+    _leaseExclusive = exclusive;
+    _leaseOwner = Napi::Persistent(self);
+    return true;
+  }
+
+  /**
+   * Whether the job was aborted through its signal or has run past its
+   * deadline. Long running work checks this between units of work and
+   * returns early when it is true, the Promise is then rejected with an
+   * AbortError instead.
+   */
+  bool Cancelled()
+  {
+    if (_cancelled || (_deadline != Clock::time_point() && Clock::now() >= _deadline))
+    {
+      _aborted = true;
+    }
+    return _aborted;
+  }
+
+protected:
+  virtual void Execute() = 0;
+
+  /**
+   * Keep the job from being delivered when Execute() returns, for work it
+   * hands over to another thread. That thread calls Resume() when done.
+   */
+  void Suspend()
+  {
+    _holds++;
+  }
+
+  /**
+   * Deliver the job once Execute() and the work it was suspended for have
+   * both finished
+   */
+  void Resume()
+  {
+    if (--_holds == 0)
+    {
+      Post();
+    }
+  }
+
+  virtual void OnOK()
+  {
+  }
+
+  virtual void OnError(const Napi::Error &e)
+  {
+  }
+
+  void SetError(const std::string &error)
+  {
+    _error = error;
+    _failed = true;
+  }
+
+  /**
+   * Check the header of an image about to be decoded against the decode
+   * limits, and reserve the memory of the image as far as the job was not
+   * admitted with it already. An image of which the header could not be
+   * read is rejected while a memory limit is set. Sets the error and
+   * returns false when the image must not be decoded.
+   */
+  bool AdmitDecode(const DecodeLimits &limits, bool probed, const ProbeResult &header)
+  {
+    std::string error = CheckDecodeLimits(limits, probed, header);
+    if (!error.empty())
+    {
+      SetError(error);
+      return false;
+    }
+    if (!probed)
+    {
+      // nothing bounds the size of the image, so it cannot be admitted
+      // under a memory limit
+      if (MemoryBudget::Instance().HasLimit())
+      {
+        MemoryBudget::Instance().Rejected();
+        SetError("Cannot read image header to check the memory limit");
+        return false;
+      }
+      return true;
+    }
+
+    return AdmitBytes(HeaderBytes(header));
+  }
+
+  /**
+   * Reserve pixel memory as far as the job was not admitted with it
+   * already. Sets the error and returns false when the budget is exhausted.
+   */
+  bool AdmitBytes(size_t bytes)
+  {
+    if (bytes > _reserved)
+    {
+      if (!MemoryBudget::Instance().Reserve(bytes - _reserved))
+      {
+        MemoryBudget::Instance().Rejected();
+        SetError("Memory limit of node-gd exceeded");
+        return false;
+      }
+      _reserved = bytes;
+    }
+    return true;
+  }
+
+  /**
+   * The value a Promise is rejected with: the AbortError of an aborted job,
+   * or the message of any other error
+   */
+  Napi::Value Rejection(const Napi::Error &e)
+  {
+    if (_aborted)
+    {
+      return e.Value();
+    }
+    return Napi::String::New(_env, e.Message());
+  }
+
+private:
+  friend class GdPool;
+  friend class GdDelivery;
+
+  /**
+   * Called on a thread of the pool
+   */
+  void OnExecute()
+  {
+#ifdef NAPI_CPP_EXCEPTIONS
+    try
+    {
+      Execute();
+    }
+    catch (const std::exception &e)
+    {
+      SetError(e.what());
+    }
+#else
+    Execute();
+#endif
+  }
+
+  /**
+   * Called on a thread of the pool after OnExecute()
+   */
+  void Post()
+  {
+    _delivery->Call(this);
+  }
+
+  /**
+   * Called on the JavaScript thread
+   */
+  static void Deliver(Napi::Env env, Napi::Function, GdWorker *worker)
+  {
+    {
+      Napi::HandleScope scope(env);
+
+      if (!worker->_listener.IsEmpty())
+      {
+        Napi::Object signal = worker->_signal.Value();
+        signal.Get("removeEventListener").As<Napi::Function>().Call(signal, {Napi::String::New(env, "abort"), worker->_listener.Value()});
+      }
+      if (!worker->_timer.IsEmpty())
+      {
+        Napi::Object global = env.Global();
+        global.Get("clearTimeout").As<Napi::Function>().Call(global, {worker->_timer.Value()});
+      }
+
+      // released before the Promise settles, so its handlers may modify or
+      // destroy the image
+      worker->ReleaseImage();
+
+      Napi::CallbackScope callbackScope(env, worker->_context);
+
+#ifdef NAPI_CPP_EXCEPTIONS
+      try
+      {
+        worker->Complete();
+      }
+      catch (const Napi::Error &e)
+      {
+        e.ThrowAsJavaScriptException();
+      }
+#else
+      worker->Complete();
+#endif
+    }
+
+    // the image created by the job is counted by now
+    MemoryBudget::Instance().Release(worker->_reserved);
+
+    GdPool::Unref(env);
+    delete worker;
+  }
+
+  /**
+   * Called on the JavaScript thread when the signal of the job is aborted
+   */
+  static Napi::Value OnAbortSignal(const Napi::CallbackInfo &info)
+  {
+    GdWorker *worker = static_cast<GdWorker *>(info.Data());
+
+    worker->_cancelled = true;
+    if (GdPool::Instance().Cancel(worker))
+    {
+      worker->_aborted = true;
+      worker->_delivery->Call(worker);
+    }
+    return info.Env().Undefined();
+  }
+
+  /**
+   * Called on the JavaScript thread when the deadline of the job has passed
+   */
+  static Napi::Value OnDeadline(const Napi::CallbackInfo &info)
+  {
+    GdWorker *worker = static_cast<GdWorker *>(info.Data());
+
+    worker->_timer.Reset();
+    if (GdPool::Instance().Cancel(worker))
+    {
+      worker->_aborted = true;
+      worker->_delivery->Call(worker);
+    }
+    return info.Env().Undefined();
+  }
+
+  void ReleaseImage()
+  {
+    if (_leased != nullptr)
+    {
+      _leased->ReleaseLease(_env, _leaseExclusive);
+      _leased = nullptr;
+      _leaseOwner.Reset();
+    }
+  }
+
+  void Complete()
+  {
+    if (_aborted)
+    {
+      Napi::Error error = Napi::Error::New(_env, _cancelled ? "The operation was aborted"
+                                                            : "The deadline of the operation was exceeded");
+      error.Set("name", Napi::String::New(_env, "AbortError"));
+      error.Set("code", Napi::String::New(_env, "ABORT_ERR"));
+      OnError(error);
+    }
+    else if (_failed)
+    {
+      OnError(Napi::Error::New(_env, _error));
+    }
+    else
+    {
+      OnOK();
+    }
+  }
+
+  Napi::Env _env;
+
+  Napi::AsyncContext _context;
+
+  std::shared_ptr<GdDelivery> _delivery;
+
+  std::string _error;
+
+  bool _failed{false};
+
+  int _priority{GD_PRIORITY_INTERACTIVE};
+
+  std::string _lane;
+
+  typedef std::chrono::steady_clock Clock;
+
+  Clock::time_point _deadline;
+
+  double _deadlineMs{-1};
+
+  // the setTimeout() of the deadline while the job is queued
+  Napi::ObjectReference _timer;
+
+  Napi::ObjectReference _signal;
+
+  Napi::FunctionReference _listener;
+
+  // set on the JavaScript thread, read on the pool
+  std::atomic<bool> _cancelled{false};
+
+  bool _aborted{false};
+
+  Gd::Image *_leased{nullptr};
+
+  bool _leaseExclusive{false};
+
+  // keeps the leased image from being garbage collected
+  Napi::ObjectReference _leaseOwner;
+
+  bool _admission{false};
+
+  // Execute() and the work the job was suspended for, delivered at 0
+  std::atomic<int> _holds{1};
+
+  // jobs of the same key, 0 or greater, run one at a time
+  int _serialKey{-1};
+
+  size_t _memoryCost{0};
+
+  // bytes reserved in the memory budget while the job is pending
+  size_t _reserved{0};
+};
+
+void GdDelivery::Call(GdWorker *job)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  if (!_closed)
+  {
+    // the queue is unbounded, so this never blocks
+    tsfn.NonBlockingCall(job, GdWorker::Deliver);
+  }
+}
+
+void GdPool::Init(Napi::Env env)
+{
+  std::shared_ptr<GdDelivery> delivery = std::make_shared<GdDelivery>();
+
+  delivery->tsfn = Napi::ThreadSafeFunction::New(
+      env, Napi::Function::New(env, [](const Napi::CallbackInfo &) {}), "node-gd", 0, 1,
+      [delivery](Napi::Env) { delivery->Close(); });
+  delivery->tsfn.Unref(env);
+
+  // cleanup hooks run in reverse order, so this one runs before the
+  // gd.Image objects of env are finalized
+  napi_add_env_cleanup_hook(
+      env, [](void *arg) { GdPool::Instance().Teardown((napi_env)arg); }, (napi_env)env);
+
+  env.GetInstanceData<GdInstanceData>()->delivery = delivery;
+}
+
+void GdPool::Ref(Napi::Env env)
+{
+  GdInstanceData *data = env.GetInstanceData<GdInstanceData>();
+
+  if (data->pending++ == 0)
+  {
+    data->delivery->tsfn.Ref(env);
+  }
+}
+
+void GdPool::Unref(Napi::Env env)
+{
+  GdInstanceData *data = env.GetInstanceData<GdInstanceData>();
+
+  if (--data->pending == 0)
+  {
+    data->delivery->tsfn.Unref(env);
+  }
+}
+
+void GdPool::Submit(GdWorker *job)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  _queues[job->_priority].push_back(job);
+  if (_idle == 0 && _threads < _concurrency)
+  {
+    _threads++;
+    std::thread(&GdPool::Run, this).detach();
+  }
+  else
+  {
+    _wake.notify_all();
+  }
+}
+
+bool GdPool::Cancel(GdWorker *job)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  std::deque<GdWorker *> &queue = _queues[job->_priority];
+  auto it = std::find(queue.begin(), queue.end(), job);
+  if (it == queue.end())
+  {
+    return false;
+  }
+
+  queue.erase(it);
+  _aborted++;
+  return true;
+}
+
+static void WakeGdPool()
+{
+  GdPool::Instance().Wake();
+}
+
+GdWorker *GdPool::Next()
+{
+  // keys of jobs passed over, later jobs with these keys wait as well
+  std::set<int> waiting;
+
+  for (int priority = 0; priority < GD_PRIORITY_COUNT; priority++)
+  {
+    // one thread is kept free for interactive work
+    if (priority == GD_PRIORITY_BATCH && _runningBatch >= std::max<size_t>(1, _concurrency - 1))
+    {
+      break;
+    }
+
+    std::deque<GdWorker *> &queue = _queues[priority];
+    for (auto it = queue.begin(); it != queue.end();)
+    {
+      GdWorker *job = *it;
+      if (job->Cancelled())
+      {
+        // past its deadline, dropped without running
+        it = queue.erase(it);
+        _aborted++;
+        job->Post();
+        continue;
+      }
+      if (job->_serialKey >= 0 && (_serialRunning.count(job->_serialKey) > 0 || waiting.count(job->_serialKey) > 0))
+      {
+        ++it;
+        continue;
+      }
+      Lane *lane = job->_lane.empty() ? nullptr : &_lanes[job->_lane];
+      if (lane != nullptr && lane->limit > 0 && lane->running >= lane->limit)
+      {
+        if (job->_serialKey >= 0)
+        {
+          waiting.insert(job->_serialKey);
+        }
+        ++it;
+        continue;
+      }
+      if (job->_admission && !MemoryBudget::Instance().Reserve(job->_memoryCost))
+      {
+        if (MemoryBudget::Instance().Queues() && !MemoryBudget::Instance().Exceeds(job->_memoryCost))
+        {
+          // waits until images are freed
+          if (job->_serialKey >= 0)
+          {
+            waiting.insert(job->_serialKey);
+          }
+          ++it;
+          continue;
+        }
+        it = queue.erase(it);
+        MemoryBudget::Instance().Rejected();
+        job->SetError("Memory limit of node-gd exceeded");
+        job->Post();
+        continue;
+      }
+      if (job->_admission)
+      {
+        job->_reserved = job->_memoryCost;
+      }
+      if (lane != nullptr)
+      {
+        lane->running++;
+      }
+      if (priority == GD_PRIORITY_BATCH)
+      {
+        _runningBatch++;
+      }
+      if (job->_serialKey >= 0)
+      {
+        _serialRunning.insert(job->_serialKey);
+      }
+      _running.insert(job);
+
+      queue.erase(it);
+      return job;
+    }
+  }
+
+  return nullptr;
+}
+
+void GdPool::Finish(GdWorker *job)
+{
+  if (!job->_lane.empty())
+  {
+    _lanes[job->_lane].running--;
+  }
+  if (job->_priority == GD_PRIORITY_BATCH)
+  {
+    _runningBatch--;
+  }
+  if (job->_serialKey >= 0)
+  {
+    _serialRunning.erase(job->_serialKey);
+  }
+  _running.erase(job);
+  _finished.notify_all();
+
+  // a job waiting for this lane or thread may run now
+  _wake.notify_all();
+}
+
+void GdPool::Teardown(napi_env env)
+{
+  std::vector<GdWorker *> dropped;
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (std::deque<GdWorker *> &queue : _queues)
+    {
+      for (auto it = queue.begin(); it != queue.end();)
+      {
+        if ((napi_env)(*it)->_env == env)
+        {
+          dropped.push_back(*it);
+          it = queue.erase(it);
+        }
+        else
+        {
+          ++it;
+        }
+      }
+    }
+
+    // long running jobs stop at their next check
+    for (GdWorker *job : _running)
+    {
+      if ((napi_env)job->_env == env)
+      {
+        job->_cancelled = true;
+      }
+    }
+    _finished.wait(lock, [this, env] {
+      return std::none_of(_running.begin(), _running.end(),
+                          [env](GdWorker *job) { return (napi_env)job->_env == env; });
+    });
+  }
+
+  // never delivered, their references are released while env is open
+  for (GdWorker *job : dropped)
+  {
+    delete job;
+  }
+}
+
+GdPool::Stats GdPool::GetStats()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  Stats stats{_concurrency, _threads, Queued(), _threads - _idle, _completed.load(), _aborted.load(), {0, 0}, {}};
+
+  for (int priority = 0; priority < GD_PRIORITY_COUNT; priority++)
+  {
+    stats.queuedByPriority[priority] = _queues[priority].size();
+    for (GdWorker *job : _queues[priority])
+    {
+      if (!job->_lane.empty())
+      {
+        stats.lanes[job->_lane].queued++;
+      }
+    }
+  }
+  for (auto &entry : _lanes)
+  {
+    LaneStats &lane = stats.lanes[entry.first];
+    lane.limit = entry.second.limit;
+    lane.running = entry.second.running;
+  }
+
+  return stats;
+}
+
+void GdPool::Run()
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  while (true)
+  {
+    GdWorker *job = nullptr;
+
+    _idle++;
+    _wake.wait(lock, [this, &job] {
+      return _threads > _concurrency || (job = Next()) != nullptr;
+    });
+    _idle--;
+
+    if (job == nullptr)
+    {
+      _threads--;
+      return;
+    }
+
+    lock.unlock();
+    job->OnExecute();
+    if (job->_aborted)
+    {
+      _aborted++;
+    }
+    else
+    {
+      _completed++;
+    }
+    lock.lock();
+
+    // the job is owned by the JavaScript thread once posted
+    Finish(job);
+    lock.unlock();
+    job->Resume();
+    lock.lock();
+  }
+}
@@ -0,0 +1,1060 @@
+/**
+ * Copyright (c) 2020, Vincent Bruijn <vebruijn@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <napi.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "node_gd.h"
+
+/**
+ * Random access to the bytes of an image, either a Buffer or an open file
+ *
+ * Files are read through a small window, so parsers can ask for a few
+ * bytes at a time without a system call for every one of them.
+ */
+class ProbeReader
+{
+public:
+  ProbeReader(const unsigned char *data, size_t length)
+      : _data(data), _file(nullptr), _length(length), _windowStart(0), _windowLength(0)
+  {
+  }
+
+  explicit ProbeReader(FILE *file)
+      : _data(nullptr), _file(file), _length(0), _windowStart(0), _windowLength(0)
+  {
+    if (fseek(_file, 0, SEEK_END) == 0)
+    {
+      long length = ftell(_file);
+      _length = length > 0 ? (uint64_t)length : 0;
+    }
+  }
+
+  uint64_t Length() const
+  {
+    return _length;
+  }
+
+  /**
+   * Copy COUNT bytes at OFFSET, false when they are not all there
+   */
+  bool Read(uint64_t offset, void *out, size_t count)
+  {
+    if (offset > _length || count > _length - offset)
+    {
+      return false;
+    }
+    if (_data != nullptr)
+    {
+      memcpy(out, _data + offset, count);
+      return true;
+    }
+    if (count > sizeof(_window))
+    {
+      return fseek(_file, (long)offset, SEEK_SET) == 0 && fread(out, 1, count, _file) == count;
+    }
+    if (offset < _windowStart || offset + count > _windowStart + _windowLength)
+    {
+      if (fseek(_file, (long)offset, SEEK_SET) != 0)
+      {
+        return false;
+      }
+      _windowStart = offset;
+      _windowLength = fread(_window, 1, sizeof(_window), _file);
+      if (_windowLength < count)
+      {
+        return false;
+      }
+    }
+    memcpy(out, _window + (offset - _windowStart), count);
+    return true;
+  }
+
+  bool U8(uint64_t offset, uint32_t &value)
+  {
+    unsigned char b[1];
+    if (!Read(offset, b, 1))
+    {
+      return false;
+    }
+    value = b[0];
+    return true;
+  }
+
+  bool BE16(uint64_t offset, uint32_t &value)
+  {
+    unsigned char b[2];
+    if (!Read(offset, b, 2))
+    {
+      return false;
+    }
+    value = (b[0] << 8) | b[1];
+    return true;
+  }
+
+  bool BE32(uint64_t offset, uint32_t &value)
+  {
+    unsigned char b[4];
+    if (!Read(offset, b, 4))
+    {
+      return false;
+    }
+    value = ((uint32_t)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+    return true;
+  }
+
+  bool LE16(uint64_t offset, uint32_t &value)
+  {
+    unsigned char b[2];
+    if (!Read(offset, b, 2))
+    {
+      return false;
+    }
+    value = b[0] | (b[1] << 8);
+    return true;
+  }
+
+  bool LE24(uint64_t offset, uint32_t &value)
+  {
+    unsigned char b[3];
+    if (!Read(offset, b, 3))
+    {
+      return false;
+    }
+    value = b[0] | (b[1] << 8) | (b[2] << 16);
+    return true;
+  }
+
+  bool LE32(uint64_t offset, uint32_t &value)
+  {
+    unsigned char b[4];
+    if (!Read(offset, b, 4))
+    {
+      return false;
+    }
+    value = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+    return true;
+  }
+
+  /**
+   * Compare the bytes at OFFSET with a string without its terminator
+   */
+  bool Matches(uint64_t offset, const char *tag)
+  {
+    size_t count = strlen(tag);
+    char b[16];
+    return count <= sizeof(b) && Read(offset, b, count) && memcmp(b, tag, count) == 0;
+  }
+
+private:
+  const unsigned char *_data;
+
+  FILE *_file;
+
+  uint64_t _length;
+
+  unsigned char _window[4096];
+
+  uint64_t _windowStart;
+
+  size_t _windowLength;
+};
+
+/**
+ * What the headers of an image tell without decoding its pixels
+ *
+ * trueColor is the kind of gd.Image the matching createFrom* function
+ * creates for the image.
+ */
+struct ProbeResult
+{
+  const char *format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t bitDepth;
+  bool alpha;
+  bool trueColor;
+  uint32_t frames;
+};
+
+// JPEG: the first start of frame segment
+static bool ProbeJpeg(ProbeReader &in, ProbeResult &result)
+{
+  uint64_t offset = 2;
+  uint32_t marker;
+  uint32_t length;
+
+  while (in.U8(offset, marker))
+  {
+    if (marker != 0xFF)
+    {
+      return false;
+    }
+    // markers may be padded with any number of 0xFF bytes
+    while (marker == 0xFF)
+    {
+      if (!in.U8(++offset, marker))
+      {
+        return false;
+      }
+    }
+    offset++;
+
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8))
+    {
+      continue;
+    }
+    if (marker == 0xD9 || marker == 0xDA || !in.BE16(offset, length) || length < 2)
+    {
+      return false;
+    }
+
+    bool startOfFrame = marker >= 0xC0 && marker <= 0xCF &&
+                        marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+    if (startOfFrame)
+    {
+      uint32_t precision, height, width;
+      if (!in.U8(offset + 2, precision) || !in.BE16(offset + 3, height) ||
+          !in.BE16(offset + 5, width))
+      {
+        return false;
+      }
+      result.format = "jpeg";
+      result.width = width;
+      result.height = height;
+      result.bitDepth = precision;
+      result.alpha = false;
+      result.trueColor = true;
+      result.frames = 1;
+      return true;
+    }
+
+    offset += length;
+  }
+
+  return false;
+}
+
+// PNG: IHDR, and the tRNS and acTL chunks in front of the first IDAT
+static bool ProbePng(ProbeReader &in, ProbeResult &result)
+{
+  uint32_t width, height, bitDepth, colorType;
+  if (!in.Matches(12, "IHDR") || !in.BE32(16, width) || !in.BE32(20, height) ||
+      !in.U8(24, bitDepth) || !in.U8(25, colorType))
+  {
+    return false;
+  }
+
+  result.format = "png";
+  result.width = width;
+  result.height = height;
+  result.bitDepth = bitDepth;
+  result.alpha = colorType == 4 || colorType == 6;
+  result.trueColor = colorType == 2 || colorType == 4 || colorType == 6;
+  result.frames = 1;
+
+  uint64_t offset = 8;
+  uint32_t length;
+  while (in.BE32(offset, length))
+  {
+    if (in.Matches(offset + 4, "IDAT") || in.Matches(offset + 4, "IEND"))
+    {
+      break;
+    }
+    if (in.Matches(offset + 4, "tRNS"))
+    {
+      result.alpha = true;
+    }
+    uint32_t frames;
+    if (in.Matches(offset + 4, "acTL") && in.BE32(offset + 8, frames) && frames > 0)
+    {
+      result.frames = frames;
+    }
+    // length, type, data and CRC
+    offset += 12 + (uint64_t)length;
+  }
+
+  return true;
+}
+
+// GIF: the logical screen descriptor, frames and transparency are counted
+static bool SkipGifSubBlocks(ProbeReader &in, uint64_t &offset)
+{
+  uint32_t size;
+  while (in.U8(offset, size))
+  {
+    offset += 1 + size;
+    if (size == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool ProbeGif(ProbeReader &in, ProbeResult &result)
+{
+  uint32_t width, height, flags;
+  if (!in.LE16(6, width) || !in.LE16(8, height) || !in.U8(10, flags))
+  {
+    return false;
+  }
+
+  result.format = "gif";
+  result.width = width;
+  result.height = height;
+  result.bitDepth = (flags & 0x07) + 1;
+  result.alpha = false;
+  result.trueColor = false;
+  result.frames = 0;
+
+  uint64_t offset = 13;
+  if (flags & 0x80)
+  {
+    offset += 3 * (2 << (flags & 0x07));
+  }
+
+  // a truncated file still has its frames so far
+  uint32_t block;
+  while (in.U8(offset, block) && block != 0x3B)
+  {
+    if (block == 0x2C)
+    {
+      uint32_t imageFlags;
+      if (!in.U8(offset + 9, imageFlags))
+      {
+        break;
+      }
+      result.frames++;
+      offset += 10;
+      if (imageFlags & 0x80)
+      {
+        offset += 3 * (2 << (imageFlags & 0x07));
+      }
+      // LZW minimum code size, then the image data
+      offset += 1;
+    }
+    else if (block == 0x21)
+    {
+      uint32_t label, control;
+      if (!in.U8(offset + 1, label))
+      {
+        break;
+      }
+      if (label == 0xF9 && in.U8(offset + 3, control) && (control & 0x01))
+      {
+        result.alpha = true;
+      }
+      offset += 2;
+    }
+    else
+    {
+      break;
+    }
+
+    if (!SkipGifSubBlocks(in, offset))
+    {
+      break;
+    }
+  }
+
+  if (result.frames == 0)
+  {
+    result.frames = 1;
+  }
+  return true;
+}
+
+// WebP: VP8, VP8L or the VP8X canvas with its animation frames
+static bool ProbeWebp(ProbeReader &in, ProbeResult &result)
+{
+  result.format = "webp";
+  result.bitDepth = 8;
+  result.alpha = false;
+  result.trueColor = true;
+  result.frames = 1;
+
+  if (in.Matches(12, "VP8 "))
+  {
+    uint32_t width, height;
+    if (!in.Matches(23, "\x9d\x01\x2a") || !in.LE16(26, width) || !in.LE16(28, height))
+    {
+      return false;
+    }
+    result.width = width & 0x3FFF;
+    result.height = height & 0x3FFF;
+    return true;
+  }
+
+  if (in.Matches(12, "VP8L"))
+  {
+    uint32_t signature, bits;
+    if (!in.U8(20, signature) || signature != 0x2F || !in.LE32(21, bits))
+    {
+      return false;
+    }
+    result.width = 1 + (bits & 0x3FFF);
+    result.height = 1 + ((bits >> 14) & 0x3FFF);
+    result.alpha = (bits >> 28) & 1;
+    return true;
+  }
+
+  if (in.Matches(12, "VP8X"))
+  {
+    uint32_t flags, width, height;
+    if (!in.U8(20, flags) || !in.LE24(24, width) || !in.LE24(27, height))
+    {
+      return false;
+    }
+    result.width = 1 + width;
+    result.height = 1 + height;
+    result.alpha = flags & 0x10;
+
+    if (flags & 0x02)
+    {
+      result.frames = 0;
+      uint64_t offset = 30;
+      uint32_t size;
+      while (in.LE32(offset + 4, size))
+      {
+        if (in.Matches(offset, "ANMF"))
+        {
+          result.frames++;
+        }
+        // chunks are padded to an even size
+        offset += 8 + (uint64_t)size + (size & 1);
+      }
+    }
+    return true;
+  }
+
+  return false;
+}
+
+// BMP: the BITMAPCOREHEADER of OS/2 or a BITMAPINFOHEADER and its successors
+static bool ProbeBmp(ProbeReader &in, ProbeResult &result)
+{
+  uint32_t headerSize, width, height, bitCount;
+  if (!in.LE32(14, headerSize))
+  {
+    return false;
+  }
+
+  result.format = "bmp";
+  result.alpha = false;
+  result.frames = 1;
+
+  if (headerSize == 12)
+  {
+    if (!in.LE16(18, width) || !in.LE16(20, height) || !in.LE16(24, bitCount))
+    {
+      return false;
+    }
+  }
+  else
+  {
+    if (!in.LE32(18, width) || !in.LE32(22, height) || !in.LE16(28, bitCount))
+    {
+      return false;
+    }
+    // negative sizes are top-down bitmaps
+    width = (uint32_t)std::abs((int32_t)width);
+    height = (uint32_t)std::abs((int32_t)height);
+
+    uint32_t alphaMask;
+    if (bitCount == 32 && headerSize >= 56 && in.LE32(66, alphaMask) && alphaMask != 0)
+    {
+      result.alpha = true;
+    }
+  }
+
+  result.width = width;
+  result.height = height;
+  result.bitDepth = bitCount;
+  result.trueColor = bitCount > 8;
+  return true;
+}
+
+// TIFF: IFD0, every IFD in the chain is a page
+static bool ProbeTiff(ProbeReader &in, ProbeResult &result)
+{
+  bool little = in.Matches(0, "II");
+  auto u16 = [&](uint64_t offset, uint32_t &value)
+  { return little ? in.LE16(offset, value) : in.BE16(offset, value); };
+  auto u32 = [&](uint64_t offset, uint32_t &value)
+  { return little ? in.LE32(offset, value) : in.BE32(offset, value); };
+
+  uint32_t ifd;
+  uint32_t count;
+  if (!u32(4, ifd) || !u16(ifd, count))
+  {
+    return false;
+  }
+
+  uint32_t width = 0, height = 0, bitsPerSample = 1, photometric = 2;
+  bool extraSamples = false;
+  for (uint32_t i = 0; i < count; i++)
+  {
+    uint64_t entry = (uint64_t)ifd + 2 + i * 12;
+    uint32_t tag, type, values, value;
+    if (!u16(entry, tag) || !u16(entry + 2, type) || !u32(entry + 4, values))
+    {
+      return false;
+    }
+    if (tag == 338)
+    {
+      extraSamples = true;
+      continue;
+    }
+    if (tag < 256 || tag > 262 || (type != 3 && type != 4))
+    {
+      continue;
+    }
+
+    // SHORT and LONG values up to 4 bytes are stored in the entry, the
+    // first one of longer arrays is read from their offset
+    bool inlined = values * (type == 3 ? 2 : 4) <= 4;
+    bool read;
+    if (inlined)
+    {
+      read = type == 3 ? u16(entry + 8, value) : u32(entry + 8, value);
+    }
+    else
+    {
+      read = u32(entry + 8, value) && (type == 3 ? u16(value, value) : u32(value, value));
+    }
+    if (!read)
+    {
+      return false;
+    }
+
+    switch (tag)
+    {
+    case 256:
+      width = value;
+      break;
+    case 257:
+      height = value;
+      break;
+    case 258:
+      bitsPerSample = value;
+      break;
+    case 262:
+      photometric = value;
+      break;
+    }
+  }
+
+  if (width == 0 || height == 0)
+  {
+    return false;
+  }
+
+  result.format = "tiff";
+  result.width = width;
+  result.height = height;
+  result.bitDepth = bitsPerSample;
+  result.alpha = extraSamples;
+  result.trueColor = photometric != 3;
+  result.frames = 1;
+
+  // follow the chain of IFDs, which may loop in broken files
+  uint32_t next;
+  while (result.frames < 65536 && u32((uint64_t)ifd + 2 + count * 12, next) && next != 0 &&
+         next != ifd && u16(next, count))
+  {
+    ifd = next;
+    result.frames++;
+  }
+
+  return true;
+}
+
+/**
+ * HEIF and AVIF are ISO base media files, a tree of boxes
+ */
+struct ProbeBox
+{
+  uint64_t start;
+  uint64_t end;
+  char type[5];
+};
+
+static bool NextBox(ProbeReader &in, uint64_t offset, uint64_t end, ProbeBox &box)
+{
+  uint32_t size;
+  if (offset + 8 > end || !in.BE32(offset, size) || !in.Read(offset + 4, box.type, 4))
+  {
+    return false;
+  }
+  box.type[4] = '\0';
+
+  uint64_t headerSize = 8;
+  uint64_t boxSize = size;
+  if (size == 1)
+  {
+    uint32_t high, low;
+    if (!in.BE32(offset + 8, high) || !in.BE32(offset + 12, low))
+    {
+      return false;
+    }
+    boxSize = ((uint64_t)high << 32) | low;
+    headerSize = 16;
+  }
+  else if (size == 0)
+  {
+    boxSize = end - offset;
+  }
+
+  if (boxSize < headerSize || boxSize > end - offset)
+  {
+    return false;
+  }
+  box.start = offset + headerSize;
+  box.end = offset + boxSize;
+  return true;
+}
+
+static bool FindBox(ProbeReader &in, uint64_t start, uint64_t end, const char *type, ProbeBox &box)
+{
+  uint64_t offset = start;
+  while (NextBox(in, offset, end, box))
+  {
+    if (strcmp(box.type, type) == 0)
+    {
+      return true;
+    }
+    offset = box.end;
+  }
+  return false;
+}
+
+static bool ProbeIsoMedia(ProbeReader &in, ProbeResult &result)
+{
+  ProbeBox ftyp;
+  if (!NextBox(in, 0, in.Length(), ftyp) || strcmp(ftyp.type, "ftyp") != 0)
+  {
+    return false;
+  }
+
+  // the major brand and the compatible brands following the minor version
+  bool avif = false, heif = false, sequence = false;
+  for (uint64_t offset = ftyp.start; offset + 4 <= ftyp.end; offset += offset == ftyp.start ? 8 : 4)
+  {
+    char brand[5] = {0};
+    if (!in.Read(offset, brand, 4))
+    {
+      return false;
+    }
+    if (strcmp(brand, "avif") == 0 || strcmp(brand, "avis") == 0)
+    {
+      avif = true;
+    }
+    if (strcmp(brand, "heic") == 0 || strcmp(brand, "heix") == 0 || strcmp(brand, "heim") == 0 ||
+        strcmp(brand, "heis") == 0 || strcmp(brand, "hevc") == 0 || strcmp(brand, "hevx") == 0 ||
+        strcmp(brand, "mif1") == 0 || strcmp(brand, "msf1") == 0)
+    {
+      heif = true;
+    }
+    if (strcmp(brand, "avis") == 0 || strcmp(brand, "msf1") == 0 || strcmp(brand, "hevc") == 0)
+    {
+      sequence = true;
+    }
+  }
+  if (!avif && !heif)
+  {
+    return false;
+  }
+
+  // meta, iprp and ipco hold the properties of all items
+  ProbeBox meta, iprp, ipco;
+  if (!FindBox(in, ftyp.end, in.Length(), "meta", meta) ||
+      !FindBox(in, meta.start + 4, meta.end, "iprp", iprp) ||
+      !FindBox(in, iprp.start, iprp.end, "ipco", ipco))
+  {
+    return false;
+  }
+
+  // the properties associated with the primary item, 1-based
+  std::vector<uint32_t> associated;
+  ProbeBox pitm, ipma;
+  uint32_t version, primary;
+  if (FindBox(in, meta.start + 4, meta.end, "pitm", pitm) && in.U8(pitm.start, version) &&
+      (version == 0 ? in.BE16(pitm.start + 4, primary) : in.BE32(pitm.start + 4, primary)) &&
+      FindBox(in, iprp.start, iprp.end, "ipma", ipma))
+  {
+    uint32_t flags, entries;
+    in.U8(ipma.start, version);
+    in.U8(ipma.start + 3, flags);
+    uint64_t offset = ipma.start + 4;
+    if (in.BE32(offset, entries))
+    {
+      offset += 4;
+      for (uint32_t i = 0; i < entries && offset < ipma.end; i++)
+      {
+        uint32_t item, count;
+        if (!(version < 1 ? in.BE16(offset, item) : in.BE32(offset, item)))
+        {
+          break;
+        }
+        offset += version < 1 ? 2 : 4;
+        if (!in.U8(offset++, count))
+        {
+          break;
+        }
+        for (uint32_t j = 0; j < count; j++)
+        {
+          uint32_t index;
+          if (flags & 1)
+          {
+            in.BE16(offset, index);
+            index &= 0x7FFF;
+            offset += 2;
+          }
+          else
+          {
+            in.U8(offset, index);
+            index &= 0x7F;
+            offset += 1;
+          }
+          if (item == primary)
+          {
+            associated.push_back(index);
+          }
+        }
+      }
+    }
+  }
+
+  result.format = avif ? "avif" : "heif";
+  result.width = 0;
+  result.height = 0;
+  result.bitDepth = 8;
+  result.alpha = false;
+  result.trueColor = true;
+  result.frames = 1;
+
+  ProbeBox property;
+  uint64_t offset = ipco.start;
+  for (uint32_t index = 1; NextBox(in, offset, ipco.end, property); index++, offset = property.end)
+  {
+    bool primaryProperty = associated.empty() ||
+                           std::find(associated.begin(), associated.end(), index) != associated.end();
+
+    if (strcmp(property.type, "ispe") == 0 && primaryProperty && result.width == 0)
+    {
+      uint32_t width, height;
+      if (in.BE32(property.start + 4, width) && in.BE32(property.start + 8, height))
+      {
+        result.width = width;
+        result.height = height;
+      }
+    }
+    else if (strcmp(property.type, "pixi") == 0 && primaryProperty)
+    {
+      uint32_t channels, bits;
+      if (in.U8(property.start + 4, channels) && channels > 0 && in.U8(property.start + 5, bits))
+      {
+        result.bitDepth = bits;
+      }
+    }
+    else if (strcmp(property.type, "auxC") == 0)
+    {
+      // an auxiliary image of the alpha type belongs to an item
+      char urn[64] = {0};
+      uint64_t length = std::min<uint64_t>(sizeof(urn) - 1, property.end - property.start);
+      if (length > 4 && in.Read(property.start + 4, urn, (size_t)length - 4) &&
+          (strstr(urn, ":alpha") != nullptr || strstr(urn, "auxid:1") != nullptr))
+      {
+        result.alpha = true;
+      }
+    }
+  }
+
+  if (result.width == 0 || result.height == 0)
+  {
+    return false;
+  }
+
+  // the sample count of the first track of an image sequence
+  ProbeBox moov, trak, mdia, minf, stbl, stsz;
+  uint32_t samples;
+  if (sequence && FindBox(in, ftyp.end, in.Length(), "moov", moov) &&
+      FindBox(in, moov.start, moov.end, "trak", trak) &&
+      FindBox(in, trak.start, trak.end, "mdia", mdia) &&
+      FindBox(in, mdia.start, mdia.end, "minf", minf) &&
+      FindBox(in, minf.start, minf.end, "stbl", stbl) &&
+      FindBox(in, stbl.start, stbl.end, "stsz", stsz) &&
+      in.BE32(stsz.start + 8, samples) && samples > 0)
+  {
+    result.frames = samples;
+  }
+
+  return true;
+}
+
+// WBMP has no signature, it is only parsed when the caller expects it
+static bool ProbeWbmp(ProbeReader &in, ProbeResult &result)
+{
+  uint32_t type, value;
+  if (!in.U8(0, type) || type != 0)
+  {
+    return false;
+  }
+
+  // the fixed header byte and its extensions have the high bit set
+  uint64_t offset = 1;
+  do
+  {
+    if (!in.U8(offset++, value))
+    {
+      return false;
+    }
+  } while (value & 0x80);
+
+  // width and height are multi-byte integers of 7 bits per byte
+  uint32_t size[2];
+  for (int i = 0; i < 2; i++)
+  {
+    size[i] = 0;
+    do
+    {
+      if (!in.U8(offset++, value) || size[i] > (UINT32_MAX >> 7))
+      {
+        return false;
+      }
+      size[i] = (size[i] << 7) | (value & 0x7F);
+    } while (value & 0x80);
+  }
+
+  result.format = "wbmp";
+  result.width = size[0];
+  result.height = size[1];
+  result.bitDepth = 1;
+  result.alpha = false;
+  result.trueColor = false;
+  result.frames = 1;
+  return true;
+}
+
+/**
+ * Sniff the format from the magic bytes and parse its headers
+ */
+static bool ProbeImage(ProbeReader &in, ProbeResult &result)
+{
+  if (in.Matches(0, "\xff\xd8\xff"))
+  {
+    return ProbeJpeg(in, result);
+  }
+  if (in.Matches(0, "\x89PNG\r\n\x1a\n"))
+  {
+    return ProbePng(in, result);
+  }
+  if (in.Matches(0, "GIF87a") || in.Matches(0, "GIF89a"))
+  {
+    return ProbeGif(in, result);
+  }
+  if (in.Matches(0, "RIFF") && in.Matches(8, "WEBP"))
+  {
+    return ProbeWebp(in, result);
+  }
+  if (in.Matches(0, "BM"))
+  {
+    return ProbeBmp(in, result);
+  }
+  if (in.Matches(0, "II*") || in.Matches(0, "MM"))
+  {
+    uint32_t magic;
+    return in.BE16(2, magic) && (magic == 0x2A00 || magic == 0x002A) && ProbeTiff(in, result);
+  }
+  if (in.Matches(4, "ftyp"))
+  {
+    return ProbeIsoMedia(in, result);
+  }
+  return false;
+}
+
+/**
+ * Probe a file, ERROR is set when it fails
+ */
+static bool ProbeFile(const std::string &path, ProbeResult &result, std::string &error)
+{
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == nullptr)
+  {
+    error = "Cannot open image file";
+    return false;
+  }
+  ProbeReader in(file);
+  bool success = ProbeImage(in, result);
+  fclose(file);
+
+  if (!success)
+  {
+    error = "Cannot read image header";
+  }
+  return success;
+}
+
+static Napi::Object ProbeResultObject(Napi::Env env, const ProbeResult &result)
+{
+  Napi::Object object = Napi::Object::New(env);
+  object.Set("format", Napi::String::New(env, result.format));
+  object.Set("width", Napi::Number::New(env, result.width));
+  object.Set("height", Napi::Number::New(env, result.height));
+  object.Set("bitDepth", Napi::Number::New(env, result.bitDepth));
+  object.Set("hasAlpha", Napi::Boolean::New(env, result.alpha));
+  object.Set("trueColor", Napi::Boolean::New(env, result.trueColor));
+  object.Set("frames", Napi::Number::New(env, result.frames));
+  return object;
+}
+
+/**
+ * Limits on the size of images to decode, 0 for no limit
+ *
+ * The header of an image is checked against the limits before libgd
+ * allocates its pixels, so a small file claiming a huge size is rejected
+ * right away. The process-wide default applies to every decode unless the
+ * options of a call override it.
+ */
+struct DecodeLimits
+{
+  double maxPixels;
+  double maxWidth;
+  double maxHeight;
+
+  bool Any() const
+  {
+    return maxPixels > 0 || maxWidth > 0 || maxHeight > 0;
+  }
+
+  static DecodeLimits Default()
+  {
+    std::lock_guard<std::mutex> lock(Mutex());
+    return Defaults();
+  }
+
+  static void SetDefault(const DecodeLimits &limits)
+  {
+    std::lock_guard<std::mutex> lock(Mutex());
+    Defaults() = limits;
+  }
+
+private:
+  static std::mutex &Mutex()
+  {
+    static std::mutex *mutex = new std::mutex();
+    return *mutex;
+  }
+
+  static DecodeLimits &Defaults()
+  {
+    static DecodeLimits limits{0, 0, 0};
+    return limits;
+  }
+};
+
+/**
+ * Read maxPixels, maxWidth and maxHeight of an options object over LIMITS.
+ * Throws and returns false for invalid values.
+ */
+static bool ReadDecodeLimitsObject(Napi::Env env, Napi::Object options, DecodeLimits &limits)
+{
+  const char *names[] = {"maxPixels", "maxWidth", "maxHeight"};
+  double *values[] = {&limits.maxPixels, &limits.maxWidth, &limits.maxHeight};
+
+  for (int i = 0; i < 3; i++)
+  {
+    Napi::Value value = options.Get(names[i]);
+    if (value.IsUndefined())
+    {
+      continue;
+    }
+    double number = value.IsNumber() ? value.As<Napi::Number>().DoubleValue() : -1;
+    if (!(number >= 0))
+    {
+      Napi::RangeError::New(env, std::string("Value for ") + names[i] + " must be a Number of 0 or greater")
+          .ThrowAsJavaScriptException();
+      return false;
+    }
+    *values[i] = number;
+  }
+  return true;
+}
+
+/**
+ * The decode limits of a call, the defaults with the ones of the trailing
+ * options object applied. Arguments before index first are never taken for
+ * the options object.
+ */
+static bool ReadDecodeLimits(const Napi::CallbackInfo &info, DecodeLimits &limits, size_t first = 0)
+{
+  limits = DecodeLimits::Default();
+  if (info.Length() <= first || !IsJobOptions(info, info.Length() - 1))
+  {
+    return true;
+  }
+  return ReadDecodeLimitsObject(info.Env(), info[info.Length() - 1].As<Napi::Object>(), limits);
+}
+
+/**
+ * Check a header against decode limits. Returns the error to reject the
+ * decode with, or an empty string when it may go ahead. An image of which
+ * the header could not be read is only rejected when limits are set, as
+ * libgd may still know the format.
+ */
+static std::string CheckDecodeLimits(const DecodeLimits &limits, bool probed, const ProbeResult &header)
+{
+  if (!probed)
+  {
+    return limits.Any() ? "Cannot read image header to check the decode limits" : "";
+  }
+
+  double pixels = (double)header.width * header.height;
+  std::string size = std::to_string(header.width) + "x" + std::to_string(header.height);
+  if (limits.maxWidth > 0 && header.width > limits.maxWidth)
+  {
+    return "Image of " + size + " pixels exceeds maxWidth";
+  }
+  if (limits.maxHeight > 0 && header.height > limits.maxHeight)
+  {
+    return "Image of " + size + " pixels exceeds maxHeight";
+  }
+  if (limits.maxPixels > 0 && pixels > limits.maxPixels)
+  {
+    return "Image of " + size + " pixels exceeds maxPixels";
+  }
+  // libgd refuses to allocate images of more than INT_MAX pixels anyway
+  if (header.width == 0 || header.height == 0 || pixels > INT_MAX)
+  {
+    return "Image of " + size + " pixels cannot be decoded";
+  }
+  return "";
+}
+
+/**
+ * Bytes of the pixels of the gd.Image a header describes, to be used after
+ * CheckDecodeLimits() passed
+ */
+static size_t HeaderBytes(const ProbeResult &header)
+{
+  return ImageBytes((int)header.width, (int)header.height, header.trueColor);
+}
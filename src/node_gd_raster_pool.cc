@@ -0,0 +1,278 @@
+/**
+ * Copyright (c) 2020, Vincent Bruijn <vebruijn@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <napi.h>
+#include <gd.h>
+#include <cstring>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "node_gd.h"
+
+/**
+ * Pool of pixel storage of destroyed images
+ *
+ * Creating an image allocates a row pointer array and a row for every line
+ * of the image, destroying it frees them again. When the pool is enabled by
+ * a byte limit, destroyed images leave their rows behind and images of the
+ * same size and type created later take them over, zeroed, instead of
+ * allocating. The least recently returned rows are freed first when the
+ * limit is exceeded. The pool is shared by all threads of the process.
+ *
+ * Free rows are found by their size and type in a hash map, the list keeps
+ * them in the order they were returned for eviction.
+ */
+class RasterPool
+{
+public:
+  struct Stats
+  {
+    size_t limit;
+    size_t bytes;
+    size_t rasters;
+    uint64_t hits;
+    uint64_t misses;
+  };
+
+  static RasterPool &Instance()
+  {
+    static RasterPool *pool = new RasterPool();
+    return *pool;
+  }
+
+  /**
+   * Create an image like gdImageCreate() or gdImageCreateTrueColor(), with
+   * recycled rows when the pool has them
+   */
+  gdImagePtr Create(int width, int height, bool trueColor)
+  {
+    void **rows = Take(width, height, trueColor);
+    if (rows == nullptr)
+    {
+      return trueColor ? gdImageCreateTrueColor(width, height) : gdImageCreate(width, height);
+    }
+
+    // libgd initializes all other members, its single row is replaced
+    gdImagePtr image = trueColor ? gdImageCreateTrueColor(1, 1) : gdImageCreate(1, 1);
+    if (image == nullptr)
+    {
+      FreeRows(rows, height);
+      return nullptr;
+    }
+
+    size_t rowSize = (size_t)width * (trueColor ? sizeof(int) : sizeof(unsigned char));
+    for (int y = 0; y < height; y++)
+    {
+      memset(rows[y], 0, rowSize);
+    }
+
+    if (trueColor)
+    {
+      gdFree(image->tpixels[0]);
+      gdFree(image->tpixels);
+      image->tpixels = (int **)rows;
+    }
+    else
+    {
+      gdFree(image->pixels[0]);
+      gdFree(image->pixels);
+      image->pixels = (unsigned char **)rows;
+    }
+    image->sx = width;
+    image->sy = height;
+    image->cx2 = width - 1;
+    image->cy2 = height - 1;
+
+    return image;
+  }
+
+  /**
+   * Destroy image like gdImageDestroy(), keeping its rows when the pool is
+   * enabled and they fit within the limit
+   */
+  void Destroy(gdImagePtr image)
+  {
+    bool trueColor = gdImageTrueColor(image);
+    void **rows = trueColor ? (void **)image->tpixels : (void **)image->pixels;
+    size_t bytes = ImageBytes(gdImageSX(image), gdImageSY(image), trueColor);
+
+    if (rows != nullptr && Put(gdImageSX(image), gdImageSY(image), trueColor, rows, bytes))
+    {
+      // gdImageDestroy() skips the rows
+      if (trueColor)
+      {
+        image->tpixels = nullptr;
+      }
+      else
+      {
+        image->pixels = nullptr;
+      }
+    }
+
+    gdImageDestroy(image);
+  }
+
+  /**
+   * Change the maximum amount of bytes kept, 0 disables the pool and frees
+   * all rows it holds
+   */
+  void SetLimit(size_t limit)
+  {
+    std::list<Raster> evicted;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      _limit = limit;
+      Evict(evicted);
+    }
+    Free(evicted);
+  }
+
+  Stats GetStats()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return Stats{_limit, _bytes, _lru.size(), _hits, _misses};
+  }
+
+private:
+  struct Raster
+  {
+    int width;
+    int height;
+    bool trueColor;
+    void **rows;
+    size_t bytes;
+  };
+
+  typedef std::list<Raster>::iterator Entry;
+
+  RasterPool()
+  {
+  }
+
+  static uint64_t Key(int width, int height, bool trueColor)
+  {
+    return ((uint64_t)(uint32_t)width << 32) | ((uint64_t)(uint32_t)height << 1) | (trueColor ? 1 : 0);
+  }
+
+  static void FreeRows(void **rows, int height)
+  {
+    for (int y = 0; y < height; y++)
+    {
+      gdFree(rows[y]);
+    }
+    gdFree(rows);
+  }
+
+  void **Take(int width, int height, bool trueColor)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_limit == 0)
+    {
+      return nullptr;
+    }
+
+    auto slot = _free.find(Key(width, height, trueColor));
+    if (slot == _free.end())
+    {
+      _misses++;
+      return nullptr;
+    }
+
+    // the most recently returned rows of this size
+    Entry entry = slot->second.back();
+    slot->second.pop_back();
+    if (slot->second.empty())
+    {
+      _free.erase(slot);
+    }
+
+    void **rows = entry->rows;
+    _bytes -= entry->bytes;
+    _lru.erase(entry);
+    _hits++;
+    return rows;
+  }
+
+  bool Put(int width, int height, bool trueColor, void **rows, size_t bytes)
+  {
+    std::list<Raster> evicted;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      if (bytes > _limit)
+      {
+        return false;
+      }
+
+      // most recently returned rows first
+      _lru.push_front(Raster{width, height, trueColor, rows, bytes});
+      _free[Key(width, height, trueColor)].push_back(_lru.begin());
+      _bytes += bytes;
+      Evict(evicted);
+    }
+    Free(evicted);
+    return true;
+  }
+
+  /**
+   * Move the least recently returned rows out until the pool fits its
+   * limit, with _mutex locked. They are freed after unlocking.
+   */
+  void Evict(std::list<Raster> &evicted)
+  {
+    while (_bytes > _limit)
+    {
+      Entry entry = std::prev(_lru.end());
+
+      // the oldest rows of a size are the first of its entries
+      auto slot = _free.find(Key(entry->width, entry->height, entry->trueColor));
+      slot->second.erase(slot->second.begin());
+      if (slot->second.empty())
+      {
+        _free.erase(slot);
+      }
+
+      _bytes -= entry->bytes;
+      evicted.splice(evicted.begin(), _lru, entry);
+    }
+  }
+
+  static void Free(std::list<Raster> &rasters)
+  {
+    for (Raster &raster : rasters)
+    {
+      FreeRows(raster.rows, raster.height);
+    }
+  }
+
+  std::mutex _mutex;
+
+  std::list<Raster> _lru;
+
+  std::unordered_map<uint64_t, std::vector<Entry> > _free;
+
+  size_t _limit{0};
+
+  size_t _bytes{0};
+
+  uint64_t _hits{0};
+
+  uint64_t _misses{0};
+};
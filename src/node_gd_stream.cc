@@ -0,0 +1,549 @@
+/**
+ * Copyright (c) 2020, Vincent Bruijn <vebruijn@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <napi.h>
+#include <gd.h>
+#include <gd_io.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "node_gd.h"
+
+/**
+ * Bounded ring buffer between the chunks of a Readable stream and a decoder
+ *
+ * The JavaScript thread writes chunks as they arrive, as far as they fit.
+ * The decoder reads on a thread of the pool and blocks while the buffer is
+ * empty. When reading frees space the writer was waiting for, the space
+ * callback tells JavaScript to resume the stream.
+ */
+class StreamSource
+{
+public:
+  StreamSource(size_t capacity, Napi::ThreadSafeFunction onSpace)
+      : _ring(std::max<size_t>(capacity, 1)), _onSpace(onSpace)
+  {
+  }
+
+  /**
+   * Copy as much of data as fits, returns the amount of bytes taken. Once
+   * the decoder is done everything is taken and dropped.
+   */
+  size_t Write(const unsigned char *data, size_t length)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_closed)
+    {
+      return length;
+    }
+
+    size_t count = std::min(length, _ring.size() - _size);
+    size_t tail = (_head + _size) % _ring.size();
+    size_t first = std::min(count, _ring.size() - tail);
+    memcpy(_ring.data() + tail, data, first);
+    memcpy(_ring.data(), data + first, count - first);
+    _size += count;
+    _waiting = count < length;
+
+    if (count > 0)
+    {
+      _readable.notify_one();
+    }
+    return count;
+  }
+
+  /**
+   * The stream ended, the decoder reads what is left
+   */
+  void End()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _ended = true;
+    _readable.notify_one();
+  }
+
+  /**
+   * The stream failed, the decoder gets no more data and fails with error
+   */
+  void Abort(const std::string &error)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _error = error;
+    _ended = true;
+    _readable.notify_one();
+  }
+
+  /**
+   * Read up to count bytes, blocking until there is data, the stream
+   * ended or cancelled returns true. Returns 0 at the end.
+   */
+  size_t Read(unsigned char *out, size_t count, const std::function<bool()> &cancelled)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_size == 0 && !_ended)
+    {
+      if (cancelled())
+      {
+        return 0;
+      }
+      // wake up now and then to notice an abort signal or deadline
+      _readable.wait_for(lock, std::chrono::milliseconds(100));
+    }
+    if (!_error.empty())
+    {
+      return 0;
+    }
+
+    count = std::min(count, _size);
+    size_t first = std::min(count, _ring.size() - _head);
+    memcpy(out, _ring.data() + _head, first);
+    memcpy(out + first, _ring.data(), count - first);
+    _head = (_head + count) % _ring.size();
+    _size -= count;
+
+    if (_waiting && count > 0 && !_closed)
+    {
+      _waiting = false;
+      _onSpace.NonBlockingCall();
+    }
+    return count;
+  }
+
+  bool Ended()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _ended && _size == 0;
+  }
+
+  std::string Error()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _error;
+  }
+
+  /**
+   * The decoder is done: further writes are dropped, a waiting writer is
+   * told to go on and the space callback is released
+   */
+  void Close()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_closed)
+    {
+      return;
+    }
+    _closed = true;
+    _size = 0;
+    if (_waiting)
+    {
+      _onSpace.NonBlockingCall();
+    }
+    _onSpace.Release();
+  }
+
+private:
+  std::mutex _mutex;
+
+  std::condition_variable _readable;
+
+  std::vector<unsigned char> _ring;
+
+  size_t _head{0};
+
+  size_t _size{0};
+
+  bool _ended{false};
+
+  bool _waiting{false};
+
+  bool _closed{false};
+
+  std::string _error;
+
+  Napi::ThreadSafeFunction _onSpace;
+};
+
+/**
+ * gdIOCtx reading from a StreamSource
+ *
+ * The first bytes are read ahead into a prefix, so the header can be
+ * checked before decoding starts. The decoder reads the prefix first and
+ * the ring buffer after it. Seeking is only possible forwards, by skipping,
+ * which is all the decoders for sequential formats need.
+ */
+struct StreamReadCtx
+{
+  // first member, libgd passes a pointer to it to the callbacks
+  gdIOCtx ctx;
+
+  StreamSource *source;
+
+  std::function<bool()> cancelled;
+
+  std::vector<unsigned char> prefix;
+
+  size_t prefixOffset;
+
+  long position;
+};
+
+static int StreamReadBuf(gdIOCtx *ctx, void *buf, int size)
+{
+  StreamReadCtx *stream = (StreamReadCtx *)ctx;
+  unsigned char *out = (unsigned char *)buf;
+  size_t count = 0;
+
+  if (stream->prefixOffset < stream->prefix.size())
+  {
+    count = std::min((size_t)size, stream->prefix.size() - stream->prefixOffset);
+    memcpy(out, stream->prefix.data() + stream->prefixOffset, count);
+    stream->prefixOffset += count;
+  }
+  // decoders expect a short read to mean the end of the data
+  while (count < (size_t)size)
+  {
+    size_t read = stream->source->Read(out + count, (size_t)size - count, stream->cancelled);
+    if (read == 0)
+    {
+      break;
+    }
+    count += read;
+  }
+
+  stream->position += (long)count;
+  return (int)count;
+}
+
+static int StreamGetC(gdIOCtx *ctx)
+{
+  unsigned char c;
+  return StreamReadBuf(ctx, &c, 1) == 1 ? c : EOF;
+}
+
+static int StreamSeek(gdIOCtx *ctx, const int position)
+{
+  StreamReadCtx *stream = (StreamReadCtx *)ctx;
+  unsigned char skipped[4096];
+
+  while (stream->position < position)
+  {
+    int count = (int)std::min<long>(sizeof(skipped), position - stream->position);
+    if (StreamReadBuf(ctx, skipped, count) != count)
+    {
+      return 0;
+    }
+  }
+  return stream->position == position;
+}
+
+static long StreamTell(gdIOCtx *ctx)
+{
+  return ((StreamReadCtx *)ctx)->position;
+}
+
+static void StreamFreeCtx(gdIOCtx *ctx)
+{
+  // owned by the worker
+}
+
+/**
+ * Set up a gdIOCtx reading from source
+ */
+static void InitStreamReadCtx(StreamReadCtx &stream, StreamSource *source,
+                              std::function<bool()> cancelled)
+{
+  memset(&stream.ctx, 0, sizeof(stream.ctx));
+  stream.ctx.getC = StreamGetC;
+  stream.ctx.getBuf = StreamReadBuf;
+  stream.ctx.seek = StreamSeek;
+  stream.ctx.tell = StreamTell;
+  stream.ctx.gd_free = StreamFreeCtx;
+  stream.source = source;
+  stream.cancelled = cancelled;
+  stream.prefixOffset = 0;
+  stream.position = 0;
+}
+
+/**
+ * Read ahead into the prefix until it holds SIZE bytes or the stream ended
+ */
+static void StreamReadAhead(StreamReadCtx &stream, size_t size)
+{
+  size_t length = stream.prefix.size();
+  if (length >= size)
+  {
+    return;
+  }
+  stream.prefix.resize(size);
+  while (length < size)
+  {
+    size_t read = stream.source->Read(stream.prefix.data() + length, size - length, stream.cancelled);
+    if (read == 0)
+    {
+      break;
+    }
+    length += read;
+  }
+  stream.prefix.resize(length);
+}
+
+/**
+ * Chunks of encoded data on their way from an encoder to a Writable stream
+ *
+ * The encoder writes into a chunk of a fixed size on a thread of the pool.
+ * Full chunks are handed to JavaScript through a thread-safe function, one
+ * credit each. JavaScript returns the credit once the stream took the chunk
+ * without asking to wait, or on its 'drain' event. Without credits the
+ * encoder blocks, so memory stays at a few chunks however large the output.
+ */
+class StreamSink
+{
+public:
+  StreamSink(size_t chunkSize, int credits, Napi::ThreadSafeFunction onChunk)
+      : _chunkSize(std::max<size_t>(chunkSize, 1)), _credits(credits), _onChunk(onChunk)
+  {
+  }
+
+  /**
+   * Called on the pool by the encoder
+   */
+  void Put(const unsigned char *data, size_t length, const std::function<bool()> &cancelled)
+  {
+    if (_dropping)
+    {
+      // nobody is listening anymore, let the encoder finish quickly
+      _bytes += length;
+      return;
+    }
+    while (length > 0)
+    {
+      if (_chunk == nullptr)
+      {
+        _chunk = new std::vector<unsigned char>();
+        _chunk->reserve(_chunkSize);
+      }
+      size_t count = std::min(length, _chunkSize - _chunk->size());
+      _chunk->insert(_chunk->end(), data, data + count);
+      _bytes += count;
+      data += count;
+      length -= count;
+
+      if (_chunk->size() == _chunkSize)
+      {
+        Emit(cancelled);
+      }
+    }
+  }
+
+  /**
+   * Hand the last partial chunk and the end of the data to JavaScript, as
+   * a null chunk
+   */
+  void Finish(const std::function<bool()> &cancelled)
+  {
+    if (_chunk != nullptr && !_chunk->empty() && !_dropping)
+    {
+      Emit(cancelled);
+    }
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (_closed)
+      {
+        return;
+      }
+    }
+    _onChunk.BlockingCall((std::vector<unsigned char> *)nullptr, CallChunk);
+  }
+
+  uint64_t Bytes() const
+  {
+    return _bytes;
+  }
+
+  /**
+   * Called on the JavaScript thread when the stream is ready for more
+   */
+  void Credit()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _credits++;
+    _writable.notify_one();
+  }
+
+  /**
+   * The stream failed, the rest of the output is dropped
+   */
+  void Abort()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _aborted = true;
+    _writable.notify_one();
+  }
+
+  /**
+   * Release the thread-safe function, after which nothing is handed over.
+   * Only called once the encoder is done, so the encoder calls the
+   * thread-safe function without holding _mutex.
+   */
+  void Close()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_closed)
+    {
+      return;
+    }
+    _closed = true;
+    _onChunk.Release();
+  }
+
+  ~StreamSink()
+  {
+    delete _chunk;
+  }
+
+private:
+  void Emit(const std::function<bool()> &cancelled)
+  {
+    std::vector<unsigned char> *chunk = _chunk;
+    _chunk = nullptr;
+
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      while (_credits == 0 && !_aborted && !_closed)
+      {
+        if (cancelled())
+        {
+          break;
+        }
+        // wake up now and then to notice an abort signal or deadline
+        _writable.wait_for(lock, std::chrono::milliseconds(100));
+      }
+      if (_credits == 0 || _aborted || _closed)
+      {
+        delete chunk;
+        _dropping = true;
+        return;
+      }
+      _credits--;
+    }
+
+    if (_onChunk.BlockingCall(chunk, CallChunk) != napi_ok)
+    {
+      delete chunk;
+      _dropping = true;
+    }
+  }
+
+  static void CallChunk(Napi::Env env, Napi::Function onChunk, std::vector<unsigned char> *chunk)
+  {
+    if (env == nullptr)
+    {
+      delete chunk;
+      return;
+    }
+    if (chunk == nullptr)
+    {
+      onChunk.Call({env.Null()});
+      return;
+    }
+
+    // the Buffer takes ownership of the chunk
+    Napi::Buffer<unsigned char> buffer = Napi::Buffer<unsigned char>::NewOrCopy(
+        env, chunk->data(), chunk->size(),
+        [](Napi::Env, unsigned char *, std::vector<unsigned char> *hint)
+        { delete hint; },
+        chunk);
+    onChunk.Call({buffer});
+  }
+
+  std::mutex _mutex;
+
+  std::condition_variable _writable;
+
+  size_t _chunkSize;
+
+  int _credits;
+
+  bool _aborted{false};
+
+  bool _closed{false};
+
+  // touched by the encoder only
+  bool _dropping{false};
+
+  std::vector<unsigned char> *_chunk{nullptr};
+
+  uint64_t _bytes{0};
+
+  Napi::ThreadSafeFunction _onChunk;
+};
+
+/**
+ * gdIOCtx writing to a StreamSink. Seeking is only possible to where the
+ * encoder already is.
+ */
+struct StreamWriteCtx
+{
+  // first member, libgd passes a pointer to it to the callbacks
+  gdIOCtx ctx;
+
+  StreamSink *sink;
+
+  std::function<bool()> cancelled;
+};
+
+static int StreamPutBuf(gdIOCtx *ctx, const void *buf, int size)
+{
+  StreamWriteCtx *stream = (StreamWriteCtx *)ctx;
+  stream->sink->Put((const unsigned char *)buf, (size_t)size, stream->cancelled);
+  return size;
+}
+
+static void StreamPutC(gdIOCtx *ctx, int c)
+{
+  unsigned char byte = (unsigned char)c;
+  StreamPutBuf(ctx, &byte, 1);
+}
+
+static int StreamWriteSeek(gdIOCtx *ctx, const int position)
+{
+  return (uint64_t)position == ((StreamWriteCtx *)ctx)->sink->Bytes();
+}
+
+static long StreamWriteTell(gdIOCtx *ctx)
+{
+  return (long)((StreamWriteCtx *)ctx)->sink->Bytes();
+}
+
+/**
+ * Set up a gdIOCtx writing to sink
+ */
+static void InitStreamWriteCtx(StreamWriteCtx &stream, StreamSink *sink,
+                               std::function<bool()> cancelled)
+{
+  memset(&stream.ctx, 0, sizeof(stream.ctx));
+  stream.ctx.putC = StreamPutC;
+  stream.ctx.putBuf = StreamPutBuf;
+  stream.ctx.seek = StreamWriteSeek;
+  stream.ctx.tell = StreamWriteTell;
+  stream.ctx.gd_free = StreamFreeCtx;
+  stream.sink = sink;
+  stream.cancelled = cancelled;
+}
@@ -15,6 +15,13 @@
  */
 #include <gd.h>
 #include <napi.h>
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <vector>
 #include "node_gd.h"
 
 /**
@@ -22,18 +29,666 @@
  */
 using namespace Napi;
 
+/**
+ * Pixel data helpers
+ *
+ * Shared by the synchronous Gd::Image methods and their async workers for
+ * bulk pixel access. Pixel data in JavaScript is RGBA with 8 bits per
+ * channel, the layout of ImageData and Uint8ClampedArray.
+ */
+static inline uint8_t AlphaToByte(int alpha)
+{
+  // gd alpha is 0 (opaque) to 127 (transparent)
+  int opacity = gdAlphaMax - alpha;
+  return (uint8_t)((opacity << 1) | (opacity >> 6));
+}
+
+/**
+ * Returns the data pointer of any typed array, including views on a
+ * SharedArrayBuffer for which ArrayBuffer::Data() cannot be used.
+ */
+static uint8_t *TypedArrayBytes(const Napi::TypedArray &array)
+{
+  void *data = nullptr;
+  napi_status status = napi_get_typedarray_info(array.Env(), array, nullptr, nullptr,
+                                                &data, nullptr, nullptr);
+  NAPI_THROW_IF_FAILED(array.Env(), status, nullptr);
+  return static_cast<uint8_t *>(data);
+}
+
+/**
+ * Throws a RangeError and returns false when the rectangle does not lie
+ * within the bounds of image.
+ */
+static bool CheckPixelRegion(Napi::Env env, gdImagePtr image, int x, int y, int width, int height)
+{
+  if (x < 0 || y < 0 || width < 1 || height < 1 ||
+      width > gdImageSX(image) - x || height > gdImageSY(image) - y)
+  {
+    Napi::RangeError::New(env, "Rectangle must have a positive size and lie within the image")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Returns the typed array in argument I when it is an 8 bit or 32 bit
+ * unsigned typed array of at least byteLength bytes. When the argument is
+ * omitted and allocate is true, a new Uint8ClampedArray is returned. Throws
+ * and returns an empty TypedArray otherwise.
+ */
+static Napi::TypedArray PixelArrayArg(const Napi::CallbackInfo &info, size_t I, size_t byteLength, bool allocate)
+{
+  if (info.Length() <= I || info[I].IsUndefined())
+  {
+    if (allocate)
+    {
+      return Napi::Uint8Array::New(info.Env(), byteLength, napi_uint8_clamped_array);
+    }
+  }
+  else if (info[I].IsTypedArray())
+  {
+    Napi::TypedArray array = info[I].As<Napi::TypedArray>();
+    napi_typedarray_type type = array.TypedArrayType();
+
+    if (type != napi_uint8_clamped_array && type != napi_uint8_array && type != napi_uint32_array)
+    {
+      Napi::TypeError::New(info.Env(), "Pixel data must be a Uint8ClampedArray, Uint8Array or Uint32Array")
+          .ThrowAsJavaScriptException();
+      return Napi::TypedArray();
+    }
+    if (array.ByteLength() < byteLength)
+    {
+      Napi::RangeError::New(info.Env(), "Pixel data is too small for the given width and height")
+          .ThrowAsJavaScriptException();
+      return Napi::TypedArray();
+    }
+    return array;
+  }
+
+  Napi::TypeError::New(info.Env(), "Argument " + std::to_string(I) + " must be a typed array")
+      .ThrowAsJavaScriptException();
+  return Napi::TypedArray();
+}
+
+static inline int ByteToAlpha(int opacity)
+{
+  return gdAlphaMax - (opacity >> 1);
+}
+
+// How to interpret the alpha channel of incoming RGBA data
+enum PixelAlphaMode
+{
+  PIXEL_ALPHA_STRAIGHT,
+  PIXEL_ALPHA_PREMULTIPLIED,
+  PIXEL_ALPHA_IGNORE
+};
+
+/**
+ * Read the optional { stride, alphaMode } object in argument I. stride is the
+ * amount of bytes per row and defaults to width * 4. Throws and returns false
+ * when an option is invalid.
+ */
+static bool PixelOptionsArg(const Napi::CallbackInfo &info, size_t I, int width, size_t &stride, int &alphaMode)
+{
+  stride = (size_t)width * 4;
+  alphaMode = PIXEL_ALPHA_STRAIGHT;
+
+  if (info.Length() <= I || info[I].IsUndefined())
+  {
+    return true;
+  }
+  if (!info[I].IsObject())
+  {
+    Napi::TypeError::New(info.Env(), "Argument " + std::to_string(I) + " must be an object")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+
+  Napi::Object options = info[I].As<Napi::Object>();
+  Napi::Value strideValue = options.Get("stride");
+  Napi::Value alphaModeValue = options.Get("alphaMode");
+
+  if (!strideValue.IsUndefined())
+  {
+    double value = strideValue.IsNumber() ? strideValue.As<Napi::Number>().DoubleValue() : -1;
+    if (value < (double)width * 4 || value != (double)(size_t)value)
+    {
+      Napi::RangeError::New(info.Env(), "Value for stride must be an integer of at least width * 4")
+          .ThrowAsJavaScriptException();
+      return false;
+    }
+    stride = (size_t)value;
+  }
+
+  if (!alphaModeValue.IsUndefined())
+  {
+    std::string mode = alphaModeValue.ToString().Utf8Value();
+    if (mode == "straight")
+    {
+      alphaMode = PIXEL_ALPHA_STRAIGHT;
+    }
+    else if (mode == "premultiplied")
+    {
+      alphaMode = PIXEL_ALPHA_PREMULTIPLIED;
+    }
+    else if (mode == "ignore")
+    {
+      alphaMode = PIXEL_ALPHA_IGNORE;
+    }
+    else
+    {
+      Napi::RangeError::New(info.Env(), "Value for alphaMode must be one of 'straight' (default), 'premultiplied' or 'ignore'")
+          .ThrowAsJavaScriptException();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Amount of bytes RGBA data of the given size and stride occupies
+ */
+static inline size_t PixelDataLength(int width, int height, size_t stride)
+{
+  return stride * (height - 1) + (size_t)width * 4;
+}
+
+/**
+ * Write RGBA bytes from data, stride bytes per row, into a rectangle of
+ * image. Pixels are replaced, not blended. True color rows are written
+ * directly, palette images resolve every color against their palette. The
+ * rectangle must lie within the image.
+ */
+static void PutImageData(gdImagePtr image, int x, int y, int width, int height,
+                         const uint8_t *data, size_t stride, int alphaMode)
+{
+  for (int row = 0; row < height; row++)
+  {
+    const uint8_t *src = data + (size_t)row * stride;
+
+    for (int col = 0; col < width; col++, src += 4)
+    {
+      int red = src[0];
+      int green = src[1];
+      int blue = src[2];
+      int opacity = alphaMode == PIXEL_ALPHA_IGNORE ? 255 : src[3];
+
+      if (alphaMode == PIXEL_ALPHA_PREMULTIPLIED && opacity < 255)
+      {
+        if (opacity == 0)
+        {
+          red = green = blue = 0;
+        }
+        else
+        {
+          red = std::min(255, (red * 255 + opacity / 2) / opacity);
+          green = std::min(255, (green * 255 + opacity / 2) / opacity);
+          blue = std::min(255, (blue * 255 + opacity / 2) / opacity);
+        }
+      }
+
+      if (gdImageTrueColor(image))
+      {
+        image->tpixels[y + row][x + col] = gdTrueColorAlpha(red, green, blue, ByteToAlpha(opacity));
+      }
+      else
+      {
+        image->pixels[y + row][x + col] =
+            gdImageColorResolveAlpha(image, red, green, blue, ByteToAlpha(opacity));
+      }
+    }
+  }
+}
+
+/**
+ * Copy a rectangle of image into out as RGBA bytes, 4 bytes per pixel, rows
+ * without padding. The rectangle must lie within the image.
+ */
+static void CopyImageData(gdImagePtr image, int x, int y, int width, int height, uint8_t *out)
+{
+  for (int row = 0; row < height; row++)
+  {
+    uint8_t *dst = out + (size_t)row * width * 4;
+
+    if (gdImageTrueColor(image))
+    {
+      const int *src = image->tpixels[y + row] + x;
+      for (int col = 0; col < width; col++, dst += 4)
+      {
+        int color = src[col];
+        dst[0] = gdTrueColorGetRed(color);
+        dst[1] = gdTrueColorGetGreen(color);
+        dst[2] = gdTrueColorGetBlue(color);
+        dst[3] = AlphaToByte(gdTrueColorGetAlpha(color));
+      }
+    }
+    else
+    {
+      const unsigned char *src = image->pixels[y + row] + x;
+      for (int col = 0; col < width; col++, dst += 4)
+      {
+        int index = src[col];
+        dst[0] = image->red[index];
+        dst[1] = image->green[index];
+        dst[2] = image->blue[index];
+        dst[3] = index == image->transparent ? 0 : AlphaToByte(image->alpha[index]);
+      }
+    }
+  }
+}
+
+/**
+ * Points argument of the polygon functions
+ *
+ * Accepts an Array of { x, y } objects, or a typed array of interleaved x, y
+ * coordinates. An Int32Array, also one viewing a SharedArrayBuffer, has the
+ * memory layout of a gdPoint array and is handed to libgd without copying.
+ * A Float64Array is truncated to integers in a single pass.
+ */
+class PolygonPoints
+{
+public:
+  /**
+   * Read the points in argument I. Throws and returns false when the
+   * argument is not usable.
+   */
+  bool Read(const Napi::CallbackInfo &info, size_t I)
+  {
+    static_assert(sizeof(gdPoint) == 2 * sizeof(int), "gdPoint must be two ints");
+
+    Napi::Env env = info.Env();
+    Napi::Value value = info[I];
+
+    if (value.IsTypedArray())
+    {
+      Napi::TypedArray array = value.As<Napi::TypedArray>();
+      napi_typedarray_type type = array.TypedArrayType();
+      size_t length = array.ElementLength();
+
+      if (type != napi_int32_array && type != napi_float64_array)
+      {
+        Napi::TypeError::New(env, "Argument " + std::to_string(I) + " must be an Int32Array or Float64Array")
+            .ThrowAsJavaScriptException();
+        return false;
+      }
+      if (length % 2 != 0 || length / 2 > INT_MAX)
+      {
+        Napi::RangeError::New(env, "Argument " + std::to_string(I) + " must hold pairs of x and y coordinates")
+            .ThrowAsJavaScriptException();
+        return false;
+      }
+
+      _count = (int)(length / 2);
+
+      if (type == napi_int32_array)
+      {
+        _points = reinterpret_cast<gdPointPtr>(TypedArrayBytes(array));
+        return true;
+      }
+
+      const double *coordinates = reinterpret_cast<const double *>(TypedArrayBytes(array));
+      _storage.resize(_count);
+      for (int i = 0; i < _count; i++)
+      {
+        double x = coordinates[2 * i];
+        double y = coordinates[2 * i + 1];
+        if (!(std::fabs(x) <= INT_MAX && std::fabs(y) <= INT_MAX))
+        {
+          Napi::RangeError::New(env, "Coordinates must be finite numbers within the 32 bit integer range")
+              .ThrowAsJavaScriptException();
+          return false;
+        }
+        _storage[i].x = (int)x;
+        _storage[i].y = (int)y;
+      }
+      _points = _storage.data();
+      return true;
+    }
+
+    if (!value.IsArray())
+    {
+      Napi::TypeError::New(env, "Argument " + std::to_string(I) + " must be an array or typed array")
+          .ThrowAsJavaScriptException();
+      return false;
+    }
+
+    Napi::String x = Napi::String::New(env, "x");
+    Napi::String y = Napi::String::New(env, "y");
+
+    Napi::Array array = value.As<Napi::Array>();
+    unsigned int length = array.Length();
+    _storage.reserve(length);
+
+    for (unsigned int i = 0; i < length; i++)
+    {
+      Napi::Value v = array.Get(i);
+      if (!v.IsObject())
+        continue;
+
+      Napi::Object o = v.ToObject();
+      if (!o.Has(x) || !o.Has(y))
+        continue;
+
+      gdPoint point;
+      point.x = o.Get(x).As<Napi::Number>().Int32Value();
+      point.y = o.Get(y).As<Napi::Number>().Int32Value();
+      _storage.push_back(point);
+    }
+
+    _count = (int)_storage.size();
+    _points = _storage.data();
+    return true;
+  }
+
+  gdPointPtr Data() const
+  {
+    return _points;
+  }
+
+  int Count() const
+  {
+    return _count;
+  }
+
+private:
+  gdPointPtr _points{nullptr};
+
+  int _count{0};
+
+  std::vector<gdPoint> _storage;
+};
+
+/**
+ * Display lists
+ *
+ * A display list is a Float64Array of drawing commands, each an opcode
+ * followed by its arguments, plus a table of strings referenced by index.
+ * It is validated once and then replayed against an image without any
+ * further N-API calls. The opcodes are mirrored in lib/DisplayList.js.
+ */
+enum DrawOpcode
+{
+  DRAW_SET_PIXEL = 1,      // x, y, color
+  DRAW_LINE,               // x1, y1, x2, y2, color
+  DRAW_DASHED_LINE,        // x1, y1, x2, y2, color
+  DRAW_RECTANGLE,          // x1, y1, x2, y2, color
+  DRAW_FILLED_RECTANGLE,   // x1, y1, x2, y2, color
+  DRAW_ELLIPSE,            // cx, cy, width, height, color
+  DRAW_FILLED_ELLIPSE,     // cx, cy, width, height, color
+  DRAW_ARC,                // cx, cy, width, height, begin, end, color
+  DRAW_FILLED_ARC,         // cx, cy, width, height, begin, end, color, style
+  DRAW_POLYGON,            // count, color, x0, y0, ... x(count-1), y(count-1)
+  DRAW_OPEN_POLYGON,       // count, color, x0, y0, ...
+  DRAW_FILLED_POLYGON,     // count, color, x0, y0, ...
+  DRAW_STRING_FT,          // color, font string, size, angle, x, y, text string
+  DRAW_SET_THICKNESS,      // thickness
+  DRAW_ALPHA_BLENDING,     // flag
+  DRAW_SET_CLIP            // x1, y1, x2, y2
+};
+
+/**
+ * Amount of fixed arguments of an opcode, -1 when the opcode is unknown
+ */
+static int DrawOpcodeArgs(double opcode)
+{
+  switch ((int)opcode == opcode ? (int)opcode : 0)
+  {
+  case DRAW_SET_PIXEL:
+    return 3;
+  case DRAW_LINE:
+  case DRAW_DASHED_LINE:
+  case DRAW_RECTANGLE:
+  case DRAW_FILLED_RECTANGLE:
+  case DRAW_ELLIPSE:
+  case DRAW_FILLED_ELLIPSE:
+    return 5;
+  case DRAW_ARC:
+    return 7;
+  case DRAW_FILLED_ARC:
+    return 8;
+  case DRAW_POLYGON:
+  case DRAW_OPEN_POLYGON:
+  case DRAW_FILLED_POLYGON:
+    return 2;
+  case DRAW_STRING_FT:
+    return 7;
+  case DRAW_SET_THICKNESS:
+  case DRAW_ALPHA_BLENDING:
+    return 1;
+  case DRAW_SET_CLIP:
+    return 4;
+  default:
+    return -1;
+  }
+}
+
+/**
+ * Check a display list, so RunDisplayList() can replay it without checks.
+ * Returns an error message, or nullptr when the list is valid.
+ */
+static const char *ValidateDisplayList(const double *commands, size_t length, size_t strings)
+{
+  size_t i = 0;
+
+  while (i < length)
+  {
+    int opcode = (int)commands[i];
+    int args = DrawOpcodeArgs(commands[i]);
+    size_t left = length - i - 1;
+
+    if (args < 0)
+    {
+      return "Unknown opcode in display list";
+    }
+    if (left < (size_t)args)
+    {
+      return "Display list ends in the middle of a command";
+    }
+
+    const double *values = commands + i + 1;
+    size_t count = args;
+
+    if (opcode == DRAW_POLYGON || opcode == DRAW_OPEN_POLYGON || opcode == DRAW_FILLED_POLYGON)
+    {
+      double points = values[0];
+      if (!(points >= 0 && points <= INT_MAX) || points != std::floor(points))
+      {
+        return "Invalid amount of polygon points in display list";
+      }
+      if ((left - args) / 2 < (size_t)points)
+      {
+        return "Display list ends in the middle of a command";
+      }
+      count += 2 * (size_t)points;
+    }
+
+    for (size_t j = 0; j < count; j++)
+    {
+      bool isDouble = opcode == DRAW_STRING_FT && (j == 2 || j == 3);
+      if (isDouble ? !std::isfinite(values[j]) : !(values[j] >= INT_MIN && values[j] <= INT_MAX))
+      {
+        return "Display list values must be finite numbers within the 32 bit integer range";
+      }
+    }
+
+    if (opcode == DRAW_STRING_FT && !(values[1] >= 0 && values[1] < strings && values[6] >= 0 && values[6] < strings))
+    {
+      return "String index out of range in display list";
+    }
+
+    i += 1 + count;
+  }
+
+  return nullptr;
+}
+
+/**
+ * Replay a display list, validated by ValidateDisplayList(), on image.
+ * Returns the error of libgd when rendering text fails, or nullptr. When
+ * job is given, replaying stops early once the job is cancelled.
+ */
+static const char *RunDisplayList(gdImagePtr image, const double *commands, size_t length,
+                                  std::vector<std::string> &strings, GdWorker *job = nullptr)
+{
+  std::vector<gdPoint> points;
+  size_t i = 0;
+  size_t run = 0;
+
+  while (i < length)
+  {
+    if (job != nullptr && ++run % 64 == 0 && job->Cancelled())
+    {
+      return nullptr;
+    }
+
+    int opcode = (int)commands[i];
+    const double *v = commands + i + 1;
+    size_t count = DrawOpcodeArgs(commands[i]);
+
+    switch (opcode)
+    {
+    case DRAW_SET_PIXEL:
+      gdImageSetPixel(image, (int)v[0], (int)v[1], (int)v[2]);
+      break;
+    case DRAW_LINE:
+      gdImageLine(image, (int)v[0], (int)v[1], (int)v[2], (int)v[3], (int)v[4]);
+      break;
+    case DRAW_DASHED_LINE:
+      gdImageDashedLine(image, (int)v[0], (int)v[1], (int)v[2], (int)v[3], (int)v[4]);
+      break;
+    case DRAW_RECTANGLE:
+      gdImageRectangle(image, (int)v[0], (int)v[1], (int)v[2], (int)v[3], (int)v[4]);
+      break;
+    case DRAW_FILLED_RECTANGLE:
+      gdImageFilledRectangle(image, (int)v[0], (int)v[1], (int)v[2], (int)v[3], (int)v[4]);
+      break;
+    case DRAW_ELLIPSE:
+      gdImageEllipse(image, (int)v[0], (int)v[1], (int)v[2], (int)v[3], (int)v[4]);
+      break;
+    case DRAW_FILLED_ELLIPSE:
+      gdImageFilledEllipse(image, (int)v[0], (int)v[1], (int)v[2], (int)v[3], (int)v[4]);
+      break;
+    case DRAW_ARC:
+      gdImageArc(image, (int)v[0], (int)v[1], (int)v[2], (int)v[3], (int)v[4], (int)v[5], (int)v[6]);
+      break;
+    case DRAW_FILLED_ARC:
+      gdImageFilledArc(image, (int)v[0], (int)v[1], (int)v[2], (int)v[3], (int)v[4], (int)v[5],
+                       (int)v[6], (int)v[7]);
+      break;
+    case DRAW_POLYGON:
+    case DRAW_OPEN_POLYGON:
+    case DRAW_FILLED_POLYGON:
+    {
+      int n = (int)v[0];
+      points.resize(n);
+      for (int p = 0; p < n; p++)
+      {
+        points[p].x = (int)v[2 + 2 * p];
+        points[p].y = (int)v[3 + 2 * p];
+      }
+      count += 2 * (size_t)n;
+
+      if (opcode == DRAW_POLYGON)
+        gdImagePolygon(image, points.data(), n, (int)v[1]);
+      else if (opcode == DRAW_OPEN_POLYGON)
+        gdImageOpenPolygon(image, points.data(), n, (int)v[1]);
+      else
+        gdImageFilledPolygon(image, points.data(), n, (int)v[1]);
+      break;
+    }
+    case DRAW_STRING_FT:
+    {
+      int brect[8];
+      char *error = gdImageStringFT(image, &brect[0], (int)v[0], &strings[(size_t)v[1]][0], v[2], v[3],
+                                    (int)v[4], (int)v[5], &strings[(size_t)v[6]][0]);
+      if (error)
+      {
+        return error;
+      }
+      break;
+    }
+    case DRAW_SET_THICKNESS:
+      gdImageSetThickness(image, (int)v[0]);
+      break;
+    case DRAW_ALPHA_BLENDING:
+      gdImageAlphaBlending(image, (int)v[0]);
+      break;
+    case DRAW_SET_CLIP:
+      gdImageSetClip(image, (int)v[0], (int)v[1], (int)v[2], (int)v[3]);
+      break;
+    }
+
+    i += 1 + count;
+  }
+
+  return nullptr;
+}
+
+/**
+ * Read the display list in argument 0 and its optional string table in
+ * argument 1. Throws and returns false when either is invalid.
+ */
+static bool DisplayListArgs(const Napi::CallbackInfo &info, const double *&commands, size_t &length,
+                            std::vector<std::string> &strings)
+{
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsTypedArray() ||
+      info[0].As<Napi::TypedArray>().TypedArrayType() != napi_float64_array)
+  {
+    Napi::TypeError::New(env, "Argument 0 must be a Float64Array of drawing commands")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+
+  Napi::TypedArray array = info[0].As<Napi::TypedArray>();
+  commands = reinterpret_cast<const double *>(TypedArrayBytes(array));
+  length = array.ElementLength();
+
+  if (info.Length() > 1 && !info[1].IsUndefined())
+  {
+    if (!info[1].IsArray())
+    {
+      Napi::TypeError::New(env, "Argument 1 must be an array of strings")
+          .ThrowAsJavaScriptException();
+      return false;
+    }
+
+    Napi::Array table = info[1].As<Napi::Array>();
+    strings.reserve(table.Length());
+    for (uint32_t i = 0; i < table.Length(); i++)
+    {
+      strings.push_back(table.Get(i).ToString().Utf8Value());
+    }
+  }
+
+  const char *error = ValidateDisplayList(commands, length, strings.size());
+  if (error)
+  {
+    Napi::RangeError::New(env, error).ThrowAsJavaScriptException();
+    return false;
+  }
+
+  return true;
+}
+
 /**
  * CreateFromWorker only to be inherited from
  *
  * This worker class contains recurring code. The CreateFromJpegWorker and others
  * are decendants of this class. Returns a Promise.
  */
-class CreateFromWorker : public AsyncWorker
+class CreateFromWorker : public GdWorker
 {
 public:
   CreateFromWorker(napi_env env, const char *resource_name)
-      : AsyncWorker(env, resource_name), _deferred(Promise::Deferred::New(env))
+      : GdWorker(env, resource_name), _deferred(Promise::Deferred::New(env))
   {
+    // the size of a decoded image is only known afterwards
+    SetMemoryCost(0);
   }
 
 protected:
@@ -41,7 +696,7 @@ protected:
   {
     // create new instance of Gd::Image with resulting image
     Napi::Value argv = Napi::External<gdImagePtr>::New(Env(), &image);
-    Napi::Object instance = Gd::Image::constructor.New({argv});
+    Napi::Object instance = Gd::Image::Constructor(Env()).New({argv});
 
     // resolve Promise with instance of Gd::Image
     _deferred.Resolve(instance);
@@ -50,7 +705,65 @@ protected:
   virtual void OnError(const Napi::Error &e) override
   {
     // reject Promise with error message
-    _deferred.Reject(Napi::String::New(Env(), e.Message()));
+    _deferred.Reject(Rejection(e));
+  }
+
+  /**
+   * Read the header of an open file and check it before decoding, the
+   * file is rewound for the decoder
+   */
+  bool CheckFile(FILE *in, bool wbmp = false)
+  {
+    ProbeReader reader(in);
+    _probed = wbmp ? ProbeWbmp(reader, _header) : ProbeImage(reader, _header);
+    rewind(in);
+    return AdmitDecode(_limits, _probed, _header);
+  }
+
+  /**
+   * AdmitDecode() for a JPEG decoded at a reduced size: the limits apply to
+   * the image in the file, the memory limit to the image decoded
+   */
+  bool AdmitScaledDecode()
+  {
+    if (!_scale.Any())
+    {
+      return AdmitDecode(_limits, _probed, _header);
+    }
+    std::string error = CheckDecodeLimits(_limits, _probed, _header);
+    if (!error.empty())
+    {
+      SetError(error);
+      return false;
+    }
+    return AdmitDecode(DecodeLimits{0, 0, 0}, _probed, JpegScaledHeader(_header, _scale));
+  }
+
+  /**
+   * Decode the file from a memory mapping when it is large enough or the
+   * call asks for it. Returns false when the file is to be read through
+   * stdio instead.
+   */
+  bool DecodeMapped(MappedDecodeFunction decode, const char *format, bool wbmp = false)
+  {
+    MappedFile file;
+    if (!file.Open(path, _mmap))
+    {
+      return false;
+    }
+
+    ProbeReader reader((const unsigned char *)file.Data(), file.Length());
+    _probed = wbmp ? ProbeWbmp(reader, _header) : ProbeImage(reader, _header);
+    if (!AdmitDecode(_limits, _probed, _header))
+    {
+      return true;
+    }
+    image = decode((int)file.Length(), file.Data());
+    if (!image)
+    {
+      SetError(std::string("Cannot read ") + format + " file");
+    }
+    return true;
   }
 
   gdImagePtr image;
@@ -58,6 +771,16 @@ protected:
   Promise::Deferred _deferred;
 
   std::string path;
+
+  DecodeLimits _limits;
+
+  MmapMode _mmap{MMAP_AUTO};
+
+  JpegScale _scale;
+
+  bool _probed{false};
+
+  ProbeResult _header;
 };
 
 /**
@@ -74,6 +797,10 @@ public:
                                                             "CreateFromJpegWorkerResource");
 
     worker->path = path;
+    JOB_OPTIONS_ARG(1, worker, "jpeg");
+    DECODE_LIMITS_ARG(worker);
+    MMAP_ARG(worker);
+    JPEG_SCALE_ARG(worker);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -81,13 +808,26 @@ public:
 protected:
   void Execute() override
   {
+    if (_scale.Any())
+    {
+      return DecodeScaled();
+    }
     // execute the task
+    if (DecodeMapped(gdImageCreateFromJpegPtr, "JPEG"))
+    {
+      return;
+    }
     FILE *in;
     in = fopen(path.c_str(), "rb");
     if (in == nullptr)
     {
       return SetError("Cannot open JPEG file");
     }
+    if (!CheckFile(in))
+    {
+      fclose(in);
+      return;
+    }
     image = gdImageCreateFromJpeg(in);
     if (!image)
     {
@@ -97,6 +837,47 @@ protected:
     fclose(in);
   }
 
+  /**
+   * Decode at a reduced size with the DCT scaling of libjpeg
+   */
+  void DecodeScaled()
+  {
+    std::string error;
+    MappedFile file;
+    if (file.Open(path, _mmap))
+    {
+      ProbeReader reader((const unsigned char *)file.Data(), file.Length());
+      _probed = ProbeImage(reader, _header);
+      if (!AdmitScaledDecode())
+      {
+        return;
+      }
+      image = DecodeJpegScaled(file.Data(), file.Length(), _scale, error);
+    }
+    else
+    {
+      FILE *in = fopen(path.c_str(), "rb");
+      if (in == nullptr)
+      {
+        return SetError("Cannot open JPEG file");
+      }
+      ProbeReader reader(in);
+      _probed = ProbeImage(reader, _header);
+      rewind(in);
+      if (!AdmitScaledDecode())
+      {
+        fclose(in);
+        return;
+      }
+      image = DecodeJpegScaled(in, _scale, error);
+      fclose(in);
+    }
+    if (!image)
+    {
+      return SetError(error.empty() ? "Cannot read JPEG file" : error);
+    }
+  }
+
 private:
   CreateFromJpegWorker(napi_env env, const char *resource_name)
       : CreateFromWorker(env, resource_name)
@@ -116,6 +897,9 @@ public:
                                                           "CreateFromPngWorkerResource");
 
     worker->path = path;
+    JOB_OPTIONS_ARG(1, worker, "png");
+    DECODE_LIMITS_ARG(worker);
+    MMAP_ARG(worker);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -124,12 +908,21 @@ protected:
   void Execute() override
   {
     // execute the async task
+    if (DecodeMapped(gdImageCreateFromPngPtr, "PNG"))
+    {
+      return;
+    }
     FILE *in;
     in = fopen(path.c_str(), "rb");
     if (in == nullptr)
     {
       return SetError("Cannot open PNG file");
     }
+    if (!CheckFile(in))
+    {
+      fclose(in);
+      return;
+    }
     image = gdImageCreateFromPng(in);
     if (!image)
     {
@@ -158,6 +951,9 @@ public:
                                                           "CreateFromGifWorkerResource");
 
     worker->path = path;
+    JOB_OPTIONS_ARG(1, worker, "gif");
+    DECODE_LIMITS_ARG(worker);
+    MMAP_ARG(worker);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -166,12 +962,21 @@ protected:
   void Execute() override
   {
     // execute the async task
+    if (DecodeMapped(gdImageCreateFromGifPtr, "GIF"))
+    {
+      return;
+    }
     FILE *in;
     in = fopen(path.c_str(), "rb");
     if (in == nullptr)
     {
       return SetError("Cannot open GIF file");
     }
+    if (!CheckFile(in))
+    {
+      fclose(in);
+      return;
+    }
     image = gdImageCreateFromGif(in);
     if (!image)
     {
@@ -200,6 +1005,9 @@ public:
                                                             "CreateFromWBMPWorkerResource");
 
     worker->path = path;
+    JOB_OPTIONS_ARG(1, worker, "wbmp");
+    DECODE_LIMITS_ARG(worker);
+    MMAP_ARG(worker);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -208,12 +1016,21 @@ protected:
   void Execute() override
   {
     // execute the async task
+    if (DecodeMapped(gdImageCreateFromWBMPPtr, "WBMP", true))
+    {
+      return;
+    }
     FILE *in;
     in = fopen(path.c_str(), "rb");
     if (in == nullptr)
     {
       return SetError("Cannot open WBMP file");
     }
+    if (!CheckFile(in, true))
+    {
+      fclose(in);
+      return;
+    }
     image = gdImageCreateFromWBMP(in);
     if (!image)
     {
@@ -242,6 +1059,9 @@ public:
                                                             "CreateFromWebpWorkerResource");
 
     worker->path = path;
+    JOB_OPTIONS_ARG(1, worker, "webp");
+    DECODE_LIMITS_ARG(worker);
+    MMAP_ARG(worker);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -250,12 +1070,21 @@ protected:
   void Execute() override
   {
     // execute the async task
+    if (DecodeMapped(gdImageCreateFromWebpPtr, "WEBP"))
+    {
+      return;
+    }
     FILE *in;
     in = fopen(path.c_str(), "rb");
     if (in == nullptr)
     {
       return SetError("Cannot open WEBP file");
     }
+    if (!CheckFile(in))
+    {
+      fclose(in);
+      return;
+    }
     image = gdImageCreateFromWebp(in);
     if (!image)
     {
@@ -284,6 +1113,9 @@ public:
                                                           "CreateFromBmpWorkerResource");
 
     worker->path = path;
+    JOB_OPTIONS_ARG(1, worker, "bmp");
+    DECODE_LIMITS_ARG(worker);
+    MMAP_ARG(worker);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -292,12 +1124,21 @@ protected:
   void Execute() override
   {
     // execute the async task
+    if (DecodeMapped(gdImageCreateFromBmpPtr, "BMP"))
+    {
+      return;
+    }
     FILE *in;
     in = fopen(path.c_str(), "rb");
     if (in == nullptr)
     {
       return SetError("Cannot open BMP file");
     }
+    if (!CheckFile(in))
+    {
+      fclose(in);
+      return;
+    }
     image = gdImageCreateFromBmp(in);
     if (!image)
     {
@@ -326,6 +1167,9 @@ public:
                                                             "CreateFromTiffWorkerResource");
 
     worker->path = path;
+    JOB_OPTIONS_ARG(1, worker, "tiff");
+    DECODE_LIMITS_ARG(worker);
+    MMAP_ARG(worker);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -334,12 +1178,21 @@ protected:
   void Execute() override
   {
     // execute the async task
+    if (DecodeMapped(gdImageCreateFromTiffPtr, "TIFF"))
+    {
+      return;
+    }
     FILE *in;
     in = fopen(path.c_str(), "rb");
     if (in == nullptr)
     {
       return SetError("Cannot open TIFF file");
     }
+    if (!CheckFile(in))
+    {
+      fclose(in);
+      return;
+    }
     image = gdImageCreateFromTiff(in);
     if (!image)
     {
@@ -369,6 +1222,9 @@ public:
                                                             "CreateFromAvifWorkerResource");
 
     worker->path = path;
+    JOB_OPTIONS_ARG(1, worker, "avif");
+    DECODE_LIMITS_ARG(worker);
+    MMAP_ARG(worker);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -377,12 +1233,21 @@ protected:
   void Execute() override
   {
     // execute the async task
+    if (DecodeMapped(gdImageCreateFromAvifPtr, "Avif"))
+    {
+      return;
+    }
     FILE *in;
     in = fopen(path.c_str(), "rb");
     if (in == nullptr)
     {
       return SetError("Cannot open Avif file");
     }
+    if (!CheckFile(in))
+    {
+      fclose(in);
+      return;
+    }
     image = gdImageCreateFromAvif(in);
     if (!image)
     {
@@ -413,6 +1278,9 @@ public:
                                                             "CreateFromHeifWorkerResource");
 
     worker->path = path;
+    JOB_OPTIONS_ARG(1, worker, "heif");
+    DECODE_LIMITS_ARG(worker);
+    MMAP_ARG(worker);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -421,12 +1289,21 @@ protected:
   void Execute() override
   {
     // execute the async task
+    if (DecodeMapped(gdImageCreateFromHeifPtr, "Heif"))
+    {
+      return;
+    }
     FILE *in;
     in = fopen(path.c_str(), "rb");
     if (in == nullptr)
     {
       return SetError("Cannot open Heif file");
     }
+    if (!CheckFile(in))
+    {
+      fclose(in);
+      return;
+    }
     image = gdImageCreateFromHeif(in);
     if (!image)
     {
@@ -445,10 +1322,297 @@ private:
 #endif
 
 /**
- * FileWorker handling gdImageFile via the AsyncWorker
+ * CreateFromPtrWorker decodes image data from a Buffer in Execute()
+ *
+ * A reference to the Buffer is kept for the lifetime of the worker so the
+ * memory stays valid while the thread pool reads from it. The libgd
+ * gdImageCreateFrom*Ptr function to use is passed in by the caller.
+ * Returns a Promise.
+ */
+class CreateFromPtrWorker : public CreateFromWorker
+{
+public:
+  typedef gdImagePtr (*DecodeFunction)(int size, void *data);
+
+  static Value DoWork(const CallbackInfo &info, DecodeFunction decode, const char *format)
+  {
+    REQ_ARGS(1, "of type Buffer.");
+    ASSERT_IS_BUFFER(info[0]);
+
+    Napi::Buffer<char> buffer = info[0].As<Napi::Buffer<char> >();
+    if (buffer.Length() > INT_MAX)
+    {
+      Napi::RangeError::New(info.Env(), "Buffer is too large to decode")
+          .ThrowAsJavaScriptException();
+      return info.Env().Null();
+    }
+
+    CreateFromPtrWorker *worker = new CreateFromPtrWorker(info.Env(),
+                                                          "CreateFromPtrWorkerResource");
+
+    worker->_buffer = Napi::Persistent(buffer.As<Napi::Object>());
+    worker->_data = buffer.Data();
+    worker->_length = buffer.Length();
+    worker->_decode = decode;
+    worker->_format = format;
+    JOB_OPTIONS_ARG(1, worker, format);
+    DECODE_LIMITS_ARG(worker);
+    if (strcmp(format, "Jpeg") == 0)
+    {
+      JPEG_SCALE_ARG(worker);
+    }
+
+    // the header is read right away, so the job is admitted to the memory
+    // limit with the size of its image
+    ProbeReader reader((const unsigned char *)worker->_data, worker->_length);
+    worker->_probed = strcmp(format, "WBMP") == 0 ? ProbeWbmp(reader, worker->_header)
+                                                  : ProbeImage(reader, worker->_header);
+    if (CheckDecodeLimits(worker->_limits, worker->_probed, worker->_header).empty())
+    {
+      worker->SetMemoryCost(HeaderBytes(worker->_scale.Any() ? JpegScaledHeader(worker->_header, worker->_scale)
+                                                             : worker->_header));
+    }
+    worker->Queue();
+    return worker->_deferred.Promise();
+  }
+
+protected:
+  void Execute() override
+  {
+    if (!AdmitScaledDecode())
+    {
+      return;
+    }
+    if (_scale.Any())
+    {
+      std::string error;
+      image = DecodeJpegScaled(_data, _length, _scale, error);
+      if (!image)
+      {
+        return SetError(error.empty() ? "Cannot read Jpeg data" : error);
+      }
+      return;
+    }
+    image = _decode((int)_length, _data);
+    if (!image)
+    {
+      return SetError(std::string("Cannot read ") + _format + " data");
+    }
+  }
+
+  Napi::ObjectReference _buffer;
+
+  char *_data;
+
+  size_t _length;
+
+  DecodeFunction _decode;
+
+  const char *_format;
+
+private:
+  CreateFromPtrWorker(napi_env env, const char *resource_name)
+      : CreateFromWorker(env, resource_name)
+  {
+  }
+};
+
+/**
+ * CreateFromStreamWorker decodes an image while its data is still arriving
+ *
+ * JavaScript writes the chunks of a Readable stream into a bounded
+ * StreamSource, the decoder reads them through a gdIOCtx on the thread
+ * pool and blocks while no data is there. Returns an object with the
+ * Promise and the write(), end() and abort() functions feeding it.
+ */
+class CreateFromStreamWorker : public CreateFromWorker
+{
+public:
+  typedef gdImagePtr (*DecodeFunction)(gdIOCtxPtr in);
+
+  static Value DoWork(const CallbackInfo &info)
+  {
+    REQ_ARGS(3, "format, buffer size and space callback.");
+    REQ_STR_ARG(0, format, "Argument should be the format of the image in the stream.");
+    REQ_DOUBLE_ARG(1, capacity);
+    REQ_FN_ARG(2, onSpace);
+
+    std::transform(format.begin(), format.end(), format.begin(), ::tolower);
+    DecodeFunction decode = Decoder(format);
+    if (decode == nullptr)
+    {
+      Napi::TypeError::New(info.Env(), "Unsupported stream format '" + format + "'")
+          .ThrowAsJavaScriptException();
+      return info.Env().Null();
+    }
+    if (!(capacity >= 1))
+    {
+      Napi::RangeError::New(info.Env(), "Value for highWaterMark must be 1 or greater")
+          .ThrowAsJavaScriptException();
+      return info.Env().Null();
+    }
+
+    CreateFromStreamWorker *worker = new CreateFromStreamWorker(info.Env(),
+                                                                "CreateFromStreamWorkerResource");
+
+    worker->_decode = decode;
+    worker->_format = format;
+    JOB_OPTIONS_ARG(3, worker, format);
+    DECODE_LIMITS_ARG(worker);
+
+    Napi::ThreadSafeFunction space = Napi::ThreadSafeFunction::New(info.Env(), onSpace,
+                                                                   "CreateFromStreamSpace", 0, 1);
+    std::shared_ptr<StreamSource> source =
+        std::make_shared<StreamSource>((size_t)std::min(capacity, 1e9), space);
+    worker->_source = source;
+
+    // the functions share the source with the worker, it lives as long as
+    // any of them
+    auto write = [source](const CallbackInfo &info) -> Value
+    {
+      REQ_ARGS(1, "a chunk of the stream.");
+      ASSERT_IS_BUFFER(info[0]);
+      Napi::Buffer<unsigned char> chunk = info[0].As<Napi::Buffer<unsigned char> >();
+      return Napi::Number::New(info.Env(), (double)source->Write(chunk.Data(), chunk.Length()));
+    };
+    auto end = [source](const CallbackInfo &info)
+    {
+      source->End();
+    };
+    auto abort = [source](const CallbackInfo &info)
+    {
+      source->Abort(info.Length() > 0 ? info[0].ToString().Utf8Value() : "The stream was aborted");
+    };
+
+    Napi::Object decoder = Napi::Object::New(info.Env());
+    decoder.Set("promise", worker->_deferred.Promise());
+    decoder.Set("write", Napi::Function::New(info.Env(), write, "write"));
+    decoder.Set("end", Napi::Function::New(info.Env(), end, "end"));
+    decoder.Set("abort", Napi::Function::New(info.Env(), abort, "abort"));
+
+    worker->Queue();
+    return decoder;
+  }
+
+  ~CreateFromStreamWorker()
+  {
+    if (_source)
+    {
+      _source->Close();
+    }
+  }
+
+protected:
+  // bytes read ahead to find the header, and at most for headers behind
+  // large metadata
+  static const size_t PROBE_SIZE = 64 * 1024;
+  static const size_t PROBE_SIZE_MAX = 1024 * 1024;
+
+  void Execute() override
+  {
+    StreamReadCtx stream;
+    InitStreamReadCtx(stream, _source.get(), [this]() { return Cancelled(); });
+
+    StreamReadAhead(stream, PROBE_SIZE);
+    _probed = Probe(stream);
+    if (!_probed && !_source->Ended())
+    {
+      StreamReadAhead(stream, PROBE_SIZE_MAX);
+      _probed = Probe(stream);
+    }
+    if (Cancelled() || !AdmitDecode(_limits, _probed, _header))
+    {
+      _source->Close();
+      return;
+    }
+
+    image = _decode(&stream.ctx);
+    _source->Close();
+
+    if (Cancelled())
+    {
+      if (image)
+      {
+        gdImageDestroy(image);
+        image = nullptr;
+      }
+      return;
+    }
+    if (!image)
+    {
+      std::string error = _source->Error();
+      return SetError(error.empty() ? "Cannot read " + _format + " stream" : error);
+    }
+  }
+
+  bool Probe(StreamReadCtx &stream)
+  {
+    ProbeReader reader(stream.prefix.data(), stream.prefix.size());
+    return _format == "wbmp" ? ProbeWbmp(reader, _header) : ProbeImage(reader, _header);
+  }
+
+  static DecodeFunction Decoder(const std::string &format)
+  {
+    if (format == "jpeg" || format == "jpg")
+    {
+      return gdImageCreateFromJpegCtx;
+    }
+    if (format == "png")
+    {
+      return gdImageCreateFromPngCtx;
+    }
+    if (format == "gif")
+    {
+      return gdImageCreateFromGifCtx;
+    }
+    if (format == "bmp")
+    {
+      return gdImageCreateFromBmpCtx;
+    }
+    if (format == "wbmp")
+    {
+      return gdImageCreateFromWBMPCtx;
+    }
+#if HAS_LIBWEBP
+    if (format == "webp")
+    {
+      return gdImageCreateFromWebpCtx;
+    }
+#endif
+#if HAS_LIBHEIF
+    if (format == "heif" || format == "heic")
+    {
+      return gdImageCreateFromHeifCtx;
+    }
+#endif
+#if HAS_LIBAVIF
+    if (format == "avif")
+    {
+      return gdImageCreateFromAvifCtx;
+    }
+#endif
+    // TIFF needs to seek back and forth through the file
+    return nullptr;
+  }
+
+  std::shared_ptr<StreamSource> _source;
+
+  DecodeFunction _decode;
+
+  std::string _format;
+
+private:
+  CreateFromStreamWorker(napi_env env, const char *resource_name)
+      : CreateFromWorker(env, resource_name)
+  {
+  }
+};
+
+/**
+ * FileWorker handling gdImageFile via the GdWorker
  * Returns a Promise
  */
-class FileWorker : public AsyncWorker
+class FileWorker : public GdWorker
 {
 public:
   static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
@@ -459,6 +1623,8 @@ public:
 
     worker->path = path;
     worker->_gdImage = &gdImage;
+    JOB_OPTIONS_ARG(1, worker, "");
+    LEASE_IMAGE(worker, false);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -483,12 +1649,12 @@ protected:
   virtual void OnError(const Napi::Error &e) override
   {
     // reject Promise with error message
-    _deferred.Reject(Napi::String::New(Env(), e.Message()));
+    _deferred.Reject(Rejection(e));
   }
 
 private:
   FileWorker(napi_env env, const char *resource_name)
-      : AsyncWorker(env, resource_name), _deferred(Promise::Deferred::New(env))
+      : GdWorker(env, resource_name), _deferred(Promise::Deferred::New(env))
   {
   }
 
@@ -505,7 +1671,7 @@ private:
  * Async worker class to make the I/O from gdImageCreateFromFile async in JavaScript
  * Returns a Promise
  */
-class CreateFromFileWorker : public AsyncWorker
+class CreateFromFileWorker : public GdWorker
 {
 public:
   static Value DoWork(const CallbackInfo &info)
@@ -516,6 +1682,9 @@ public:
                                                             "CreateFromFileWorkerResource");
 
     worker->path = path;
+    JOB_OPTIONS_ARG(1, worker, "");
+    DECODE_LIMITS_ARG(worker);
+    MMAP_ARG(worker);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -523,6 +1692,33 @@ public:
 protected:
   void Execute() override
   {
+    // the format is picked by the extension, the header by its signature
+    ProbeResult header;
+    MappedDecodeFunction decode = DecoderForExtension(path);
+    MappedFile file;
+    if (decode != nullptr && file.Open(path, _mmap))
+    {
+      ProbeReader reader((const unsigned char *)file.Data(), file.Length());
+      bool probed = ProbeImage(reader, header);
+      if (!AdmitDecode(_limits, probed, header))
+      {
+        return;
+      }
+      image = decode((int)file.Length(), file.Data());
+      if (!image)
+      {
+        return SetError("Cannot read image file");
+      }
+      return;
+    }
+
+    std::string error;
+    bool probed = ProbeFile(path, header, error);
+    if (!AdmitDecode(_limits, probed, header))
+    {
+      return;
+    }
+
     // execute the async task
     image = gdImageCreateFromFile(path.c_str());
     if (!image)
@@ -535,7 +1731,7 @@ protected:
   {
     // create new instance of Gd::Image with resulting image
     Napi::Value argv = Napi::External<gdImagePtr>::New(Env(), &image);
-    Napi::Object instance = Gd::Image::constructor.New({argv});
+    Napi::Object instance = Gd::Image::Constructor(Env()).New({argv});
 
     // resolve Promise with instance of Gd::Image
     _deferred.Resolve(instance);
@@ -543,7 +1739,7 @@ protected:
 
   virtual void OnError(const Napi::Error &e) override
   {
-    _deferred.Reject(Napi::String::New(Env(), e.Message()));
+    _deferred.Reject(Rejection(e));
   }
 
   gdImagePtr image;
@@ -552,21 +1748,26 @@ protected:
 
   std::string path;
 
+  DecodeLimits _limits;
+
+  MmapMode _mmap{MMAP_AUTO};
+
 private:
   CreateFromFileWorker(napi_env env, const char *resource_name)
-      : AsyncWorker(env, resource_name), _deferred(Promise::Deferred::New(env))
+      : GdWorker(env, resource_name), _deferred(Promise::Deferred::New(env))
   {
+    SetMemoryCost(0);
   }
 };
 
 /**
  * CreateWorker for async creation of images in memory
  */
-class CreateWorker : public AsyncWorker
+class CreateWorker : public GdWorker
 {
 public:
   CreateWorker(napi_env env, const char *resource_name, int width, int height, int trueColor)
-      : AsyncWorker(env, resource_name), _deferred(Promise::Deferred::New(env)),
+      : GdWorker(env, resource_name), _deferred(Promise::Deferred::New(env)),
         _width(width), _height(height), _trueColor(trueColor)
   {
   }
@@ -576,14 +1777,7 @@ public:
 protected:
   void Execute() override
   {
-    if (_trueColor == 0)
-    {
-      image = gdImageCreate(_width, _height);
-    }
-    else
-    {
-      image = gdImageCreateTrueColor(_width, _height);
-    }
+    image = RasterPool::Instance().Create(_width, _height, _trueColor != 0);
     if (!image)
     {
       return SetError("No image created!");
@@ -593,14 +1787,14 @@ protected:
   virtual void OnOK() override
   {
     Napi::Value _argv = Napi::External<gdImagePtr>::New(Env(), &image);
-    Napi::Object instance = Gd::Image::constructor.New({_argv});
+    Napi::Object instance = Gd::Image::Constructor(Env()).New({_argv});
 
     _deferred.Resolve(instance);
   }
 
   virtual void OnError(const Napi::Error &e) override
   {
-    _deferred.Reject(Napi::String::New(Env(), e.Message()));
+    _deferred.Reject(Rejection(e));
   }
 
 private:
@@ -616,23 +1810,107 @@ private:
 /**
  * Save workers
  */
-class SaveWorker : public AsyncWorker
+class SaveWorker : public GdWorker
 {
 public:
   SaveWorker(napi_env env, const char *resource_name)
-      : AsyncWorker(env, resource_name), _deferred(Promise::Deferred::New(env))
+      : GdWorker(env, resource_name), _deferred(Promise::Deferred::New(env))
   {
   }
 
 protected:
   virtual void OnOK() override
   {
+    if (_target.fd >= 0)
+    {
+      // the amount of bytes, to know where to write the next image
+      _deferred.Resolve(Napi::Number::New(Env(), (double)_written));
+      return;
+    }
     _deferred.Resolve(Napi::Boolean::New(Env(), true));
   }
 
   virtual void OnError(const Napi::Error &e) override
   {
-    _deferred.Reject(Napi::String::New(Env(), e.Message()));
+    _deferred.Reject(Rejection(e));
+  }
+
+  /**
+   * Encode the image with the gdIOCtx variant of the format
+   */
+  virtual void EncodeCtx(gdImagePtr image, gdIOCtx *out) = 0;
+
+  /**
+   * Jobs writing at the current position of a descriptor read and move it,
+   * so they run one at a time in the order they were queued
+   */
+  void SetTarget(const SaveTarget &target)
+  {
+    _target = target;
+    if (!_target.handle.IsEmpty())
+    {
+      _handle = Napi::Persistent(_target.handle);
+      _target.handle = Napi::Object();
+    }
+    if (_target.fd >= 0 && _target.offset < 0)
+    {
+      SerializeOn(_target.fd);
+    }
+  }
+
+  /**
+   * Encode straight into the file descriptor of the target with pwrite(),
+   * and sync it when asked for
+   */
+  void WriteToFd(const char *format)
+  {
+#ifndef _WIN32
+    if (*_gdImage == nullptr)
+    {
+      return SetError("Image is already destroyed");
+    }
+
+    FdWriteCtx out;
+    InitFdWriteCtx(out, _target);
+    EncodeCtx(*_gdImage, &out.ctx);
+
+    int error = FinishFdWriteCtx(out, _target);
+    if (error != 0)
+    {
+      return SetError(std::string("Cannot write ") + format + " image: " + strerror(error));
+    }
+    if (out.length == 0)
+    {
+      return SetError(std::string("Cannot encode ") + format + " image");
+    }
+
+    _written = out.length;
+
+    if (_target.fsync == FSYNC_EACH)
+    {
+      error = SyncFd(_target.fd);
+      if (error != 0)
+      {
+        return SetError(std::string("Cannot sync ") + format + " image: " + strerror(error));
+      }
+    }
+    else if (_target.fsync == FSYNC_BATCH)
+    {
+      // the thread of the batch syncs and delivers the job, the thread of
+      // the pool is free for the next job meanwhile
+      std::string name = format;
+      auto synced = [this, name](int error)
+      {
+        if (error != 0)
+        {
+          SetError("Cannot sync " + name + " image: " + strerror(error));
+        }
+        Resume();
+      };
+      Suspend();
+      FsyncBatch::Instance().Add(_target.fd, synced);
+    }
+#endif
   }
 
   gdImagePtr *_gdImage;
@@ -645,7 +1923,13 @@ protected:
 
   Promise::Deferred _deferred;
 
-  std::string path;
+  SaveTarget _target;
+
+  // keeps a FileHandle target from being collected, which closes its
+  // descriptor, until the job is delivered
+  Napi::ObjectReference _handle;
+
+  int64_t _written{0};
 };
 
 class SaveJpegWorker : public SaveWorker
@@ -653,15 +1937,17 @@ class SaveJpegWorker : public SaveWorker
 public:
   static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
   {
-    REQ_STR_ARG(0, path, "Argument should be a path and filename to the destination to save the JPEG.");
-    OPT_INT_ARG(1, quality, -1);
+    SAVE_TARGET_ARG(0, target, "Argument should be a path and filename to the destination to save the JPEG.");
+    OPT_INT_ARG_JOB(1, quality, -1);
 
     SaveJpegWorker *worker = new SaveJpegWorker(info.Env(),
                                                 "SaveJpegWorkerResource");
 
-    worker->path = path;
+    worker->SetTarget(target);
     worker->quality = quality;
     worker->_gdImage = &gdImage;
+    JOB_OPTIONS_ARG(1, worker, "jpeg");
+    LEASE_IMAGE(worker, false);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -669,7 +1955,11 @@ public:
 protected:
   void Execute() override
   {
-    FILE *out = fopen(path.c_str(), "wb");
+    if (_target.fd >= 0)
+    {
+      return WriteToFd("JPEG");
+    }
+    FILE *out = fopen(_target.path.c_str(), "wb");
     if (out == nullptr)
     {
       return SetError("Cannot save JPEG file");
@@ -678,6 +1968,11 @@ protected:
     fclose(out);
   }
 
+  void EncodeCtx(gdImagePtr image, gdIOCtx *out) override
+  {
+    gdImageJpegCtx(image, out, quality);
+  }
+
 private:
   SaveJpegWorker(napi_env env, const char *resource_name)
       : SaveWorker(env, resource_name)
@@ -690,13 +1985,15 @@ class SaveGifWorker : public SaveWorker
 public:
   static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
   {
-    REQ_STR_ARG(0, path, "Argument should be a path and filename to the destination to save the Gif.");
+    SAVE_TARGET_ARG(0, target, "Argument should be a path and filename to the destination to save the Gif.");
 
     SaveGifWorker *worker = new SaveGifWorker(info.Env(),
                                               "SaveGifWorkerResource");
 
-    worker->path = path;
+    worker->SetTarget(target);
     worker->_gdImage = &gdImage;
+    JOB_OPTIONS_ARG(1, worker, "gif");
+    LEASE_IMAGE(worker, false);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -704,7 +2001,11 @@ public:
 protected:
   void Execute() override
   {
-    FILE *out = fopen(path.c_str(), "wb");
+    if (_target.fd >= 0)
+    {
+      return WriteToFd("GIF");
+    }
+    FILE *out = fopen(_target.path.c_str(), "wb");
     if (out == nullptr)
     {
       return SetError("Cannot save GIF file");
@@ -713,6 +2014,11 @@ protected:
     fclose(out);
   }
 
+  void EncodeCtx(gdImagePtr image, gdIOCtx *out) override
+  {
+    gdImageGifCtx(image, out);
+  }
+
 private:
   SaveGifWorker(napi_env env, const char *resource_name)
       : SaveWorker(env, resource_name)
@@ -725,15 +2031,17 @@ class SavePngWorker : public SaveWorker
 public:
   static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
   {
-    REQ_STR_ARG(0, path, "Argument should be a path and filename to the destination to save the PNG.");
-    OPT_INT_ARG(1, level, -1);
+    SAVE_TARGET_ARG(0, target, "Argument should be a path and filename to the destination to save the PNG.");
+    OPT_INT_ARG_JOB(1, level, -1);
 
     SavePngWorker *worker = new SavePngWorker(info.Env(),
                                               "SavePngWorkerResource");
 
-    worker->path = path;
+    worker->SetTarget(target);
     worker->level = level;
     worker->_gdImage = &gdImage;
+    JOB_OPTIONS_ARG(1, worker, "png");
+    LEASE_IMAGE(worker, false);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -741,7 +2049,11 @@ public:
 protected:
   void Execute() override
   {
-    FILE *out = fopen(path.c_str(), "wb");
+    if (_target.fd >= 0)
+    {
+      return WriteToFd("PNG");
+    }
+    FILE *out = fopen(_target.path.c_str(), "wb");
     if (out == nullptr)
     {
       return SetError("Cannot save PNG file");
@@ -750,6 +2062,11 @@ protected:
     fclose(out);
   }
 
+  void EncodeCtx(gdImagePtr image, gdIOCtx *out) override
+  {
+    gdImagePngCtxEx(image, out, level);
+  }
+
 private:
   SavePngWorker(napi_env env, const char *resource_name)
       : SaveWorker(env, resource_name)
@@ -762,15 +2079,17 @@ class SaveWBMPWorker : public SaveWorker
 public:
   static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
   {
-    REQ_STR_ARG(0, path, "Argument should be a path and filename to the destination to save the WBMP.");
+    SAVE_TARGET_ARG(0, target, "Argument should be a path and filename to the destination to save the WBMP.");
     REQ_INT_ARG(1, foreground, "The index of the foreground color should be supplied.");
 
     SaveWBMPWorker *worker = new SaveWBMPWorker(info.Env(),
                                                 "SaveWBMPWorkerResource");
 
-    worker->path = path;
+    worker->SetTarget(target);
     worker->foreground = foreground;
     worker->_gdImage = &gdImage;
+    JOB_OPTIONS_ARG(1, worker, "wbmp");
+    LEASE_IMAGE(worker, false);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -778,7 +2097,11 @@ public:
 protected:
   void Execute() override
   {
-    FILE *out = fopen(path.c_str(), "wb");
+    if (_target.fd >= 0)
+    {
+      return WriteToFd("WBMP");
+    }
+    FILE *out = fopen(_target.path.c_str(), "wb");
     if (out == nullptr)
     {
       return SetError("Cannot save WBMP file");
@@ -787,6 +2110,11 @@ protected:
     fclose(out);
   }
 
+  void EncodeCtx(gdImagePtr image, gdIOCtx *out) override
+  {
+    gdImageWBMPCtx(image, foreground, out);
+  }
+
 private:
   SaveWBMPWorker(napi_env env, const char *resource_name)
       : SaveWorker(env, resource_name)
@@ -799,15 +2127,17 @@ class SaveWebpWorker : public SaveWorker
 public:
   static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
   {
-    REQ_STR_ARG(0, path, "Argument should be a path and filename to the destination to save the Webp.");
-    OPT_INT_ARG(1, level, -1);
+    SAVE_TARGET_ARG(0, target, "Argument should be a path and filename to the destination to save the Webp.");
+    OPT_INT_ARG_JOB(1, level, -1);
 
     SaveWebpWorker *worker = new SaveWebpWorker(info.Env(),
                                                 "SaveWebpWorkerResource");
 
-    worker->path = path;
+    worker->SetTarget(target);
     worker->level = level;
     worker->_gdImage = &gdImage;
+    JOB_OPTIONS_ARG(1, worker, "webp");
+    LEASE_IMAGE(worker, false);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -815,7 +2145,11 @@ public:
 protected:
   void Execute() override
   {
-    FILE *out = fopen(path.c_str(), "wb");
+    if (_target.fd >= 0)
+    {
+      return WriteToFd("WEBP");
+    }
+    FILE *out = fopen(_target.path.c_str(), "wb");
     if (out == nullptr)
     {
       return SetError("Cannot save WEBP file");
@@ -824,6 +2158,11 @@ protected:
     fclose(out);
   }
 
+  void EncodeCtx(gdImagePtr image, gdIOCtx *out) override
+  {
+    gdImageWebpCtx(image, out, level);
+  }
+
 private:
   SaveWebpWorker(napi_env env, const char *resource_name)
       : SaveWorker(env, resource_name)
@@ -837,15 +2176,17 @@ public:
   static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
   {
     REQ_ARGS(2, "destination file path and compression flag.");
-    REQ_STR_ARG(0, path, "Argument should be a path and filename to the destination to save the BMP.");
+    SAVE_TARGET_ARG(0, target, "Argument should be a path and filename to the destination to save the BMP.");
     REQ_INT_ARG(1, compression, "BMP compression flag should be either 0 (no compression) or 1 (compression).");
 
     SaveBmpWorker *worker = new SaveBmpWorker(info.Env(),
                                               "SaveBmpWorkerResource");
 
-    worker->path = path;
+    worker->SetTarget(target);
     worker->compression = compression;
     worker->_gdImage = &gdImage;
+    JOB_OPTIONS_ARG(1, worker, "bmp");
+    LEASE_IMAGE(worker, false);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -853,7 +2194,11 @@ public:
 protected:
   void Execute() override
   {
-    FILE *out = fopen(path.c_str(), "wb");
+    if (_target.fd >= 0)
+    {
+      return WriteToFd("BMP");
+    }
+    FILE *out = fopen(_target.path.c_str(), "wb");
     if (out == nullptr)
     {
       return SetError("Cannot save BMP file");
@@ -862,6 +2207,11 @@ protected:
     fclose(out);
   }
 
+  void EncodeCtx(gdImagePtr image, gdIOCtx *out) override
+  {
+    gdImageBmpCtx(image, out, compression);
+  }
+
   int compression;
 
 private:
@@ -876,13 +2226,15 @@ class SaveTiffWorker : public SaveWorker
 public:
   static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
   {
-    REQ_STR_ARG(0, path, "Argument should be a path and filename to the destination to save the TIFF.");
+    SAVE_TARGET_ARG(0, target, "Argument should be a path and filename to the destination to save the TIFF.");
 
     SaveTiffWorker *worker = new SaveTiffWorker(info.Env(),
                                                 "SaveTiffWorkerResource");
 
-    worker->path = path;
+    worker->SetTarget(target);
     worker->_gdImage = &gdImage;
+    JOB_OPTIONS_ARG(1, worker, "tiff");
+    LEASE_IMAGE(worker, false);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -890,7 +2242,11 @@ public:
 protected:
   void Execute() override
   {
-    FILE *out = fopen(path.c_str(), "wb");
+    if (_target.fd >= 0)
+    {
+      return WriteToFd("TIFF");
+    }
+    FILE *out = fopen(_target.path.c_str(), "wb");
     if (out == nullptr)
     {
       return SetError("Cannot save TIFF file");
@@ -899,6 +2255,11 @@ protected:
     fclose(out);
   }
 
+  void EncodeCtx(gdImagePtr image, gdIOCtx *out) override
+  {
+    gdImageTiffCtx(image, out);
+  }
+
 private:
   SaveTiffWorker(napi_env env, const char *resource_name)
       : SaveWorker(env, resource_name)
@@ -912,15 +2273,15 @@ class SaveHeifWorker : public SaveWorker
 public:
   static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
   {
-    REQ_STR_ARG(0, path, "Argument should be a path and filename to the destination to save the Heif.");
-    OPT_INT_ARG(1, quality, -1);
-    OPT_INT_ARG(2, codec_param, 1);
-    OPT_STR_ARG(3, chroma_param, "444");
+    SAVE_TARGET_ARG(0, target, "Argument should be a path and filename to the destination to save the Heif.");
+    OPT_INT_ARG_JOB(1, quality, -1);
+    OPT_INT_ARG_JOB(2, codec_param, 1);
+    OPT_STR_ARG_JOB(3, chroma_param, "444");
 
     SaveHeifWorker *worker = new SaveHeifWorker(info.Env(),
                                                 "SaveHeifWorkerResource");
 
-    worker->path = path;
+    worker->SetTarget(target);
     worker->_gdImage = &gdImage;
     worker->quality = quality;
     if (codec_param == 1)
@@ -936,6 +2297,8 @@ public:
       worker->codec = GD_HEIF_CODEC_UNKNOWN;
     }
     worker->chroma = chroma_param;
+    JOB_OPTIONS_ARG(1, worker, "heif");
+    LEASE_IMAGE(worker, false);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -943,7 +2306,11 @@ public:
 protected:
   void Execute() override
   {
-    FILE *out = fopen(path.c_str(), "wb");
+    if (_target.fd >= 0)
+    {
+      return WriteToFd("Heif");
+    }
+    FILE *out = fopen(_target.path.c_str(), "wb");
     if (out == nullptr)
     {
       return SetError("Cannot save Heif file");
@@ -952,6 +2319,11 @@ protected:
     fclose(out);
   }
 
+  void EncodeCtx(gdImagePtr image, gdIOCtx *out) override
+  {
+    gdImageHeifCtx(image, out, quality, codec, chroma.c_str());
+  }
+
   gdHeifCodec codec;
 
   std::string chroma;
@@ -970,17 +2342,19 @@ class SaveAvifWorker : public SaveWorker
 public:
   static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
   {
-    REQ_STR_ARG(0, path, "Argument should be a path and filename to the destination to save the Avif.");
-    OPT_INT_ARG(1, quality, -1);
-    OPT_INT_ARG(2, speed, -1);
+    SAVE_TARGET_ARG(0, target, "Argument should be a path and filename to the destination to save the Avif.");
+    OPT_INT_ARG_JOB(1, quality, -1);
+    OPT_INT_ARG_JOB(2, speed, -1);
 
     SaveAvifWorker *worker = new SaveAvifWorker(info.Env(),
                                                 "SaveAvifWorkerResource");
 
-    worker->path = path;
+    worker->SetTarget(target);
     worker->_gdImage = &gdImage;
     worker->quality = quality;
     worker->speed = speed;
+    JOB_OPTIONS_ARG(1, worker, "avif");
+    LEASE_IMAGE(worker, false);
     worker->Queue();
     return worker->_deferred.Promise();
   }
@@ -988,7 +2362,11 @@ public:
 protected:
   void Execute() override
   {
-    FILE *out = fopen(path.c_str(), "wb");
+    if (_target.fd >= 0)
+    {
+      return WriteToFd("Avif");
+    }
+    FILE *out = fopen(_target.path.c_str(), "wb");
     if (out == nullptr)
     {
       return SetError("Cannot save Avif file");
@@ -1006,6 +2384,11 @@ protected:
     fclose(out);
   }
 
+  void EncodeCtx(gdImagePtr image, gdIOCtx *out) override
+  {
+    gdImageAvifCtx(image, out, quality, speed);
+  }
+
   int speed;
 
 private:
@@ -1015,3 +2398,1891 @@ private:
   }
 };
 #endif
+
+/**
+ * Ptr workers
+ *
+ * Encode an image into a Buffer on the thread pool instead of on the main
+ * thread. Descendants only implement Encode() which calls the libgd *Ptr
+ * function for their format. Returns a Promise resolving to a Buffer.
+ */
+class PtrWorker : public GdWorker
+{
+public:
+  PtrWorker(napi_env env, const char *resource_name, const char *format)
+      : GdWorker(env, resource_name), _deferred(Promise::Deferred::New(env)),
+        _format(format)
+  {
+  }
+
+  ~PtrWorker()
+  {
+    if (data != nullptr)
+    {
+      gdFree(data);
+    }
+  }
+
+protected:
+  virtual void *Encode(gdImagePtr image) = 0;
+
+  void Execute() override
+  {
+    if (*_gdImage == nullptr)
+    {
+      return SetError("Image is already destroyed");
+    }
+
+    data = Encode(*_gdImage);
+    if (data == nullptr)
+    {
+      return SetError(std::string("Cannot encode ") + _format + " image");
+    }
+  }
+
+  virtual void OnOK() override
+  {
+    // the Buffer takes ownership of data
+    Napi::Buffer<char> result =
+        Napi::Buffer<char>::NewOrCopy(Env(), (char *)data, (size_t)size, FreeGdData);
+    data = nullptr;
+
+    _deferred.Resolve(result);
+  }
+
+  virtual void OnError(const Napi::Error &e) override
+  {
+    _deferred.Reject(Rejection(e));
+  }
+
+  gdImagePtr *_gdImage;
+
+  int quality;
+
+  int level;
+
+  int foreground;
+
+  void *data{nullptr};
+
+  int size{0};
+
+  Promise::Deferred _deferred;
+
+  const char *_format;
+};
+
+class JpegPtrWorker : public PtrWorker
+{
+public:
+  static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
+  {
+    OPT_INT_ARG_JOB(0, quality, -1);
+
+    JpegPtrWorker *worker = new JpegPtrWorker(info.Env(),
+                                              "JpegPtrWorkerResource");
+
+    worker->quality = quality;
+    worker->_gdImage = &gdImage;
+    JOB_OPTIONS_ARG(0, worker, "jpeg");
+    LEASE_IMAGE(worker, false);
+    worker->Queue();
+    return worker->_deferred.Promise();
+  }
+
+protected:
+  void *Encode(gdImagePtr image) override
+  {
+    return gdImageJpegPtr(image, &size, quality);
+  }
+
+private:
+  JpegPtrWorker(napi_env env, const char *resource_name)
+      : PtrWorker(env, resource_name, "JPEG")
+  {
+  }
+};
+
+class GifPtrWorker : public PtrWorker
+{
+public:
+  static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
+  {
+    GifPtrWorker *worker = new GifPtrWorker(info.Env(),
+                                            "GifPtrWorkerResource");
+
+    worker->_gdImage = &gdImage;
+    JOB_OPTIONS_ARG(0, worker, "gif");
+    LEASE_IMAGE(worker, false);
+    worker->Queue();
+    return worker->_deferred.Promise();
+  }
+
+protected:
+  void *Encode(gdImagePtr image) override
+  {
+    return gdImageGifPtr(image, &size);
+  }
+
+private:
+  GifPtrWorker(napi_env env, const char *resource_name)
+      : PtrWorker(env, resource_name, "GIF")
+  {
+  }
+};
+
+class PngPtrWorker : public PtrWorker
+{
+public:
+  static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
+  {
+    OPT_INT_ARG_JOB(0, level, -1);
+
+    PngPtrWorker *worker = new PngPtrWorker(info.Env(),
+                                            "PngPtrWorkerResource");
+
+    worker->level = level;
+    worker->_gdImage = &gdImage;
+    JOB_OPTIONS_ARG(0, worker, "png");
+    LEASE_IMAGE(worker, false);
+    worker->Queue();
+    return worker->_deferred.Promise();
+  }
+
+protected:
+  void *Encode(gdImagePtr image) override
+  {
+    return gdImagePngPtrEx(image, &size, level);
+  }
+
+private:
+  PngPtrWorker(napi_env env, const char *resource_name)
+      : PtrWorker(env, resource_name, "PNG")
+  {
+  }
+};
+
+class WBMPPtrWorker : public PtrWorker
+{
+public:
+  static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
+  {
+    REQ_INT_ARG(0, foreground, "The index of the foreground color should be supplied.");
+
+    WBMPPtrWorker *worker = new WBMPPtrWorker(info.Env(),
+                                              "WBMPPtrWorkerResource");
+
+    worker->foreground = foreground;
+    worker->_gdImage = &gdImage;
+    JOB_OPTIONS_ARG(0, worker, "wbmp");
+    LEASE_IMAGE(worker, false);
+    worker->Queue();
+    return worker->_deferred.Promise();
+  }
+
+protected:
+  void *Encode(gdImagePtr image) override
+  {
+    return gdImageWBMPPtr(image, &size, foreground);
+  }
+
+private:
+  WBMPPtrWorker(napi_env env, const char *resource_name)
+      : PtrWorker(env, resource_name, "WBMP")
+  {
+  }
+};
+
+#if HAS_LIBWEBP
+class WebpPtrWorker : public PtrWorker
+{
+public:
+  static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
+  {
+    OPT_INT_ARG_JOB(0, level, -1);
+
+    WebpPtrWorker *worker = new WebpPtrWorker(info.Env(),
+                                              "WebpPtrWorkerResource");
+
+    worker->level = level;
+    worker->_gdImage = &gdImage;
+    JOB_OPTIONS_ARG(0, worker, "webp");
+    LEASE_IMAGE(worker, false);
+    worker->Queue();
+    return worker->_deferred.Promise();
+  }
+
+protected:
+  void *Encode(gdImagePtr image) override
+  {
+    return gdImageWebpPtrEx(image, &size, level);
+  }
+
+private:
+  WebpPtrWorker(napi_env env, const char *resource_name)
+      : PtrWorker(env, resource_name, "WEBP")
+  {
+  }
+};
+#endif
+
+class BmpPtrWorker : public PtrWorker
+{
+public:
+  static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
+  {
+    OPT_INT_ARG_JOB(0, compression, 0);
+
+    BmpPtrWorker *worker = new BmpPtrWorker(info.Env(),
+                                            "BmpPtrWorkerResource");
+
+    worker->compression = compression;
+    worker->_gdImage = &gdImage;
+    JOB_OPTIONS_ARG(0, worker, "bmp");
+    LEASE_IMAGE(worker, false);
+    worker->Queue();
+    return worker->_deferred.Promise();
+  }
+
+protected:
+  void *Encode(gdImagePtr image) override
+  {
+    return gdImageBmpPtr(image, &size, compression);
+  }
+
+  int compression;
+
+private:
+  BmpPtrWorker(napi_env env, const char *resource_name)
+      : PtrWorker(env, resource_name, "BMP")
+  {
+  }
+};
+
+#if HAS_LIBTIFF
+class TiffPtrWorker : public PtrWorker
+{
+public:
+  static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
+  {
+    TiffPtrWorker *worker = new TiffPtrWorker(info.Env(),
+                                              "TiffPtrWorkerResource");
+
+    worker->_gdImage = &gdImage;
+    JOB_OPTIONS_ARG(0, worker, "tiff");
+    LEASE_IMAGE(worker, false);
+    worker->Queue();
+    return worker->_deferred.Promise();
+  }
+
+protected:
+  void *Encode(gdImagePtr image) override
+  {
+    return gdImageTiffPtr(image, &size);
+  }
+
+private:
+  TiffPtrWorker(napi_env env, const char *resource_name)
+      : PtrWorker(env, resource_name, "TIFF")
+  {
+  }
+};
+#endif
+
+#if HAS_LIBHEIF
+/**
+ * The libgd HEIF codec of the codec argument or option: 1 for HEVC, 4 for
+ * AV1
+ */
+static gdHeifCodec HeifCodec(int codec)
+{
+  if (codec == 1)
+  {
+    return GD_HEIF_CODEC_HEVC;
+  }
+  if (codec == 4)
+  {
+    return GD_HEIF_CODEC_AV1;
+  }
+  return GD_HEIF_CODEC_UNKNOWN;
+}
+
+/**
+ * Read the codec and chroma options of a HEIF encoder from an options
+ * object. Throws and returns false for invalid values.
+ */
+static bool ReadHeifOptions(Napi::Object options, gdHeifCodec &codec, std::string &chroma)
+{
+  Napi::Value codecValue = options.Get("codec");
+  if (!codecValue.IsUndefined() && !codecValue.IsNumber())
+  {
+    Napi::TypeError::New(options.Env(), "Option 'codec' must be a Number")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+  codec = HeifCodec(codecValue.IsUndefined() ? 1 : codecValue.As<Napi::Number>().Int32Value());
+
+  Napi::Value chromaValue = options.Get("chroma");
+  chroma = chromaValue.IsUndefined() ? "444" : chromaValue.ToString().Utf8Value();
+  if (chroma != "444" && chroma != "422" && chroma != "420")
+  {
+    Napi::RangeError::New(options.Env(), "Value for chroma must be one of '420', '422' or '444' (default)")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+  return true;
+}
+
+class HeifPtrWorker : public PtrWorker
+{
+public:
+  static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
+  {
+    OPT_INT_ARG_JOB(0, quality, -1);
+    OPT_INT_ARG_JOB(1, codec_param, 1);
+    OPT_STR_ARG_JOB(2, chroma, "444");
+
+    if (quality < -1 || quality > 200)
+    {
+      Napi::RangeError::New(info.Env(), "Value for quality must be greater than or equal to 0 and less than or equal to 200").ThrowAsJavaScriptException();
+      return info.Env().Null();
+    }
+
+    if (chroma.compare("444") != 0 && chroma.compare("422") != 0 && chroma.compare("420") != 0)
+    {
+      Napi::RangeError::New(info.Env(), "Value for chroma must be one of '420', '422' or '444' (default)").ThrowAsJavaScriptException();
+      return info.Env().Null();
+    }
+
+    HeifPtrWorker *worker = new HeifPtrWorker(info.Env(),
+                                              "HeifPtrWorkerResource");
+
+    worker->quality = quality;
+    worker->codec = HeifCodec(codec_param);
+    worker->chroma = chroma;
+    worker->_gdImage = &gdImage;
+    JOB_OPTIONS_ARG(0, worker, "heif");
+    LEASE_IMAGE(worker, false);
+    worker->Queue();
+    return worker->_deferred.Promise();
+  }
+
+protected:
+  void *Encode(gdImagePtr image) override
+  {
+    return gdImageHeifPtrEx(image, &size, quality, codec, chroma.c_str());
+  }
+
+  gdHeifCodec codec;
+
+  std::string chroma;
+
+private:
+  HeifPtrWorker(napi_env env, const char *resource_name)
+      : PtrWorker(env, resource_name, "Heif")
+  {
+  }
+};
+#endif
+
+#if HAS_LIBAVIF
+class AvifPtrWorker : public PtrWorker
+{
+public:
+  static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
+  {
+    OPT_INT_ARG_JOB(0, quality, -1);
+    OPT_INT_ARG_JOB(1, speed, -1);
+
+    AvifPtrWorker *worker = new AvifPtrWorker(info.Env(),
+                                              "AvifPtrWorkerResource");
+
+    worker->quality = quality;
+    worker->speed = speed;
+    worker->_gdImage = &gdImage;
+    JOB_OPTIONS_ARG(0, worker, "avif");
+    LEASE_IMAGE(worker, false);
+    worker->Queue();
+    return worker->_deferred.Promise();
+  }
+
+protected:
+  void *Encode(gdImagePtr image) override
+  {
+    return gdImageAvifPtrEx(image, &size, quality, speed);
+  }
+
+  int speed;
+
+private:
+  AvifPtrWorker(napi_env env, const char *resource_name)
+      : PtrWorker(env, resource_name, "Avif")
+  {
+  }
+};
+#endif
+
+/**
+ * GetImageDataWorker copies a rectangle of pixels into a typed array. The
+ * pixels are converted on the thread pool into memory of the worker and
+ * copied into the typed array on the main thread, as its ArrayBuffer may be
+ * transferred or resized while the job runs.
+ */
+class GetImageDataWorker : public GdWorker
+{
+public:
+  static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
+  {
+    REQ_ARGS(4, "x coordinate, y coordinate, width and height.");
+    REQ_INT_ARG(0, x, "A value for the x coordinate should be supplied.");
+    REQ_INT_ARG(1, y, "A value for the y coordinate should be supplied.");
+    REQ_INT_ARG(2, width, "A value for 'width' should be supplied.");
+    REQ_INT_ARG(3, height, "A value for 'height' should be supplied.");
+
+    if (!CheckPixelRegion(info.Env(), gdImage, x, y, width, height))
+    {
+      return info.Env().Null();
+    }
+
+    Napi::TypedArray target = PixelArrayArg(info, 4, (size_t)width * height * 4, true);
+    if (target.IsEmpty())
+    {
+      return info.Env().Null();
+    }
+
+    GetImageDataWorker *worker = new GetImageDataWorker(info.Env(),
+                                                        "GetImageDataWorkerResource");
+
+    worker->_gdImage = &gdImage;
+    worker->_x = x;
+    worker->_y = y;
+    worker->_width = width;
+    worker->_height = height;
+    worker->_target = Napi::Persistent(target.As<Napi::Object>());
+    JOB_OPTIONS_ARG(4, worker, "");
+    LEASE_IMAGE(worker, false);
+    worker->Queue();
+    return worker->_deferred.Promise();
+  }
+
+protected:
+  void Execute() override
+  {
+    if (*_gdImage == nullptr)
+    {
+      return SetError("Image is already destroyed");
+    }
+    if (_width > gdImageSX(*_gdImage) - _x || _height > gdImageSY(*_gdImage) - _y)
+    {
+      return SetError("Image has been resized");
+    }
+
+    _data.resize((size_t)_width * _height * 4);
+    CopyImageData(*_gdImage, _x, _y, _width, _height, _data.data());
+  }
+
+  virtual void OnOK() override
+  {
+    Napi::TypedArray target = _target.Value().As<Napi::TypedArray>();
+    if (target.ByteLength() < _data.size())
+    {
+      _deferred.Reject(Napi::String::New(Env(), "Typed array was detached or shrunk"));
+      return;
+    }
+
+    memcpy(TypedArrayBytes(target), _data.data(), _data.size());
+    _deferred.Resolve(target);
+  }
+
+  virtual void OnError(const Napi::Error &e) override
+  {
+    _deferred.Reject(Rejection(e));
+  }
+
+private:
+  GetImageDataWorker(napi_env env, const char *resource_name)
+      : GdWorker(env, resource_name), _deferred(Promise::Deferred::New(env))
+  {
+  }
+
+  gdImagePtr *_gdImage;
+
+  int _x;
+
+  int _y;
+
+  int _width;
+
+  int _height;
+
+  std::vector<uint8_t> _data;
+
+  Napi::ObjectReference _target;
+
+  Promise::Deferred _deferred;
+};
+
+/**
+ * PutImageDataWorker writes RGBA data from a typed array into a rectangle of
+ * an image on the thread pool. The data is copied first, as the ArrayBuffer
+ * may be transferred or resized while the job runs.
+ */
+class PutImageDataWorker : public GdWorker
+{
+public:
+  static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
+  {
+    REQ_ARGS(5, "pixel data, x coordinate, y coordinate, width and height.");
+    REQ_INT_ARG(1, x, "A value for the x coordinate should be supplied.");
+    REQ_INT_ARG(2, y, "A value for the y coordinate should be supplied.");
+    REQ_INT_ARG(3, width, "A value for 'width' should be supplied.");
+    REQ_INT_ARG(4, height, "A value for 'height' should be supplied.");
+
+    if (!CheckPixelRegion(info.Env(), gdImage, x, y, width, height))
+    {
+      return info.Env().Null();
+    }
+
+    size_t stride;
+    int alphaMode;
+    if (!PixelOptionsArg(info, 5, width, stride, alphaMode))
+    {
+      return info.Env().Null();
+    }
+
+    Napi::TypedArray source = PixelArrayArg(info, 0, PixelDataLength(width, height, stride), false);
+    if (source.IsEmpty())
+    {
+      return info.Env().Null();
+    }
+
+    PutImageDataWorker *worker = new PutImageDataWorker(info.Env(),
+                                                        "PutImageDataWorkerResource");
+
+    worker->_gdImage = &gdImage;
+    worker->_x = x;
+    worker->_y = y;
+    worker->_width = width;
+    worker->_height = height;
+    worker->_stride = stride;
+    worker->_alphaMode = alphaMode;
+    worker->_data.assign(TypedArrayBytes(source), TypedArrayBytes(source) + PixelDataLength(width, height, stride));
+    worker->_self = Napi::Persistent(info.This().As<Napi::Object>());
+    JOB_OPTIONS_ARG(5, worker, "");
+    LEASE_IMAGE(worker, true);
+    worker->Queue();
+    return worker->_deferred.Promise();
+  }
+
+protected:
+  void Execute() override
+  {
+    if (*_gdImage == nullptr)
+    {
+      return SetError("Image is already destroyed");
+    }
+    if (_width > gdImageSX(*_gdImage) - _x || _height > gdImageSY(*_gdImage) - _y)
+    {
+      return SetError("Image has been resized");
+    }
+
+    PutImageData(*_gdImage, _x, _y, _width, _height, _data.data(), _stride, _alphaMode);
+  }
+
+  virtual void OnOK() override
+  {
+    _deferred.Resolve(_self.Value());
+  }
+
+  virtual void OnError(const Napi::Error &e) override
+  {
+    _deferred.Reject(Rejection(e));
+  }
+
+private:
+  PutImageDataWorker(napi_env env, const char *resource_name)
+      : GdWorker(env, resource_name), _deferred(Promise::Deferred::New(env))
+  {
+  }
+
+  gdImagePtr *_gdImage;
+
+  int _x;
+
+  int _y;
+
+  int _width;
+
+  int _height;
+
+  size_t _stride;
+
+  int _alphaMode;
+
+  std::vector<uint8_t> _data;
+
+  Napi::ObjectReference _self;
+
+  Promise::Deferred _deferred;
+};
+
+/**
+ * CreateFromRGBAWorker creates a true color image from RGBA data in a typed
+ * array on the thread pool, from a copy of the data
+ */
+class CreateFromRGBAWorker : public CreateFromWorker
+{
+public:
+  static Value DoWork(const CallbackInfo &info)
+  {
+    REQ_ARGS(3, "width, height and pixel data.");
+    REQ_INT_ARG(0, width, "A value for 'width' should be supplied.");
+    REQ_INT_ARG(1, height, "A value for 'height' should be supplied.");
+
+    INT_ARG_RANGE(width, "width");
+    INT_ARG_RANGE(height, "height");
+
+    size_t stride;
+    int alphaMode;
+    if (!PixelOptionsArg(info, 3, width, stride, alphaMode))
+    {
+      return info.Env().Null();
+    }
+
+    Napi::TypedArray source = PixelArrayArg(info, 2, PixelDataLength(width, height, stride), false);
+    if (source.IsEmpty())
+    {
+      return info.Env().Null();
+    }
+
+    CreateFromRGBAWorker *worker = new CreateFromRGBAWorker(info.Env(),
+                                                            "CreateFromRGBAWorkerResource");
+
+    worker->_width = width;
+    worker->_height = height;
+    worker->_stride = stride;
+    worker->_alphaMode = alphaMode;
+    worker->_data.assign(TypedArrayBytes(source), TypedArrayBytes(source) + PixelDataLength(width, height, stride));
+    worker->SetMemoryCost(ImageBytes(width, height, true));
+    JOB_OPTIONS_ARG(3, worker, "");
+    worker->Queue();
+    return worker->_deferred.Promise();
+  }
+
+  /**
+   * Create the image and fill it, shared with gd.createFromRGBASync()
+   */
+  static gdImagePtr CreateImage(int width, int height, const uint8_t *data, size_t stride, int alphaMode)
+  {
+    gdImagePtr image = gdImageCreateTrueColor(width, height);
+    if (!image)
+    {
+      return nullptr;
+    }
+
+    PutImageData(image, 0, 0, width, height, data, stride, alphaMode);
+    if (alphaMode != PIXEL_ALPHA_IGNORE)
+    {
+      gdImageSaveAlpha(image, 1);
+    }
+    return image;
+  }
+
+protected:
+  void Execute() override
+  {
+    image = CreateImage(_width, _height, _data.data(), _stride, _alphaMode);
+    if (!image)
+    {
+      return SetError("No image created!");
+    }
+  }
+
+private:
+  CreateFromRGBAWorker(napi_env env, const char *resource_name)
+      : CreateFromWorker(env, resource_name)
+  {
+  }
+
+  int _width;
+
+  int _height;
+
+  size_t _stride;
+
+  int _alphaMode;
+
+  std::vector<uint8_t> _data;
+};
+
+/**
+ * ProbeWorker reads the headers of an image in a Buffer or a file
+ * Returns a Promise
+ */
+class ProbeWorker : public GdWorker
+{
+public:
+  static Value DoWork(const CallbackInfo &info)
+  {
+    REQ_ARGS(1, "a Buffer or a path to an image file.");
+    if (!info[0].IsBuffer() && !info[0].IsString())
+    {
+      Napi::TypeError::New(info.Env(), "Argument 0 must be a Buffer or a string.")
+          .ThrowAsJavaScriptException();
+      return info.Env().Null();
+    }
+
+    ProbeWorker *worker = new ProbeWorker(info.Env(), "ProbeWorkerResource");
+
+    if (info[0].IsBuffer())
+    {
+      Napi::Buffer<unsigned char> buffer = info[0].As<Napi::Buffer<unsigned char> >();
+      worker->_buffer = Napi::Persistent(buffer.As<Napi::Object>());
+      worker->_data = buffer.Data();
+      worker->_length = buffer.Length();
+    }
+    else
+    {
+      worker->_path = info[0].As<Napi::String>().Utf8Value();
+    }
+    JOB_OPTIONS_ARG(1, worker, "");
+    worker->Queue();
+    return worker->_deferred.Promise();
+  }
+
+protected:
+  void Execute() override
+  {
+    if (_data == nullptr)
+    {
+      std::string error;
+      if (!ProbeFile(_path, _result, error))
+      {
+        return SetError(error);
+      }
+      return;
+    }
+
+    ProbeReader in(_data, _length);
+    if (!ProbeImage(in, _result))
+    {
+      return SetError("Cannot read image header");
+    }
+  }
+
+  virtual void OnOK() override
+  {
+    _deferred.Resolve(ProbeResultObject(Env(), _result));
+  }
+
+  virtual void OnError(const Napi::Error &e) override
+  {
+    _deferred.Reject(Rejection(e));
+  }
+
+private:
+  ProbeWorker(napi_env env, const char *resource_name)
+      : GdWorker(env, resource_name), _deferred(Promise::Deferred::New(env)),
+        _data(nullptr), _length(0)
+  {
+  }
+
+  Promise::Deferred _deferred;
+
+  Napi::ObjectReference _buffer;
+
+  const unsigned char *_data;
+
+  size_t _length;
+
+  std::string _path;
+
+  ProbeResult _result;
+};
+
+/**
+ * DrawCommandsWorker replays a display list on the thread pool. The commands
+ * and strings are copied, so the caller may reuse or change the list right
+ * away.
+ */
+class DrawCommandsWorker : public GdWorker
+{
+public:
+  static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
+  {
+    const double *commands;
+    size_t length;
+    std::vector<std::string> strings;
+
+    if (!DisplayListArgs(info, commands, length, strings))
+    {
+      return info.Env().Null();
+    }
+
+    DrawCommandsWorker *worker = new DrawCommandsWorker(info.Env(),
+                                                        "DrawCommandsWorkerResource");
+
+    worker->_gdImage = &gdImage;
+    worker->_commands.assign(commands, commands + length);
+    worker->_strings = std::move(strings);
+    worker->_self = Napi::Persistent(info.This().As<Napi::Object>());
+    JOB_OPTIONS_ARG(1, worker, "");
+    LEASE_IMAGE(worker, true);
+    worker->Queue();
+    return worker->_deferred.Promise();
+  }
+
+protected:
+  void Execute() override
+  {
+    if (*_gdImage == nullptr)
+    {
+      return SetError("Image is already destroyed");
+    }
+
+    const char *error = RunDisplayList(*_gdImage, _commands.data(), _commands.size(), _strings, this);
+    if (error)
+    {
+      return SetError(error);
+    }
+  }
+
+  virtual void OnOK() override
+  {
+    _deferred.Resolve(_self.Value());
+  }
+
+  virtual void OnError(const Napi::Error &e) override
+  {
+    _deferred.Reject(Rejection(e));
+  }
+
+private:
+  DrawCommandsWorker(napi_env env, const char *resource_name)
+      : GdWorker(env, resource_name), _deferred(Promise::Deferred::New(env))
+  {
+  }
+
+  gdImagePtr *_gdImage;
+
+  std::vector<double> _commands;
+
+  std::vector<std::string> _strings;
+
+  Napi::ObjectReference _self;
+
+  Promise::Deferred _deferred;
+};
+
+/**
+ * Pick the libgd decoder for encoded image data by its signature. Returns
+ * nullptr when the format is not recognized or not supported by this build.
+ */
+static CreateFromPtrWorker::DecodeFunction SniffDecoder(const unsigned char *data, size_t length,
+                                                        const char *&format)
+{
+  if (length >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF)
+  {
+    format = "JPEG";
+    return gdImageCreateFromJpegPtr;
+  }
+  if (length >= 8 && memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0)
+  {
+    format = "PNG";
+    return gdImageCreateFromPngPtr;
+  }
+  if (length >= 6 && (memcmp(data, "GIF87a", 6) == 0 || memcmp(data, "GIF89a", 6) == 0))
+  {
+    format = "GIF";
+    return gdImageCreateFromGifPtr;
+  }
+  if (length >= 2 && data[0] == 'B' && data[1] == 'M')
+  {
+    format = "BMP";
+    return gdImageCreateFromBmpPtr;
+  }
+#if HAS_LIBWEBP
+  if (length >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WEBP", 4) == 0)
+  {
+    format = "WEBP";
+    return gdImageCreateFromWebpPtr;
+  }
+#endif
+#if HAS_LIBTIFF
+  if (length >= 4 && (memcmp(data, "II*\0", 4) == 0 || memcmp(data, "MM\0*", 4) == 0))
+  {
+    format = "TIFF";
+    return gdImageCreateFromTiffPtr;
+  }
+#endif
+  if (length >= 12 && memcmp(data + 4, "ftyp", 4) == 0)
+  {
+#if HAS_LIBAVIF
+    if (memcmp(data + 8, "avif", 4) == 0 || memcmp(data + 8, "avis", 4) == 0)
+    {
+      format = "AVIF";
+      return gdImageCreateFromAvifPtr;
+    }
+#endif
+#if HAS_LIBHEIF
+    format = "HEIF";
+    return gdImageCreateFromHeifPtr;
+#endif
+  }
+
+  return nullptr;
+}
+
+/**
+ * PipelineWorker decodes an image, applies a list of transformations and
+ * encodes the result, all in a single Execute() on the thread pool.
+ * Intermediate images are destroyed as soon as a step has replaced them and
+ * only the encoded Buffer is handed back to JavaScript.
+ */
+class PipelineWorker : public PtrWorker
+{
+public:
+  static Value DoWork(const CallbackInfo &info)
+  {
+    REQ_ARGS(3, "input, an array of steps and output options.");
+
+    PipelineWorker *worker = new PipelineWorker(info.Env(), "PipelineWorkerResource");
+    worker->SetMemoryCost(0);
+
+    if (!worker->ReadInput(info) || !worker->ReadSteps(info) || !worker->ReadOutput(info))
+    {
+      delete worker;
+      return info.Env().Null();
+    }
+
+    JOB_OPTIONS_ARG(3, worker, worker->_format);
+    // Argument 2 may be an object too, the options can only be argument 3
+    if (!ReadDecodeLimits(info, worker->_limits, 3))
+    {
+      delete worker;
+      return info.Env().Null();
+    }
+
+    if (worker->_decode != nullptr)
+    {
+      ProbeReader reader((const unsigned char *)worker->_data, worker->_length);
+      worker->_probed = ProbeImage(reader, worker->_header);
+      std::string error = CheckDecodeLimits(worker->_limits, worker->_probed, worker->_header);
+      if (error.empty() && worker->_probed)
+      {
+        size_t peak = worker->PeakBytes(worker->_header, error);
+        if (error.empty())
+        {
+          worker->SetMemoryCost(peak);
+        }
+      }
+    }
+    worker->Queue();
+    return worker->_deferred.Promise();
+  }
+
+  ~PipelineWorker()
+  {
+    if (_image != nullptr)
+    {
+      gdImageDestroy(_image);
+    }
+  }
+
+protected:
+  enum StepType
+  {
+    STEP_RESIZE,
+    STEP_SCALE,
+    STEP_CROP,
+    STEP_ROTATE,
+    STEP_SHARPEN,
+    STEP_GAUSSIAN_BLUR,
+    STEP_GRAYSCALE,
+    STEP_NEGATE,
+    STEP_BRIGHTNESS,
+    STEP_CONTRAST,
+    STEP_FLIP_HORIZONTAL,
+    STEP_FLIP_VERTICAL,
+    STEP_FLIP_BOTH
+  };
+
+  struct Step
+  {
+    StepType type;
+    int args[4];
+    double value;
+  };
+
+  void Execute() override
+  {
+    if (_decode == nullptr)
+    {
+      std::string error;
+      _probed = ProbeFile(_path, _header, error);
+    }
+    if (!AdmitPipeline())
+    {
+      return;
+    }
+
+    if (_decode != nullptr)
+    {
+      _image = _decode((int)_length, _data);
+    }
+    else
+    {
+      _image = gdImageCreateFromFile(_path.c_str());
+    }
+    if (_image == nullptr)
+    {
+      return SetError(std::string("Cannot read ") + _inputFormat + " data");
+    }
+
+    for (const Step &step : _steps)
+    {
+      if (Cancelled())
+      {
+        return;
+      }
+
+      const char *error = Apply(step);
+      if (error)
+      {
+        return SetError(error);
+      }
+    }
+
+    if (Cancelled())
+    {
+      return;
+    }
+
+    PtrWorker::Execute();
+  }
+
+  void *Encode(gdImagePtr image) override
+  {
+    switch (_output)
+    {
+    case OUTPUT_JPEG:
+      return gdImageJpegPtr(image, &size, quality);
+    case OUTPUT_PNG:
+      return gdImagePngPtrEx(image, &size, level);
+    case OUTPUT_GIF:
+      return gdImageGifPtr(image, &size);
+    case OUTPUT_BMP:
+      return gdImageBmpPtr(image, &size, level);
+#if HAS_LIBWEBP
+    case OUTPUT_WEBP:
+      return gdImageWebpPtrEx(image, &size, quality);
+#endif
+#if HAS_LIBTIFF
+    case OUTPUT_TIFF:
+      return gdImageTiffPtr(image, &size);
+#endif
+#if HAS_LIBHEIF
+    case OUTPUT_HEIF:
+      return gdImageHeifPtrEx(image, &size, quality, _heifCodec, _chroma.c_str());
+#endif
+#if HAS_LIBAVIF
+    case OUTPUT_AVIF:
+      return gdImageAvifPtrEx(image, &size, quality, level);
+#endif
+    default:
+      return nullptr;
+    }
+  }
+
+private:
+  enum OutputFormat
+  {
+    OUTPUT_JPEG,
+    OUTPUT_PNG,
+    OUTPUT_GIF,
+    OUTPUT_BMP,
+    OUTPUT_WEBP,
+    OUTPUT_TIFF,
+    OUTPUT_HEIF,
+    OUTPUT_AVIF
+  };
+
+  PipelineWorker(napi_env env, const char *resource_name)
+      : PtrWorker(env, resource_name, "")
+  {
+    _gdImage = &_image;
+  }
+
+  /**
+   * Check the decoded image and every image the steps make from it against
+   * the decode limits, and reserve the most pixel memory the pipeline holds
+   * at once. Sets the error and returns false when it must not run.
+   */
+  bool AdmitPipeline()
+  {
+    if (!_probed)
+    {
+      return AdmitDecode(_limits, _probed, _header);
+    }
+
+    std::string error = CheckDecodeLimits(_limits, _probed, _header);
+    size_t peak = error.empty() ? PeakBytes(_header, error) : 0;
+    if (!error.empty())
+    {
+      SetError(error);
+      return false;
+    }
+    return AdmitBytes(peak);
+  }
+
+  /**
+   * Follow the size of the image through the steps, starting from the
+   * decoded header. A step that makes a new image holds it next to its
+   * source, the peak is the largest of these pairs. Sets error when an
+   * intermediate image exceeds the decode limits.
+   */
+  size_t PeakBytes(const ProbeResult &header, std::string &error) const
+  {
+    ProbeResult current = header;
+    size_t peak = HeaderBytes(current);
+
+    for (const Step &step : _steps)
+    {
+      ProbeResult next = current;
+      next.trueColor = true;
+      double width = current.width;
+      double height = current.height;
+
+      switch (step.type)
+      {
+      case STEP_RESIZE:
+        next.width = step.args[0] ? step.args[0] : std::max(1.0, std::floor(width * step.args[1] / height + 0.5));
+        next.height = step.args[1] ? step.args[1] : std::max(1.0, std::floor(height * step.args[0] / width + 0.5));
+        break;
+      case STEP_SCALE:
+        next.width = std::max(step.args[0], 0);
+        next.height = std::max(step.args[1], 0);
+        break;
+      case STEP_CROP:
+        // libgd clips the rectangle to the image
+        next.trueColor = current.trueColor;
+        next.width = std::max(0.0, std::min((double)step.args[2], width - std::max(step.args[0], 0)));
+        next.height = std::max(0.0, std::min((double)step.args[3], height - std::max(step.args[1], 0)));
+        break;
+      case STEP_ROTATE:
+      {
+        // The bounding box of the rotated image, rounding errors of right
+        // angles ignored
+        double angle = step.value * std::acos(-1.0) / 180;
+        double cos = std::fabs(std::cos(angle));
+        double sin = std::fabs(std::sin(angle));
+        next.width = (uint32_t)std::ceil(width * cos + height * sin - 1e-6);
+        next.height = (uint32_t)std::ceil(width * sin + height * cos - 1e-6);
+        break;
+      }
+      case STEP_GAUSSIAN_BLUR:
+        // The convolution works from a copy of the image
+        next.trueColor = current.trueColor;
+        break;
+      default:
+        continue;
+      }
+
+      if (step.type != STEP_GAUSSIAN_BLUR && step.type != STEP_CROP)
+      {
+        error = CheckDecodeLimits(_limits, true, next);
+        if (!error.empty())
+        {
+          return 0;
+        }
+      }
+      peak = std::max(peak, HeaderBytes(current) + HeaderBytes(next));
+      current = next;
+    }
+    return peak;
+  }
+
+  /**
+   * Run one step, replacing _image when the libgd function returns a new
+   * image. Returns an error message, or nullptr.
+   */
+  const char *Apply(const Step &step)
+  {
+    gdImagePtr result = nullptr;
+
+    switch (step.type)
+    {
+    case STEP_RESIZE:
+    {
+      int width = step.args[0];
+      int height = step.args[1];
+      if (width == 0)
+        width = std::max(1, (int)((double)gdImageSX(_image) * height / gdImageSY(_image) + 0.5));
+      if (height == 0)
+        height = std::max(1, (int)((double)gdImageSY(_image) * width / gdImageSX(_image) + 0.5));
+
+      result = gdImageCreateTrueColor(width, height);
+      if (result == nullptr)
+        return "Cannot resize image";
+
+      gdImageAlphaBlending(result, 0);
+      gdImageSaveAlpha(result, 1);
+      gdImageCopyResampled(result, _image, 0, 0, 0, 0, width, height,
+                           gdImageSX(_image), gdImageSY(_image));
+      break;
+    }
+    case STEP_SCALE:
+      result = gdImageScale(_image, step.args[0], step.args[1]);
+      if (result == nullptr)
+        return "Cannot scale image";
+      break;
+    case STEP_CROP:
+    {
+      gdRect rect = {step.args[0], step.args[1], step.args[2], step.args[3]};
+      result = gdImageCrop(_image, &rect);
+      if (result == nullptr)
+        return "Cannot crop image";
+      break;
+    }
+    case STEP_ROTATE:
+      result = gdImageRotateInterpolated(_image, (float)step.value, step.args[0]);
+      if (result == nullptr)
+        return "Cannot rotate image";
+      break;
+    case STEP_SHARPEN:
+      gdImageSharpen(_image, step.args[0]);
+      break;
+    case STEP_GAUSSIAN_BLUR:
+      gdImageGaussianBlur(_image);
+      break;
+    case STEP_GRAYSCALE:
+      gdImageGrayScale(_image);
+      break;
+    case STEP_NEGATE:
+      gdImageNegate(_image);
+      break;
+    case STEP_BRIGHTNESS:
+      gdImageBrightness(_image, step.args[0]);
+      break;
+    case STEP_CONTRAST:
+      gdImageContrast(_image, step.value);
+      break;
+    case STEP_FLIP_HORIZONTAL:
+      gdImageFlipHorizontal(_image);
+      break;
+    case STEP_FLIP_VERTICAL:
+      gdImageFlipVertical(_image);
+      break;
+    case STEP_FLIP_BOTH:
+      gdImageFlipBoth(_image);
+      break;
+    }
+
+    if (result != nullptr)
+    {
+      gdImageDestroy(_image);
+      _image = result;
+    }
+    return nullptr;
+  }
+
+  bool ReadInput(const CallbackInfo &info)
+  {
+    if (info[0].IsString())
+    {
+      _path = info[0].As<Napi::String>().Utf8Value();
+      _inputFormat = "image file";
+      return true;
+    }
+
+    if (!info[0].IsBuffer())
+    {
+      Napi::TypeError::New(info.Env(), "Argument 0 must be a Buffer or a path to an image file")
+          .ThrowAsJavaScriptException();
+      return false;
+    }
+
+    Napi::Buffer<char> buffer = info[0].As<Napi::Buffer<char> >();
+    if (buffer.Length() > INT_MAX)
+    {
+      Napi::RangeError::New(info.Env(), "Buffer is too large to decode")
+          .ThrowAsJavaScriptException();
+      return false;
+    }
+
+    _decode = SniffDecoder((const unsigned char *)buffer.Data(), buffer.Length(), _inputFormat);
+    if (_decode == nullptr)
+    {
+      Napi::TypeError::New(info.Env(), "Unsupported or unrecognized image format")
+          .ThrowAsJavaScriptException();
+      return false;
+    }
+
+    _buffer = Napi::Persistent(buffer.As<Napi::Object>());
+    _data = buffer.Data();
+    _length = buffer.Length();
+    return true;
+  }
+
+  /**
+   * Read an integer property of a step, throwing when a required property
+   * is missing or not a number
+   */
+  static bool StepInt(Napi::Object step, const char *key, int &value, bool required, int fallback = 0)
+  {
+    Napi::Value v = step.Get(key);
+    if (v.IsUndefined() && !required)
+    {
+      value = fallback;
+      return true;
+    }
+    if (!v.IsNumber())
+    {
+      Napi::TypeError::New(step.Env(), std::string("Pipeline step property '") + key + "' must be a Number")
+          .ThrowAsJavaScriptException();
+      return false;
+    }
+    value = v.As<Napi::Number>().Int32Value();
+    return true;
+  }
+
+  bool ReadSteps(const CallbackInfo &info)
+  {
+    if (!info[1].IsArray())
+    {
+      Napi::TypeError::New(info.Env(), "Argument 1 must be an array of steps")
+          .ThrowAsJavaScriptException();
+      return false;
+    }
+
+    Napi::Array steps = info[1].As<Napi::Array>();
+    for (uint32_t i = 0; i < steps.Length(); i++)
+    {
+      Napi::Value value = steps.Get(i);
+      if (!value.IsObject())
+      {
+        Napi::TypeError::New(info.Env(), "Pipeline steps must be objects with an 'op' property")
+            .ThrowAsJavaScriptException();
+        return false;
+      }
+
+      Napi::Object object = value.As<Napi::Object>();
+      std::string op = object.Get("op").ToString().Utf8Value();
+      Step step = {STEP_GRAYSCALE, {0, 0, 0, 0}, 0};
+      bool ok = true;
+
+      if (op == "resize")
+      {
+        step.type = STEP_RESIZE;
+        ok = StepInt(object, "width", step.args[0], false) && StepInt(object, "height", step.args[1], false);
+        if (ok && (step.args[0] < 0 || step.args[1] < 0 || (step.args[0] == 0 && step.args[1] == 0)))
+        {
+          Napi::RangeError::New(info.Env(), "Pipeline step 'resize' needs a positive width, height or both")
+              .ThrowAsJavaScriptException();
+          return false;
+        }
+      }
+      else if (op == "scale")
+      {
+        step.type = STEP_SCALE;
+        ok = StepInt(object, "width", step.args[0], true) && StepInt(object, "height", step.args[1], true);
+      }
+      else if (op == "crop")
+      {
+        step.type = STEP_CROP;
+        ok = StepInt(object, "x", step.args[0], true) && StepInt(object, "y", step.args[1], true) &&
+             StepInt(object, "width", step.args[2], true) && StepInt(object, "height", step.args[3], true);
+      }
+      else if (op == "rotate")
+      {
+        step.type = STEP_ROTATE;
+        Napi::Value angle = object.Get("angle");
+        if (!angle.IsNumber())
+        {
+          Napi::TypeError::New(info.Env(), "Pipeline step property 'angle' must be a Number")
+              .ThrowAsJavaScriptException();
+          return false;
+        }
+        step.value = angle.As<Napi::Number>().DoubleValue();
+        ok = StepInt(object, "background", step.args[0], false);
+      }
+      else if (op == "sharpen")
+      {
+        step.type = STEP_SHARPEN;
+        ok = StepInt(object, "pct", step.args[0], true);
+      }
+      else if (op == "gaussianBlur")
+      {
+        step.type = STEP_GAUSSIAN_BLUR;
+      }
+      else if (op == "grayscale")
+      {
+        step.type = STEP_GRAYSCALE;
+      }
+      else if (op == "negate")
+      {
+        step.type = STEP_NEGATE;
+      }
+      else if (op == "brightness")
+      {
+        step.type = STEP_BRIGHTNESS;
+        ok = StepInt(object, "brightness", step.args[0], true);
+      }
+      else if (op == "contrast")
+      {
+        step.type = STEP_CONTRAST;
+        Napi::Value contrast = object.Get("contrast");
+        if (!contrast.IsNumber())
+        {
+          Napi::TypeError::New(info.Env(), "Pipeline step property 'contrast' must be a Number")
+              .ThrowAsJavaScriptException();
+          return false;
+        }
+        step.value = contrast.As<Napi::Number>().DoubleValue();
+      }
+      else if (op == "flipHorizontal")
+      {
+        step.type = STEP_FLIP_HORIZONTAL;
+      }
+      else if (op == "flipVertical")
+      {
+        step.type = STEP_FLIP_VERTICAL;
+      }
+      else if (op == "flipBoth")
+      {
+        step.type = STEP_FLIP_BOTH;
+      }
+      else
+      {
+        Napi::TypeError::New(info.Env(), "Unknown pipeline step '" + op + "'")
+            .ThrowAsJavaScriptException();
+        return false;
+      }
+
+      if (!ok)
+      {
+        return false;
+      }
+      _steps.push_back(step);
+    }
+
+    return true;
+  }
+
+  bool ReadOutput(const CallbackInfo &info)
+  {
+    Napi::Object options;
+    std::string format;
+
+    if (info[2].IsString())
+    {
+      format = info[2].As<Napi::String>().Utf8Value();
+      options = Napi::Object::New(info.Env());
+    }
+    else if (info[2].IsObject())
+    {
+      options = info[2].As<Napi::Object>();
+      format = options.Get("format").ToString().Utf8Value();
+    }
+    else
+    {
+      Napi::TypeError::New(info.Env(), "Argument 2 must be an output format or an object with a format property")
+          .ThrowAsJavaScriptException();
+      return false;
+    }
+
+    std::transform(format.begin(), format.end(), format.begin(), ::tolower);
+
+    if (format == "jpeg" || format == "jpg")
+    {
+      _output = OUTPUT_JPEG;
+      _format = "JPEG";
+      return StepInt(options, "quality", quality, false, -1);
+    }
+    if (format == "png")
+    {
+      _output = OUTPUT_PNG;
+      _format = "PNG";
+      return StepInt(options, "level", level, false, -1);
+    }
+    if (format == "gif")
+    {
+      _output = OUTPUT_GIF;
+      _format = "GIF";
+      return true;
+    }
+    if (format == "bmp")
+    {
+      _output = OUTPUT_BMP;
+      _format = "BMP";
+      return StepInt(options, "compression", level, false, 0);
+    }
+#if HAS_LIBWEBP
+    if (format == "webp")
+    {
+      _output = OUTPUT_WEBP;
+      _format = "WEBP";
+      return StepInt(options, "quality", quality, false, -1);
+    }
+#endif
+#if HAS_LIBTIFF
+    if (format == "tiff" || format == "tif")
+    {
+      _output = OUTPUT_TIFF;
+      _format = "TIFF";
+      return true;
+    }
+#endif
+#if HAS_LIBHEIF
+    if (format == "heif" || format == "heic")
+    {
+      _output = OUTPUT_HEIF;
+      _format = "HEIF";
+      return StepInt(options, "quality", quality, false, -1) && ReadHeifOptions(options, _heifCodec, _chroma);
+    }
+#endif
+#if HAS_LIBAVIF
+    if (format == "avif")
+    {
+      _output = OUTPUT_AVIF;
+      _format = "AVIF";
+      return StepInt(options, "quality", quality, false, -1) && StepInt(options, "speed", level, false, -1);
+    }
+#endif
+
+    Napi::TypeError::New(info.Env(), "Unsupported output format '" + format + "'")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+
+  gdImagePtr _image{nullptr};
+
+  std::string _path;
+
+  Napi::ObjectReference _buffer;
+
+  char *_data{nullptr};
+
+  size_t _length{0};
+
+  CreateFromPtrWorker::DecodeFunction _decode{nullptr};
+
+  const char *_inputFormat{""};
+
+  DecodeLimits _limits;
+
+  bool _probed{false};
+
+  ProbeResult _header;
+
+  std::vector<Step> _steps;
+
+  OutputFormat _output{OUTPUT_PNG};
+
+#if HAS_LIBHEIF
+  gdHeifCodec _heifCodec{GD_HEIF_CODEC_HEVC};
+
+  std::string _chroma{"444"};
+#endif
+};
+
+/**
+ * StreamEncodeWorker encodes an image through a gdIOCtx handing fixed-size
+ * chunks to JavaScript while the encoder is still running
+ *
+ * The chunks go to a Writable stream, a StreamSink blocks the encoder while
+ * the stream asks to wait. Returns an object with the Promise, resolving to
+ * the number of bytes written, and the credit() and abort() functions
+ * driving the sink.
+ */
+class StreamEncodeWorker : public GdWorker
+{
+public:
+  static Value DoWork(const CallbackInfo &info, gdImagePtr &gdImage)
+  {
+    REQ_ARGS(3, "format, chunk size and chunk callback.");
+    REQ_STR_ARG(0, format, "Argument should be the format to encode the image to.");
+    REQ_DOUBLE_ARG(1, chunkSize);
+    REQ_FN_ARG(2, onChunk);
+
+    if (!(chunkSize >= 1))
+    {
+      Napi::RangeError::New(info.Env(), "Value for chunkSize must be 1 or greater")
+          .ThrowAsJavaScriptException();
+      return info.Env().Null();
+    }
+
+    StreamEncodeWorker *worker = new StreamEncodeWorker(info.Env(),
+                                                        "StreamEncodeWorkerResource");
+
+    worker->_gdImage = &gdImage;
+    if (!worker->ReadFormat(info, format))
+    {
+      delete worker;
+      return info.Env().Null();
+    }
+    JOB_OPTIONS_ARG(3, worker, worker->_lane);
+    LEASE_IMAGE(worker, false);
+
+    // two chunks in flight keep the encoder busy while the stream writes
+    Napi::ThreadSafeFunction chunks = Napi::ThreadSafeFunction::New(info.Env(), onChunk,
+                                                                    "StreamEncodeChunk", 0, 1);
+    std::shared_ptr<StreamSink> sink =
+        std::make_shared<StreamSink>((size_t)std::min(chunkSize, 1e9), 2, chunks);
+    worker->_sink = sink;
+
+    auto credit = [sink](const CallbackInfo &info)
+    {
+      sink->Credit();
+    };
+    auto abort = [sink](const CallbackInfo &info)
+    {
+      sink->Abort();
+    };
+
+    Napi::Object encoder = Napi::Object::New(info.Env());
+    encoder.Set("promise", worker->_deferred.Promise());
+    encoder.Set("credit", Napi::Function::New(info.Env(), credit, "credit"));
+    encoder.Set("abort", Napi::Function::New(info.Env(), abort, "abort"));
+
+    worker->Queue();
+    return encoder;
+  }
+
+  ~StreamEncodeWorker()
+  {
+    if (_sink)
+    {
+      _sink->Close();
+    }
+  }
+
+protected:
+  enum OutputFormat
+  {
+    OUTPUT_JPEG,
+    OUTPUT_PNG,
+    OUTPUT_GIF,
+    OUTPUT_BMP,
+    OUTPUT_WEBP,
+    OUTPUT_TIFF,
+    OUTPUT_HEIF,
+    OUTPUT_AVIF
+  };
+
+  void Execute() override
+  {
+    if (*_gdImage == nullptr)
+    {
+      return SetError("Image is already destroyed");
+    }
+
+    auto cancelled = [this]()
+    { return Cancelled(); };
+    StreamWriteCtx stream;
+    InitStreamWriteCtx(stream, _sink.get(), cancelled);
+
+    if (!Encode(*_gdImage, &stream.ctx, cancelled))
+    {
+      return SetError("Cannot encode " + _format + " image");
+    }
+    if (Cancelled())
+    {
+      return;
+    }
+
+    _sink->Finish(cancelled);
+    _bytes = _sink->Bytes();
+    if (_bytes == 0)
+    {
+      return SetError("Cannot encode " + _format + " image");
+    }
+  }
+
+  bool Encode(gdImagePtr image, gdIOCtx *out, const std::function<bool()> &cancelled)
+  {
+    switch (_output)
+    {
+    case OUTPUT_JPEG:
+      gdImageJpegCtx(image, out, _quality);
+      return true;
+    case OUTPUT_PNG:
+      gdImagePngCtxEx(image, out, _level);
+      return true;
+    case OUTPUT_GIF:
+      gdImageGifCtx(image, out);
+      return true;
+    case OUTPUT_BMP:
+      gdImageBmpCtx(image, out, _level);
+      return true;
+#if HAS_LIBWEBP
+    case OUTPUT_WEBP:
+      gdImageWebpCtx(image, out, _quality);
+      return true;
+#endif
+#if HAS_LIBTIFF
+    case OUTPUT_TIFF:
+    {
+      // libtiff seeks back to patch the directory offsets, so TIFF is
+      // encoded in memory first and then handed over chunk by chunk
+      int size = 0;
+      void *data = gdImageTiffPtr(image, &size);
+      if (data == nullptr)
+      {
+        return false;
+      }
+      _sink->Put((const unsigned char *)data, (size_t)size, cancelled);
+      gdFree(data);
+      return true;
+    }
+#endif
+#if HAS_LIBHEIF
+    case OUTPUT_HEIF:
+      gdImageHeifCtx(image, out, _quality, _heifCodec, _chroma.c_str());
+      return true;
+#endif
+#if HAS_LIBAVIF
+    case OUTPUT_AVIF:
+      gdImageAvifCtx(image, out, _quality, _level);
+      return true;
+#endif
+    default:
+      return false;
+    }
+  }
+
+  virtual void OnOK() override
+  {
+    _deferred.Resolve(Napi::Number::New(Env(), (double)_bytes));
+  }
+
+  virtual void OnError(const Napi::Error &e) override
+  {
+    _deferred.Reject(Rejection(e));
+  }
+
+  bool ReadFormat(const CallbackInfo &info, std::string format)
+  {
+    Napi::Object options = IsJobOptions(info, 3) ? info[3].As<Napi::Object>()
+                                                 : Napi::Object::New(info.Env());
+
+    std::transform(format.begin(), format.end(), format.begin(), ::tolower);
+
+    if (format == "jpeg" || format == "jpg")
+    {
+      _output = OUTPUT_JPEG;
+      _format = "JPEG";
+      _lane = "jpeg";
+      return OptionInt(options, "quality", _quality, -1);
+    }
+    if (format == "png")
+    {
+      _output = OUTPUT_PNG;
+      _format = "PNG";
+      _lane = "png";
+      return OptionInt(options, "level", _level, -1);
+    }
+    if (format == "gif")
+    {
+      _output = OUTPUT_GIF;
+      _format = "GIF";
+      _lane = "gif";
+      return true;
+    }
+    if (format == "bmp")
+    {
+      _output = OUTPUT_BMP;
+      _format = "BMP";
+      _lane = "bmp";
+      return OptionInt(options, "compression", _level, 0);
+    }
+#if HAS_LIBWEBP
+    if (format == "webp")
+    {
+      _output = OUTPUT_WEBP;
+      _format = "WEBP";
+      _lane = "webp";
+      return OptionInt(options, "quality", _quality, -1);
+    }
+#endif
+#if HAS_LIBTIFF
+    if (format == "tiff" || format == "tif")
+    {
+      _output = OUTPUT_TIFF;
+      _format = "TIFF";
+      _lane = "tiff";
+      return true;
+    }
+#endif
+#if HAS_LIBHEIF
+    if (format == "heif" || format == "heic")
+    {
+      _output = OUTPUT_HEIF;
+      _format = "HEIF";
+      _lane = "heif";
+      return OptionInt(options, "quality", _quality, -1) && ReadHeifOptions(options, _heifCodec, _chroma);
+    }
+#endif
+#if HAS_LIBAVIF
+    if (format == "avif")
+    {
+      _output = OUTPUT_AVIF;
+      _format = "AVIF";
+      _lane = "avif";
+      return OptionInt(options, "quality", _quality, -1) && OptionInt(options, "speed", _level, -1);
+    }
+#endif
+
+    Napi::TypeError::New(info.Env(), "Unsupported stream format '" + format + "'")
+        .ThrowAsJavaScriptException();
+    return false;
+  }
+
+  static bool OptionInt(Napi::Object options, const char *key, int &value, int fallback)
+  {
+    Napi::Value v = options.Get(key);
+    if (v.IsUndefined())
+    {
+      value = fallback;
+      return true;
+    }
+    if (!v.IsNumber())
+    {
+      Napi::TypeError::New(options.Env(), std::string("Option '") + key + "' must be a Number")
+          .ThrowAsJavaScriptException();
+      return false;
+    }
+    value = v.As<Napi::Number>().Int32Value();
+    return true;
+  }
+
+  gdImagePtr *_gdImage;
+
+  std::shared_ptr<StreamSink> _sink;
+
+  OutputFormat _output{OUTPUT_PNG};
+
+  std::string _format;
+
+  std::string _lane;
+
+  int _quality{-1};
+
+  int _level{-1};
+
+#if HAS_LIBHEIF
+  gdHeifCodec _heifCodec{GD_HEIF_CODEC_HEVC};
+
+  std::string _chroma{"444"};
+#endif
+
+  uint64_t _bytes{0};
+
+  Promise::Deferred _deferred;
+
+private:
+  StreamEncodeWorker(napi_env env, const char *resource_name)
+      : GdWorker(env, resource_name), _deferred(Promise::Deferred::New(env))
+  {
+  }
+};
@@ -0,0 +1,84 @@
+import fs from 'fs';
+import { Readable } from 'stream';
+
+import gd from '../index.js';
+import { assert } from 'chai';
+
+import dirname from './dirname.mjs';
+
+const currentDir = dirname(import.meta.url);
+
+const source = currentDir + '/fixtures/';
+
+describe('Creating an image from a stream', function () {
+  it('gd.createFromStream() -- decodes a JPEG file stream', async function () {
+    const stream = fs.createReadStream(source + 'input.jpg', { highWaterMark: 1024 });
+    const img = await gd.createFromStream(stream, 'jpeg');
+
+    assert.strictEqual(img.width, 100);
+    assert.strictEqual(img.height, 100);
+    img.destroy();
+  });
+
+  it('gd.createFromStream() -- applies backpressure with a small buffer', async function () {
+    const data = fs.readFileSync(source + 'input.png');
+    const chunks = [];
+    for (let i = 0; i < data.length; i += 500) {
+      chunks.push(data.subarray(i, i + 500));
+    }
+
+    const img = await gd.createFromStream(Readable.from(chunks), 'png', { highWaterMark: 256 });
+    const expected = await gd.createFromPngPtr(data);
+
+    assert.strictEqual(img.getPixel(50, 50), expected.getPixel(50, 50));
+    img.destroy();
+    expected.destroy();
+  });
+
+  it('gd.createFromStream() -- rejects with the error of the stream', async function () {
+    const stream = new Readable({ read() {} });
+    const decoding = gd.createFromStream(stream, 'png');
+
+    stream.push(fs.readFileSync(source + 'input.png').subarray(0, 100));
+    stream.destroy(new Error('Connection reset'));
+
+    try {
+      await decoding;
+      assert.fail('The Promise should have been rejected');
+    } catch (error) {
+      assert.strictEqual(error.message, 'Connection reset');
+    }
+  });
+
+  it('gd.createFromStream() -- checks the decode limits', async function () {
+    const stream = fs.createReadStream(source + 'input.jpg');
+
+    try {
+      await gd.createFromStream(stream, 'jpeg', { maxWidth: 10 });
+      assert.fail('The Promise should have been rejected');
+    } catch (error) {
+      assert.match(error, /exceeds maxWidth/);
+    }
+  });
+
+  it('gd.createFromStream() -- destroys the stream when decoding fails', async function () {
+    const stream = new Readable({ read() {} });
+    const decoding = gd.createFromStream(stream, 'png', { maxWidth: 10 });
+
+    stream.push(fs.readFileSync(source + 'input.png'));
+
+    try {
+      await decoding;
+      assert.fail('The Promise should have been rejected');
+    } catch (error) {
+      assert.match(error, /exceeds maxWidth/);
+    }
+    assert.isTrue(stream.destroyed);
+  });
+
+  it('gd.createFromStream() -- throws for a format which cannot be streamed', function () {
+    assert.throws(function () {
+      gd.createFromStream(fs.createReadStream(source + 'input.tif'), 'tiff');
+    }, TypeError);
+  });
+});
@@ -0,0 +1,94 @@
+import fs from 'fs';
+
+import gd from '../index.js';
+import { assert } from 'chai';
+
+import dirname from './dirname.mjs';
+
+const currentDir = dirname(import.meta.url);
+
+const source = currentDir + '/fixtures/';
+
+/**
+ * A PNG of which only the header claims a size, without pixel data
+ */
+function pngHeader(width, height) {
+  const data = Buffer.alloc(33);
+  Buffer.from('\x89PNG\r\n\x1a\n', 'latin1').copy(data, 0);
+  data.writeUInt32BE(13, 8);
+  data.write('IHDR', 12, 'latin1');
+  data.writeUInt32BE(width, 16);
+  data.writeUInt32BE(height, 20);
+  data[24] = 8;
+  data[25] = 6;
+  return data;
+}
+
+async function assertRejects(promise, pattern) {
+  try {
+    await promise;
+    assert.fail('The Promise should have been rejected');
+  } catch (error) {
+    assert.match(error, pattern);
+  }
+}
+
+describe('Decode limits', function () {
+  afterEach(function () {
+    gd.setDecodeLimits({});
+  });
+
+  it('gd.createFromJpeg() -- rejects an image wider than maxWidth', async function () {
+    await assertRejects(gd.createFromJpeg(source + 'input.jpg', { maxWidth: 50 }), /exceeds maxWidth/);
+  });
+
+  it('gd.createFromPngPtr() -- decodes an image within maxPixels', async function () {
+    const img = await gd.createFromPngPtr(fs.readFileSync(source + 'input.png'), { maxPixels: 100 * 100 });
+
+    assert.strictEqual(img.width, 100);
+    img.destroy();
+  });
+
+  it('gd.createFromPngPtr() -- rejects a header claiming too many pixels', async function () {
+    await assertRejects(gd.createFromPngPtr(pngHeader(40000, 40000), { maxPixels: 1e8 }), /exceeds maxPixels/);
+  });
+
+  it('gd.createFromPngPtr() -- rejects a header libgd cannot allocate without limits', async function () {
+    await assertRejects(gd.createFromPngPtr(pngHeader(50000, 50000)), /cannot be decoded/);
+  });
+
+  it('gd.setDecodeLimits() -- sets defaults which a call can override', async function () {
+    gd.setDecodeLimits({ maxHeight: 10 });
+
+    await assertRejects(gd.openJpeg(source + 'input.jpg'), /exceeds maxHeight/);
+
+    const img = await gd.openJpeg(source + 'input.jpg', { maxHeight: 0 });
+    assert.strictEqual(img.height, 100);
+    img.destroy();
+  });
+
+  it('gd.pipeline() -- rejects input beyond the limits', async function () {
+    const input = fs.readFileSync(source + 'input.jpg');
+
+    await assertRejects(gd.pipeline(input, [{ op: 'grayscale' }], 'png', { maxPixels: 1000 }), /exceeds maxPixels/);
+  });
+
+  it('gd.pipeline() -- rejects a step making an image beyond the limits', async function () {
+    const input = fs.readFileSync(source + 'input.jpg');
+
+    await assertRejects(gd.pipeline(input, [{ op: 'scale', width: 5000, height: 100 }], 'png', { maxWidth: 1000 }), /exceeds maxWidth/);
+  });
+
+  it('gd.pipeline() -- does not read limits from the output options', async function () {
+    const input = fs.readFileSync(source + 'input.jpg');
+
+    const output = await gd.pipeline(input, [{ op: 'grayscale' }], { format: 'png', maxPixels: 1000 });
+    assert.instanceOf(output, Buffer);
+  });
+
+  it('gd.createFromJpegPtr() -- throws for an invalid limit', function () {
+    assert.throws(function () {
+      gd.createFromJpegPtr(Buffer.alloc(10), { maxPixels: -1 });
+    }, RangeError);
+  });
+});
@@ -0,0 +1,85 @@
+import gd from '../index.js';
+import { assert } from 'chai';
+
+import dirname from './dirname.mjs';
+
+const currentDir = dirname(import.meta.url);
+
+const fontFile = currentDir + '/fixtures/FreeSans.ttf';
+
+function record(list) {
+  return list
+    .filledRectangle(0, 0, 99, 99, 0xffffff)
+    .setThickness(3)
+    .line(0, 0, 99, 99, 0xff0000)
+    .setThickness(1)
+    .filledEllipse(50, 50, 40, 20, 0x00ff00)
+    .filledPolygon([{ x: 10, y: 90 }, { x: 30, y: 60 }, { x: 50, y: 90 }], 0x0000ff)
+    .stringFT(0x000000, fontFile, 12, 0, 5, 20, 'node-gd');
+}
+
+async function drawDirect() {
+  const img = await gd.createTrueColor(100, 100);
+  img.filledRectangle(0, 0, 99, 99, 0xffffff);
+  img.setThickness(3);
+  img.line(0, 0, 99, 99, 0xff0000);
+  img.setThickness(1);
+  img.filledEllipse(50, 50, 40, 20, 0x00ff00);
+  img.filledPolygon([{ x: 10, y: 90 }, { x: 30, y: 60 }, { x: 50, y: 90 }], 0x0000ff);
+  img.stringFT(0x000000, fontFile, 12, 0, 5, 20, 'node-gd');
+  return img;
+}
+
+describe('Display lists', function () {
+  it('gd.DisplayList#drawTo() -- draws the same as separate calls', async function () {
+    const expected = await drawDirect();
+    const img = await gd.createTrueColor(100, 100);
+
+    const result = record(new gd.DisplayList()).drawTo(img);
+
+    assert.strictEqual(result, img);
+    assert.deepEqual(img.getImageData(0, 0, 100, 100), expected.getImageData(0, 0, 100, 100));
+    img.destroy();
+    expected.destroy();
+  });
+
+  it('gd.DisplayList#drawToAsync() -- replays one list on several images', async function () {
+    const expected = await drawDirect();
+    const list = record(new gd.DisplayList());
+    const images = await Promise.all([gd.createTrueColor(100, 100), gd.createTrueColor(100, 100)]);
+
+    await Promise.all(images.map(img => list.drawToAsync(img)));
+
+    for (const img of images) {
+      assert.deepEqual(img.getImageData(0, 0, 100, 100), expected.getImageData(0, 0, 100, 100));
+      img.destroy();
+    }
+    expected.destroy();
+  });
+
+  it('gd.DisplayList#stringFT() -- stores repeated strings once', function () {
+    const list = new gd.DisplayList();
+    list.stringFT(0, fontFile, 10, 0, 0, 10, 'a').stringFT(0, fontFile, 10, 0, 0, 20, 'a');
+
+    assert.deepEqual(list.strings, [fontFile, 'a']);
+  });
+
+  it('gd.Image#drawCommands() -- throws a RangeError for a truncated list', async function () {
+    const img = await gd.createTrueColor(10, 10);
+    const { LINE } = gd.DisplayList.opcodes;
+
+    assert.throws(function () {
+      img.drawCommands(new Float64Array([LINE, 0, 0, 9]));
+    }, RangeError);
+    img.destroy();
+  });
+
+  it('gd.Image#drawCommands() -- throws a RangeError for an unknown opcode', async function () {
+    const img = await gd.createTrueColor(10, 10);
+
+    assert.throws(function () {
+      img.drawCommands(new Float64Array([999]));
+    }, RangeError);
+    img.destroy();
+  });
+});
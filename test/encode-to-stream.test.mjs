@@ -0,0 +1,75 @@
+import { Writable } from 'stream';
+
+import gd from '../index.js';
+import { assert } from 'chai';
+
+import dirname from './dirname.mjs';
+
+const currentDir = dirname(import.meta.url);
+
+const source = currentDir + '/fixtures/';
+
+function collector(highWaterMark) {
+  const chunks = [];
+  const writable = new Writable({
+    highWaterMark,
+    write(chunk, encoding, callback) {
+      chunks.push(chunk);
+      setImmediate(callback);
+    },
+  });
+  return { writable, chunks };
+}
+
+describe('Encoding an image into a stream', function () {
+  it('gd.Image#encodeToStream() -- writes a PNG image', async function () {
+    const img = await gd.createFromPng(source + 'input.png');
+    const { writable, chunks } = collector();
+
+    const bytes = await img.encodeToStream(writable, 'png');
+    const data = Buffer.concat(chunks);
+    const decoded = await gd.createFromPngPtr(data);
+
+    assert.strictEqual(bytes, data.length);
+    assert.isTrue(writable.writableFinished);
+    assert.strictEqual(decoded.getTrueColorPixel(50, 50), img.getTrueColorPixel(50, 50));
+    img.destroy();
+    decoded.destroy();
+  });
+
+  it('gd.Image#encodeToStream() -- writes chunks of chunkSize bytes', async function () {
+    const img = await gd.createFromJpeg(source + 'input.jpg');
+    const { writable, chunks } = collector(16);
+
+    const bytes = await img.encodeToStream(writable, 'jpeg', { chunkSize: 256, quality: 90 });
+
+    assert.isAbove(chunks.length, 1);
+    chunks.slice(0, -1).forEach(chunk => assert.strictEqual(chunk.length, 256));
+    assert.strictEqual(bytes, Buffer.concat(chunks).length);
+    img.destroy();
+  });
+
+  it('gd.Image#encodeToStream() -- leaves the stream open with end set to false', async function () {
+    const img = gd.createTrueColorSync(10, 10);
+    const { writable } = collector();
+
+    await img.encodeToStream(writable, 'gif', { end: false });
+
+    assert.isFalse(writable.writableEnded);
+    writable.end();
+    img.destroy();
+  });
+
+  it('gd.Image#encodeToStream() -- throws for an unsupported format', async function () {
+    const img = gd.createTrueColorSync(10, 10);
+    const { writable } = collector();
+
+    try {
+      await img.encodeToStream(writable, 'xyz');
+      assert.fail('The Promise should have been rejected');
+    } catch (error) {
+      assert.instanceOf(error, TypeError);
+    }
+    img.destroy();
+  });
+});
@@ -168,4 +168,39 @@ describe('Section Handling file types', function () {
     assert.ok(fs.existsSync(t));
     img.destroy();
   });
+
+  it('gd.Image#jpegPtrAsync() -- returns a Promise resolving to a Buffer', async function () {
+    const s = `${source}input.png`;
+    const img = await gd.openPng(s);
+    const promise = img.jpegPtrAsync(80);
+
+    assert.ok(promise instanceof Promise);
+    const data = await promise;
+    assert.ok(Buffer.isBuffer(data));
+    assert.ok(data.length > 0);
+
+    const copy = await gd.createFromJpegPtr(data);
+    assert.strictEqual(copy.width, img.width);
+    assert.strictEqual(copy.height, img.height);
+    copy.destroy();
+    img.destroy();
+  });
+
+  it('gd.Image#pngPtrAsync() -- yields the same data as gd.Image#pngPtr()', async function () {
+    const s = `${source}input.png`;
+    const img = await gd.openPng(s);
+    const data = await img.pngPtrAsync(6);
+
+    assert.ok(data.equals(img.pngPtr(6)));
+    img.destroy();
+  });
+
+  it('gd.Image#gifPtrAsync() -- throws when the image is destroyed', async function () {
+    const img = await gd.create(10, 10);
+    img.destroy();
+
+    assert.throws(function () {
+      img.gifPtrAsync();
+    }, /Image is already destroyed/);
+  });
 });
@@ -0,0 +1,130 @@
+import gd from '../index.js';
+import { assert } from 'chai';
+
+describe('Bulk pixel access', function () {
+  it('gd.Image#getImageData() -- returns RGBA values of a true color image', async function () {
+    const img = await gd.createTrueColor(4, 3);
+    img.alphaBlending(0);
+    img.setPixel(1, 2, gd.trueColorAlpha(10, 20, 30, 127));
+    img.setPixel(2, 2, gd.trueColor(200, 100, 50));
+
+    const data = img.getImageData(0, 0, 4, 3);
+
+    assert.instanceOf(data, Uint8ClampedArray);
+    assert.strictEqual(data.length, 4 * 3 * 4);
+    assert.deepEqual(Array.from(data.subarray(36, 40)), [10, 20, 30, 0]);
+    assert.deepEqual(Array.from(data.subarray(40, 44)), [200, 100, 50, 255]);
+    img.destroy();
+  });
+
+  it('gd.Image#getImageData() -- resolves palette colors', async function () {
+    const img = await gd.create(2, 2);
+    img.colorAllocate(0, 0, 255);
+    const red = img.colorAllocate(255, 0, 0);
+    img.setPixel(1, 1, red);
+
+    const data = img.getImageData(1, 1, 1, 1);
+
+    assert.deepEqual(Array.from(data), [255, 0, 0, 255]);
+    img.destroy();
+  });
+
+  it('gd.Image#getImageData() -- fills a supplied Uint32Array', async function () {
+    const img = await gd.createTrueColor(2, 2);
+    const target = new Uint32Array(4);
+
+    const result = img.getImageData(0, 0, 2, 2, target);
+
+    assert.strictEqual(result, target);
+    img.destroy();
+  });
+
+  it('gd.Image#getImageData() -- throws a RangeError for a rectangle outside the image', async function () {
+    const img = await gd.createTrueColor(10, 10);
+
+    assert.throws(function () {
+      img.getImageData(5, 5, 10, 10);
+    }, RangeError);
+    img.destroy();
+  });
+
+  it('gd.Image#getImageDataAsync() -- resolves with the same pixels', async function () {
+    const img = await gd.createTrueColor(20, 20);
+    img.filledEllipse(10, 10, 12, 12, gd.trueColor(0, 255, 0));
+
+    const data = await img.getImageDataAsync(0, 0, 20, 20);
+
+    assert.deepEqual(data, img.getImageData(0, 0, 20, 20));
+    img.destroy();
+  });
+
+  it('gd.createFromRGBASync() -- round trips through gd.Image#getImageData()', function () {
+    const pixels = new Uint8ClampedArray(3 * 2 * 4);
+    for (let i = 0; i < pixels.length; i++) {
+      pixels[i] = (i * 37) % 256;
+    }
+    for (let i = 3; i < pixels.length; i += 4) {
+      pixels[i] = 255;
+    }
+
+    const img = gd.createFromRGBASync(3, 2, pixels);
+
+    assert.strictEqual(img.trueColor, 1);
+    assert.deepEqual(img.getImageData(0, 0, 3, 2), pixels);
+    img.destroy();
+  });
+
+  it('gd.createFromRGBA() -- honours stride and premultiplied alpha', async function () {
+    const pixels = new Uint8Array([
+      100, 50, 0, 128, 9, 9, 9, 9,
+      0, 0, 0, 0, 9, 9, 9, 9,
+    ]);
+
+    const img = await gd.createFromRGBA(1, 2, pixels, {
+      stride: 8,
+      alphaMode: 'premultiplied',
+    });
+
+    assert.deepEqual(Array.from(img.getImageData(0, 0, 1, 1)), [199, 100, 0, 129]);
+    assert.deepEqual(Array.from(img.getImageData(0, 1, 1, 1)), [0, 0, 0, 0]);
+    img.destroy();
+  });
+
+  it('gd.createFromRGBASync() -- throws a RangeError for too little data', function () {
+    assert.throws(function () {
+      gd.createFromRGBASync(10, 10, new Uint8ClampedArray(10));
+    }, RangeError);
+  });
+
+  it('gd.Image#putImageData() -- writes into a rectangle', async function () {
+    const img = await gd.createTrueColor(4, 4);
+
+    img.putImageData(new Uint8ClampedArray([255, 0, 0, 255, 0, 255, 0, 255]), 1, 2, 2, 1);
+
+    assert.strictEqual(img.getPixel(1, 2), gd.trueColor(255, 0, 0));
+    assert.strictEqual(img.getPixel(2, 2), gd.trueColor(0, 255, 0));
+    assert.strictEqual(img.getPixel(3, 2), 0);
+    img.destroy();
+  });
+
+  it('gd.Image#putImageData() -- resolves colors on a palette image', async function () {
+    const img = await gd.create(2, 2);
+
+    img.putImageData(new Uint8ClampedArray([0, 0, 255, 255]), 0, 0, 1, 1);
+
+    assert.strictEqual(img.colorsTotal, 1);
+    assert.deepEqual(Array.from(img.getImageData(0, 0, 1, 1)), [0, 0, 255, 255]);
+    img.destroy();
+  });
+
+  it('gd.Image#putImageDataAsync() -- resolves with the image', async function () {
+    const img = await gd.createTrueColor(8, 8);
+    const pixels = new Uint8ClampedArray(8 * 8 * 4).fill(255);
+
+    const result = await img.putImageDataAsync(pixels, 0, 0, 8, 8);
+
+    assert.strictEqual(result, img);
+    assert.deepEqual(img.getImageData(0, 0, 8, 8), pixels);
+    img.destroy();
+  });
+});
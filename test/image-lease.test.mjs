@@ -0,0 +1,84 @@
+import gd from '../index.js';
+import { assert } from 'chai';
+
+describe('Images in use by asynchronous jobs', function () {
+  it('gd.Image#jpegPtrAsync() -- encodes concurrently with other encoders', async function () {
+    const img = await gd.createTrueColor(100, 100);
+
+    const [jpeg, png] = await Promise.all([img.jpegPtrAsync(), img.pngPtrAsync()]);
+
+    assert.instanceOf(jpeg, Buffer);
+    assert.instanceOf(png, Buffer);
+    img.destroy();
+  });
+
+  it('gd.Image#setPixel() -- throws while the image is being encoded', async function () {
+    const img = await gd.createTrueColor(100, 100);
+
+    const promise = img.pngPtrAsync();
+    assert.throws(function () {
+      img.setPixel(1, 1, 0xff0000);
+    }, /in use/);
+    await promise;
+
+    img.setPixel(1, 1, 0xff0000);
+    assert.strictEqual(img.getPixel(1, 1), 0xff0000);
+    img.destroy();
+  });
+
+  it('gd.Image#getPixel() -- throws while the image is being modified', async function () {
+    const img = await gd.createTrueColor(100, 100);
+    const list = new gd.DisplayList().filledRectangle(0, 0, 99, 99, 0x00ff00);
+
+    const promise = list.drawToAsync(img);
+    assert.throws(function () {
+      img.getPixel(1, 1);
+    }, /modified/);
+    await promise;
+
+    assert.strictEqual(img.getPixel(1, 1), 0x00ff00);
+    img.destroy();
+  });
+
+  it('gd.Image#destroy() -- frees the image after pending jobs', async function () {
+    const img = await gd.createTrueColor(100, 100);
+
+    const promise = img.pngPtrAsync();
+    img.destroy();
+
+    assert.instanceOf(await promise, Buffer);
+    assert.throws(function () {
+      img.getPixel(1, 1);
+    }, /destroyed/);
+  });
+
+  it('gd.Image#copy() -- throws when the destination is being encoded', async function () {
+    const src = await gd.createTrueColor(10, 10);
+    const dest = await gd.createTrueColor(10, 10);
+
+    const promise = dest.pngPtrAsync();
+    assert.throws(function () {
+      src.copy(dest, 0, 0, 0, 0, 10, 10);
+    }, /in use/);
+    await promise;
+
+    src.destroy();
+    dest.destroy();
+  });
+
+  it('gd.Image#setBrush() -- throws when the brush is being modified', async function () {
+    const img = await gd.createTrueColor(10, 10);
+    const brush = await gd.createTrueColor(3, 3);
+    const list = new gd.DisplayList().filledRectangle(0, 0, 2, 2, 0x00ff00);
+
+    const promise = list.drawToAsync(brush);
+    assert.throws(function () {
+      img.setBrush(brush);
+    }, /modified/);
+    await promise;
+
+    img.setBrush(brush);
+    img.destroy();
+    brush.destroy();
+  });
+});
@@ -30,18 +30,30 @@ describe('gd.createFromJpegPtr - Creating image from Buffer', function () {
     });
   });
 
-  it('should accept a Buffer', function (done) {
-    const imageData = fs.readFile(s, function (error, data) {
-      if (error) {
-        throw error;
-      }
+  it('should accept a Buffer', async function () {
+    const data = fs.readFileSync(s);
+    const img = await gd.createFromJpegPtr(data);
 
-      const img = gd.createFromJpegPtr(data);
+    assert.ok(img instanceof gd.Image);
+    img.destroy();
+  });
 
-      assert.ok(img instanceof gd.Image);
-      img.destroy();
-      done();
-    });
+  it('should return a Promise', async function () {
+    const data = fs.readFileSync(s);
+    const promise = gd.createFromJpegPtr(data);
+
+    assert.ok(promise instanceof Promise);
+    const img = await promise;
+    img.destroy();
+  });
+
+  it('should reject when the Buffer does not contain a JPEG image', async function () {
+    try {
+      await gd.createFromJpegPtr(Buffer.from('not a jpeg'));
+      assert.fail('Promise should have been rejected');
+    } catch (reason) {
+      assert.strictEqual(reason, 'Cannot read Jpeg data');
+    }
   });
 
   it('should not accept a Number', function (done) {
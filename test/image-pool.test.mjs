@@ -0,0 +1,66 @@
+import gd from '../index.js';
+import { assert } from 'chai';
+
+describe('Image pool', function () {
+  afterEach(function () {
+    gd.setImagePoolLimit(0);
+  });
+
+  it('gd.getImagePoolStats() -- reports an empty disabled pool by default', function () {
+    const stats = gd.getImagePoolStats();
+
+    assert.strictEqual(stats.limit, 0);
+    assert.strictEqual(stats.bytes, 0);
+    assert.strictEqual(stats.images, 0);
+  });
+
+  it('gd.createTrueColor() -- reuses the memory of a destroyed image of the same size', async function () {
+    gd.setImagePoolLimit(1024 * 1024);
+    const { hits } = gd.getImagePoolStats();
+
+    const first = await gd.createTrueColor(32, 24);
+    first.filledRectangle(0, 0, 31, 23, 0xff0000);
+    first.destroy();
+    assert.strictEqual(gd.getImagePoolStats().images, 1);
+
+    const second = await gd.createTrueColor(32, 24);
+    assert.strictEqual(gd.getImagePoolStats().hits, hits + 1);
+    assert.strictEqual(gd.getImagePoolStats().images, 0);
+    assert.strictEqual(second.width, 32);
+    assert.strictEqual(second.height, 24);
+    assert.strictEqual(second.getPixel(10, 10), 0);
+    second.destroy();
+  });
+
+  it('gd.createSync() -- reuses the memory of palette images', function () {
+    gd.setImagePoolLimit(1024 * 1024);
+
+    gd.createSync(10, 10).destroy();
+    const { hits } = gd.getImagePoolStats();
+    const img = gd.createSync(10, 10);
+
+    assert.strictEqual(gd.getImagePoolStats().hits, hits + 1);
+    assert.strictEqual(img.trueColor, 0);
+    img.destroy();
+  });
+
+  it('gd.setImagePoolLimit() -- keeps the pool within its limit', function () {
+    gd.setImagePoolLimit(100 * 100 * 4 + 100 * 8);
+
+    gd.createTrueColorSync(100, 100).destroy();
+    gd.createTrueColorSync(100, 100).destroy();
+    gd.createTrueColorSync(50, 50).destroy();
+
+    const stats = gd.getImagePoolStats();
+    assert.isAtMost(stats.bytes, stats.limit);
+
+    gd.setImagePoolLimit(0);
+    assert.strictEqual(gd.getImagePoolStats().bytes, 0);
+  });
+
+  it('gd.setImagePoolLimit() -- throws a RangeError for a negative limit', function () {
+    assert.throws(function () {
+      gd.setImagePoolLimit(-1);
+    }, RangeError);
+  });
+});
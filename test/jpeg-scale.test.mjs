@@ -0,0 +1,44 @@
+import fs from 'fs';
+
+import gd from '../index.js';
+import { assert } from 'chai';
+
+import dirname from './dirname.mjs';
+
+const currentDir = dirname(import.meta.url);
+
+const source = currentDir + '/fixtures/';
+
+describe('Decoding JPEG images at a reduced size', function () {
+  it('gd.createFromJpeg() -- decodes at 1/scaleDenom of the size', async function () {
+    const img = await gd.createFromJpeg(source + 'input.jpg', { scaleDenom: 4 });
+
+    assert.strictEqual(img.width, 25);
+    assert.strictEqual(img.height, 25);
+    assert.strictEqual(img.trueColor, 1);
+    img.destroy();
+  });
+
+  it('gd.createFromJpegPtr() -- picks the smallest size covering the target', async function () {
+    const data = fs.readFileSync(source + 'input.jpg');
+    const img = await gd.createFromJpegPtr(data, { targetWidth: 30, targetHeight: 20 });
+
+    // 1/2 decodes 50x50, 1/4 would be 25 pixels wide
+    assert.strictEqual(img.width, 50);
+    assert.strictEqual(img.height, 50);
+    img.destroy();
+  });
+
+  it('gd.createFromJpeg() -- decodes at full size for a large target', async function () {
+    const img = await gd.createFromJpeg(source + 'input.jpg', { targetWidth: 1000, mmap: true });
+
+    assert.strictEqual(img.width, 100);
+    img.destroy();
+  });
+
+  it('gd.createFromJpegPtr() -- throws for an invalid scaleDenom', function () {
+    assert.throws(function () {
+      gd.createFromJpegPtr(Buffer.alloc(10), { scaleDenom: 3 });
+    }, RangeError);
+  });
+});
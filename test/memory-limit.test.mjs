@@ -0,0 +1,98 @@
+import gd from '../index.js';
+import { assert } from 'chai';
+
+describe('Memory limit', function () {
+  afterEach(function () {
+    gd.setMemoryLimit(0);
+  });
+
+  it('gd.memoryUsage() -- counts the pixels of live images', async function () {
+    const before = gd.memoryUsage().images;
+
+    const img = await gd.createTrueColor(100, 100);
+    assert.isAtLeast(gd.memoryUsage().images, before + 100 * 100 * 4);
+
+    img.destroy();
+    assert.strictEqual(gd.memoryUsage().images, before);
+  });
+
+  it('gd.Image#detach() -- keeps the pixels counted until the handle is attached or discarded', async function () {
+    const before = gd.memoryUsage().images;
+
+    const img = await gd.createTrueColor(100, 100);
+    const handle = img.detach();
+    assert.isAtLeast(gd.memoryUsage().images, before + 100 * 100 * 4);
+
+    const attached = gd.Image.attach(handle);
+    assert.isAtLeast(gd.memoryUsage().images, before + 100 * 100 * 4);
+
+    assert.isTrue(gd.Image.discard(attached.detach()));
+    assert.strictEqual(gd.memoryUsage().images, before);
+  });
+
+  it('gd.createTrueColor() -- rejects an image beyond the limit', async function () {
+    gd.setMemoryLimit(gd.memoryUsage().images + 1000);
+    const { rejected } = gd.memoryUsage();
+
+    try {
+      await gd.createTrueColor(100, 100);
+      assert.fail('The Promise should have been rejected');
+    } catch (error) {
+      assert.match(error, /Memory limit/);
+    }
+    assert.strictEqual(gd.memoryUsage().rejected, rejected + 1);
+  });
+
+  it('gd.createTrueColorSync() -- throws beyond the limit', function () {
+    gd.setMemoryLimit(gd.memoryUsage().images + 1000);
+
+    assert.throws(function () {
+      gd.createTrueColorSync(100, 100);
+    }, /Memory limit/);
+  });
+
+  it('gd.Image#scale() -- throws beyond the limit', function () {
+    const img = gd.createTrueColorSync(10, 10);
+    gd.setMemoryLimit(gd.memoryUsage().images + 1000);
+
+    assert.throws(function () {
+      img.scale(100, 100);
+    }, /Memory limit/);
+    img.destroy();
+  });
+
+  it('gd.createFromPngPtr() -- rejects an unreadable header while a limit is set', async function () {
+    gd.setMemoryLimit(gd.memoryUsage().images + 1000000);
+
+    try {
+      await gd.createFromPngPtr(Buffer.alloc(100));
+      assert.fail('The Promise should have been rejected');
+    } catch (error) {
+      assert.match(error, /memory limit/);
+    }
+  });
+
+  it('gd.createTrueColor() -- waits for memory in queue mode', async function () {
+    const first = await gd.createTrueColor(100, 100);
+    gd.setMemoryLimit(gd.memoryUsage().images + 100 * 100 * 4, 'queue');
+
+    let created = false;
+    const waiting = gd.createTrueColor(100, 100).then(img => {
+      created = true;
+      return img;
+    });
+    await new Promise(resolve => setTimeout(resolve, 50));
+    assert.isFalse(created);
+
+    first.destroy();
+    const second = await waiting;
+    assert.strictEqual(second.width, 100);
+    second.destroy();
+  });
+
+  it('gd.setMemoryLimit() -- throws for an unknown mode', function () {
+    assert.throws(function () {
+      gd.setMemoryLimit(1000, 'block');
+    }, RangeError);
+  });
+});
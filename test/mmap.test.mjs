@@ -0,0 +1,61 @@
+import gd from '../index.js';
+import { assert } from 'chai';
+
+import dirname from './dirname.mjs';
+
+const currentDir = dirname(import.meta.url);
+
+const source = currentDir + '/fixtures/';
+
+describe('Decoding image files from a memory mapping', function () {
+  after(function () {
+    gd.setMmapThreshold(0);
+  });
+
+  it('gd.createFromPng() -- decodes the same image with and without mmap', async function () {
+    const mapped = await gd.createFromPng(source + 'input.png', { mmap: true });
+    const read = await gd.createFromPng(source + 'input.png', { mmap: false });
+
+    assert.strictEqual(mapped.width, read.width);
+    assert.strictEqual(mapped.height, read.height);
+    assert.strictEqual(mapped.getPixel(50, 50), read.getPixel(50, 50));
+    mapped.destroy();
+    read.destroy();
+  });
+
+  it('gd.createFromJpeg() -- maps files above the threshold', async function () {
+    gd.setMmapThreshold(1);
+    const img = await gd.createFromJpeg(source + 'input.jpg');
+
+    assert.strictEqual(img.width, 100);
+    img.destroy();
+  });
+
+  it('gd.createFromFile() -- maps a file by its extension', async function () {
+    const img = await gd.createFromFile(source + 'input.bmp', { mmap: true });
+
+    assert.strictEqual(img.width, 100);
+    img.destroy();
+  });
+
+  it('gd.createFromJpeg() -- checks the decode limits of a mapped file', async function () {
+    try {
+      await gd.createFromJpeg(source + 'input.jpg', { mmap: true, maxWidth: 10 });
+      assert.fail('The Promise should have been rejected');
+    } catch (error) {
+      assert.match(error, /exceeds maxWidth/);
+    }
+  });
+
+  it('gd.createFromPng() -- throws for an mmap option which is not a Boolean', function () {
+    assert.throws(function () {
+      gd.createFromPng(source + 'input.png', { mmap: 'yes' });
+    }, TypeError);
+  });
+
+  it('gd.setMmapThreshold() -- throws for a negative threshold', function () {
+    assert.throws(function () {
+      gd.setMmapThreshold(-1);
+    }, RangeError);
+  });
+});
@@ -0,0 +1,57 @@
+import fs from 'fs';
+
+import gd from '../index.js';
+import { assert } from 'chai';
+
+import dirname from './dirname.mjs';
+
+const currentDir = dirname(import.meta.url);
+
+const source = currentDir + '/fixtures/';
+
+describe('Pipeline', function () {
+  it('gd.pipeline() -- resizes a JPEG Buffer into a PNG Buffer', async function () {
+    const input = fs.readFileSync(source + 'input.jpg');
+
+    const output = await gd.pipeline(
+      input,
+      [{ op: 'resize', width: 50 }, { op: 'sharpen', pct: 10 }],
+      'png'
+    );
+
+    assert.instanceOf(output, Buffer);
+    const img = await gd.createFromPngPtr(output);
+    const original = await gd.createFromJpegPtr(input);
+    assert.strictEqual(img.width, 50);
+    assert.strictEqual(img.height, Math.round((original.height * 50) / original.width));
+    img.destroy();
+    original.destroy();
+  });
+
+  it('gd.pipeline() -- crops an image file and encodes with options', async function () {
+    const output = await gd.pipeline(
+      source + 'input.png',
+      [{ op: 'crop', x: 0, y: 0, width: 20, height: 10 }, { op: 'grayscale' }],
+      { format: 'jpeg', quality: 50 }
+    );
+
+    const img = await gd.createFromJpegPtr(output);
+    assert.strictEqual(img.width, 20);
+    assert.strictEqual(img.height, 10);
+    img.destroy();
+  });
+
+  it('gd.pipeline() -- throws for an unknown step', function () {
+    const input = fs.readFileSync(source + 'input.png');
+
+    assert.throws(function () {
+      gd.pipeline(input, [{ op: 'explode' }], 'png');
+    }, TypeError);
+  });
+
+  it('gd.pipeline() -- throws for unrecognized input data', function () {
+    assert.throws(function () {
+      gd.pipeline(Buffer.from('not an image'), [], 'png');
+    }, TypeError);
+  });
+});
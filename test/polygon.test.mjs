@@ -0,0 +1,50 @@
+import gd from '../index.js';
+import { assert } from 'chai';
+
+const points = [
+  { x: 10, y: 10 },
+  { x: 70, y: 50 },
+  { x: 30, y: 90 },
+];
+
+async function draw(fn, input) {
+  const img = await gd.createTrueColor(100, 100);
+  img[fn](input, 0xff0000);
+  const data = img.getImageData(0, 0, 100, 100);
+  img.destroy();
+  return data;
+}
+
+describe('Polygon functions', function () {
+  for (const fn of ['polygon', 'openPolygon', 'filledPolygon']) {
+    it(`gd.Image#${fn}() -- draws the same from an Int32Array as from objects`, async function () {
+      const expected = await draw(fn, points);
+      const actual = await draw(fn, new Int32Array([10, 10, 70, 50, 30, 90]));
+
+      assert.deepEqual(actual, expected);
+    });
+  }
+
+  it('gd.Image#filledPolygon() -- accepts a Float64Array', async function () {
+    const expected = await draw('filledPolygon', points);
+    const actual = await draw('filledPolygon', new Float64Array([10.4, 10, 70, 50.9, 30, 90]));
+
+    assert.deepEqual(actual, expected);
+  });
+
+  it('gd.Image#polygon() -- accepts an Int32Array on a SharedArrayBuffer', async function () {
+    const shared = new Int32Array(new SharedArrayBuffer(6 * 4));
+    shared.set([10, 10, 70, 50, 30, 90]);
+
+    assert.deepEqual(await draw('polygon', shared), await draw('polygon', points));
+  });
+
+  it('gd.Image#polygon() -- throws a RangeError for an odd amount of coordinates', async function () {
+    const img = await gd.createTrueColor(10, 10);
+
+    assert.throws(function () {
+      img.polygon(new Int32Array([1, 2, 3]), 0xff0000);
+    }, RangeError);
+    img.destroy();
+  });
+});
@@ -0,0 +1,69 @@
+import fs from 'fs';
+
+import gd from '../index.js';
+import { assert } from 'chai';
+
+import dirname from './dirname.mjs';
+
+const currentDir = dirname(import.meta.url);
+
+const source = currentDir + '/fixtures/';
+
+describe('Probing image headers', function () {
+  it('gd.probe() -- reads the header of a JPEG file', async function () {
+    const info = await gd.probe(source + 'input.jpg');
+
+    assert.deepEqual(info, {
+      format: 'jpeg',
+      width: 100,
+      height: 100,
+      bitDepth: 8,
+      hasAlpha: false,
+      trueColor: true,
+      frames: 1,
+    });
+  });
+
+  it('gd.probe() -- reads the header of a PNG Buffer', async function () {
+    const info = await gd.probe(fs.readFileSync(source + 'input-transparent.png'));
+
+    assert.strictEqual(info.format, 'png');
+    assert.strictEqual(info.width, 100);
+    assert.strictEqual(info.height, 100);
+    assert.isTrue(info.hasAlpha);
+  });
+
+  it('gd.probeSync() -- recognizes GIF, BMP and TIFF files', function () {
+    assert.strictEqual(gd.probeSync(source + 'node-gd.gif').format, 'gif');
+    assert.isFalse(gd.probeSync(source + 'node-gd.gif').trueColor);
+    assert.strictEqual(gd.probeSync(source + 'input.bmp').bitDepth, 24);
+    assert.strictEqual(gd.probeSync(source + 'input.tif').format, 'tiff');
+    assert.strictEqual(gd.probeSync(source + 'input.tif').width, 100);
+  });
+
+  it('gd.probeSync() -- matches the size of the decoded image', async function () {
+    const data = fs.readFileSync(source + 'input.jpg');
+    const info = gd.probeSync(data);
+    const img = await gd.createFromJpegPtr(data);
+
+    assert.strictEqual(info.width, img.width);
+    assert.strictEqual(info.height, img.height);
+    assert.strictEqual(info.trueColor, img.trueColor === 1);
+    img.destroy();
+  });
+
+  it('gd.probe() -- rejects data of an unknown format', async function () {
+    try {
+      await gd.probe(Buffer.from('not an image'));
+      assert.fail('The Promise should have been rejected');
+    } catch (error) {
+      assert.match(error, /Cannot read image header/);
+    }
+  });
+
+  it('gd.probeSync() -- throws for a file which does not exist', function () {
+    assert.throws(function () {
+      gd.probeSync(source + 'does-not-exist.png');
+    }, /Cannot open image file/);
+  });
+});
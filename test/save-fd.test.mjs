@@ -0,0 +1,110 @@
+import fs from 'fs';
+import { open } from 'fs/promises';
+import v8 from 'v8';
+import vm from 'vm';
+
+import gd from '../index.js';
+import { assert } from 'chai';
+
+import dirname from './dirname.mjs';
+
+const currentDir = dirname(import.meta.url);
+
+const source = currentDir + '/fixtures/';
+const target = currentDir + '/output/';
+
+describe('Saving images to a file descriptor', function () {
+  it('gd.Image#saveJpeg() -- writes to a file descriptor', async function () {
+    const img = await gd.createFromJpeg(source + 'input.jpg');
+    const file = target + 'output-fd.jpg';
+    const fd = fs.openSync(file, 'w');
+
+    const bytes = await img.saveJpeg(fd, 90);
+    fs.closeSync(fd);
+
+    assert.strictEqual(bytes, fs.statSync(file).size);
+    const saved = await gd.createFromJpeg(file);
+    assert.strictEqual(saved.width, img.width);
+    img.destroy();
+    saved.destroy();
+  });
+
+  it('gd.Image#png() -- writes to a FileHandle at an offset', async function () {
+    const img = await gd.createFromPng(source + 'input.png');
+    const handle = await open(target + 'output-fd.seg', 'w+');
+
+    const first = await img.png(handle, -1, { offset: 0 });
+    const second = await img.png(handle, 9, { offset: first, fsync: true });
+    await handle.close();
+
+    const data = fs.readFileSync(target + 'output-fd.seg');
+    assert.strictEqual(data.length, first + second);
+    const decoded = await gd.createFromPngPtr(data.subarray(first));
+    assert.strictEqual(decoded.getTrueColorPixel(50, 50), img.getTrueColorPixel(50, 50));
+    img.destroy();
+    decoded.destroy();
+  });
+
+  it('gd.Image#png() -- keeps a FileHandle open while the job runs', async function () {
+    v8.setFlagsFromString('--expose-gc');
+    const gc = vm.runInNewContext('gc');
+    const img = gd.createTrueColorSync(1000, 1000);
+    const file = target + 'output-fd-gc.png';
+
+    let handle = await open(file, 'w');
+    const ref = new WeakRef(handle);
+    const saving = img.png(handle, 9);
+    handle = null;
+    gc();
+
+    const bytes = await saving;
+    await ref.deref()?.close();
+
+    assert.strictEqual(bytes, fs.statSync(file).size);
+    img.destroy();
+  });
+
+  it('gd.Image#gif() -- groups the syncs of concurrent jobs', async function () {
+    const img = gd.createTrueColorSync(50, 50);
+    const files = [0, 1, 2, 3].map(i => target + `output-fd-${i}.gif`);
+    const fds = files.map(file => fs.openSync(file, 'w'));
+
+    const sizes = await Promise.all(fds.map(fd => img.gif(fd, { fsync: 'batch' })));
+    fds.forEach(fd => fs.closeSync(fd));
+
+    sizes.forEach((size, i) => assert.strictEqual(size, fs.statSync(files[i]).size));
+    img.destroy();
+  });
+
+  it('gd.Image#saveGif() -- appends concurrent saves without an offset', async function () {
+    const img = gd.createTrueColorSync(50, 50);
+    const file = target + 'output-fd-append.seg';
+    const fd = fs.openSync(file, 'w');
+
+    const sizes = await Promise.all([0, 1, 2, 3].map(() => img.saveGif(fd)));
+    fs.closeSync(fd);
+
+    assert.strictEqual(fs.statSync(file).size, sizes.reduce((a, b) => a + b, 0));
+    img.destroy();
+  });
+
+  it('gd.Image#png() -- throws for a descriptor which is not a regular file', function () {
+    const img = gd.createTrueColorSync(10, 10);
+    const fd = fs.openSync(currentDir, 'r');
+
+    assert.throws(function () {
+      img.png(fd);
+    }, TypeError);
+    fs.closeSync(fd);
+    img.destroy();
+  });
+
+  it('gd.Image#jpeg() -- throws for a negative offset', function () {
+    const img = gd.createTrueColorSync(10, 10);
+
+    assert.throws(function () {
+      img.jpeg(1, 80, { offset: -1 });
+    }, RangeError);
+    img.destroy();
+  });
+});
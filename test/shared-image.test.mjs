@@ -0,0 +1,56 @@
+import gd from '../index.js';
+import { assert } from 'chai';
+
+describe('Images on a SharedArrayBuffer', function () {
+  it('gd.createTrueColorShared() -- draws into the SharedArrayBuffer', function () {
+    const img = gd.createTrueColorShared(10, 5);
+
+    assert.instanceOf(img.sharedBuffer, SharedArrayBuffer);
+    assert.strictEqual(img.sharedBuffer.byteLength, 10 * 5 * 4);
+
+    img.setPixel(3, 2, 0x123456);
+    const pixels = new Int32Array(img.sharedBuffer);
+    assert.strictEqual(pixels[2 * 10 + 3], 0x123456);
+    img.destroy();
+  });
+
+  it('gd.createTrueColorShared() -- reads pixels written to the SharedArrayBuffer', async function () {
+    const img = gd.createTrueColorShared(4, 4);
+    new Int32Array(img.sharedBuffer).fill(0x00ff00);
+
+    assert.strictEqual(img.getPixel(3, 3), 0x00ff00);
+
+    const copy = await gd.createFromPngPtr(await img.pngPtrAsync());
+    assert.strictEqual(copy.getPixel(0, 0), 0x00ff00);
+    copy.destroy();
+    img.destroy();
+  });
+
+  it('gd.createTrueColorShared() -- shares an existing buffer between images', function () {
+    const a = gd.createTrueColorShared(8, 8);
+    const b = gd.createTrueColorShared(8, 8, a.sharedBuffer);
+
+    a.filledRectangle(0, 0, 7, 7, 0xabcdef);
+
+    assert.strictEqual(b.getPixel(5, 5), 0xabcdef);
+    a.destroy();
+    assert.strictEqual(b.getPixel(5, 5), 0xabcdef);
+    b.destroy();
+  });
+
+  it('gd.createTrueColorShared() -- throws for a buffer which is too small', function () {
+    assert.throws(function () {
+      gd.createTrueColorShared(8, 8, new SharedArrayBuffer(16));
+    }, RangeError);
+    assert.throws(function () {
+      gd.createTrueColorShared(8, 8, new ArrayBuffer(256));
+    }, TypeError);
+  });
+
+  it('gd.Image#sharedBuffer -- is null for other images', async function () {
+    const img = await gd.createTrueColor(2, 2);
+
+    assert.isNull(img.sharedBuffer);
+    img.destroy();
+  });
+});
@@ -0,0 +1,180 @@
+import gd from '../index.js';
+import { assert } from 'chai';
+
+describe('Thread pool', function () {
+  let concurrency;
+
+  before(function () {
+    concurrency = gd.getQueueStats().concurrency;
+  });
+
+  afterEach(function () {
+    gd.setConcurrency(concurrency);
+  });
+
+  it('gd.getQueueStats() -- reports the state of the pool', function () {
+    const stats = gd.getQueueStats();
+
+    for (const key of ['concurrency', 'threads', 'queued', 'running', 'completed', 'pending']) {
+      assert.isNumber(stats[key], key);
+    }
+    assert.isAtLeast(stats.concurrency, 1);
+  });
+
+  it('gd.setConcurrency() -- changes the maximum amount of threads', function () {
+    gd.setConcurrency(2);
+
+    assert.strictEqual(gd.getQueueStats().concurrency, 2);
+  });
+
+  it('gd.setConcurrency() -- throws a RangeError for less than one thread', function () {
+    assert.throws(function () {
+      gd.setConcurrency(0);
+    }, RangeError);
+  });
+
+  it('gd.getQueueStats() -- counts pending and completed jobs', async function () {
+    gd.setConcurrency(1);
+    const before = gd.getQueueStats().completed;
+
+    const promises = [];
+    for (let i = 0; i < 8; i++) {
+      promises.push(gd.createTrueColor(64, 64));
+    }
+    assert.strictEqual(gd.getQueueStats().pending, 8);
+
+    const images = await Promise.all(promises);
+
+    const stats = gd.getQueueStats();
+    assert.strictEqual(stats.pending, 0);
+    assert.strictEqual(stats.completed - before, 8);
+    images.forEach(img => img.destroy());
+  });
+
+  it('gd.createTrueColor() -- accepts a priority option', async function () {
+    const img = await gd.createTrueColor(10, 10, { priority: 'batch' });
+
+    assert.strictEqual(img.width, 10);
+    img.destroy();
+  });
+
+  it('gd.Image#pngPtrAsync() -- accepts options without the optional level', async function () {
+    const img = await gd.createTrueColor(10, 10);
+
+    const data = await img.pngPtrAsync({ priority: 'batch' });
+
+    assert.instanceOf(data, Buffer);
+    img.destroy();
+  });
+
+  it('gd.createTrueColor() -- throws a RangeError for an unknown priority', function () {
+    assert.throws(function () {
+      gd.createTrueColor(10, 10, { priority: 'urgent' });
+    }, RangeError);
+  });
+
+  it('gd.getQueueStats() -- reports queued jobs per priority', async function () {
+    gd.setConcurrency(1);
+    const promises = [
+      gd.createTrueColor(10, 10),
+      gd.createTrueColor(10, 10, { priority: 'batch' }),
+      gd.createTrueColor(10, 10, { priority: 'batch' }),
+    ];
+
+    const stats = gd.getQueueStats();
+    assert.isAtLeast(stats.queuedByPriority.batch, 1);
+
+    const images = await Promise.all(promises);
+    images.forEach(img => img.destroy());
+  });
+
+  it('gd.setLaneLimit() -- limits running jobs of a format', async function () {
+    gd.setLaneLimit('png', 1);
+    const img = await gd.createTrueColor(200, 200);
+
+    const results = await Promise.all([img.pngPtrAsync(), img.pngPtrAsync(), img.pngPtrAsync()]);
+
+    assert.strictEqual(results.length, 3);
+    assert.strictEqual(gd.getQueueStats().lanes.png.limit, 1);
+    gd.setLaneLimit('png', 0);
+    img.destroy();
+  });
+
+  it('gd.createTrueColor() -- rejects with an AbortError for an aborted signal', async function () {
+    const controller = new AbortController();
+    controller.abort();
+
+    try {
+      await gd.createTrueColor(10, 10, { signal: controller.signal });
+      assert.fail('The Promise should have been rejected');
+    } catch (error) {
+      assert.strictEqual(error.name, 'AbortError');
+      assert.strictEqual(error.code, 'ABORT_ERR');
+    }
+  });
+
+  it('gd.Image#pngPtrAsync() -- drops a queued job when its signal is aborted', async function () {
+    gd.setConcurrency(1);
+    const img = await gd.createTrueColor(2000, 2000);
+    const controller = new AbortController();
+    const aborted = gd.getQueueStats().aborted;
+
+    const busy = img.pngPtrAsync();
+    const dropped = img.pngPtrAsync({ signal: controller.signal });
+    controller.abort();
+
+    try {
+      await dropped;
+      assert.fail('The Promise should have been rejected');
+    } catch (error) {
+      assert.strictEqual(error.name, 'AbortError');
+    }
+    assert.instanceOf(await busy, Buffer);
+    assert.strictEqual(gd.getQueueStats().aborted, aborted + 1);
+    img.destroy();
+  });
+
+  it('gd.pipeline() -- rejects with an AbortError past its deadline', async function () {
+    const input = await gd.createTrueColor(100, 100);
+    const png = await input.pngPtrAsync();
+    input.destroy();
+
+    try {
+      await gd.pipeline(png, [{ op: 'grayscale' }], 'png', { deadlineMs: 0 });
+      assert.fail('The Promise should have been rejected');
+    } catch (error) {
+      assert.strictEqual(error.name, 'AbortError');
+    }
+  });
+
+  it('gd.Image#pngPtrAsync() -- rejects a queued job at its deadline while the pool is busy', async function () {
+    gd.setConcurrency(1);
+    const img = await gd.createTrueColor(2000, 2000);
+
+    let encoded = false;
+    const busy = img.pngPtrAsync().then((data) => {
+      encoded = true;
+      return data;
+    });
+    const late = img.pngPtrAsync({ deadlineMs: 1 });
+
+    try {
+      await late;
+      assert.fail('The Promise should have been rejected');
+    } catch (error) {
+      assert.strictEqual(error.name, 'AbortError');
+    }
+    assert.isFalse(encoded);
+    assert.instanceOf(await busy, Buffer);
+    img.destroy();
+  });
+
+  it('gd.createTrueColor() -- throws for invalid cancellation options', function () {
+    assert.throws(function () {
+      gd.createTrueColor(10, 10, { deadlineMs: -1 });
+    }, RangeError);
+    assert.throws(function () {
+      gd.createTrueColor(10, 10, { signal: 'abort' });
+    }, TypeError);
+  });
+});
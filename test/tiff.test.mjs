@@ -64,7 +64,7 @@ describe('Section Handling TIFF files', function () {
     var t = target + 'output-from-tiff-ptr.tif';
 
     var imageData = fs.readFileSync(s);
-    var image = gd.createFromTiffPtr(imageData);
+    var image = await gd.createFromTiffPtr(imageData);
     await image.saveTiff(t);
     assert.ok(fs.existsSync(t));
     image.destroy();
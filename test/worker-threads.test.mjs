@@ -0,0 +1,111 @@
+import { Worker } from 'worker_threads';
+import { assert } from 'chai';
+
+const script = `
+import { parentPort, workerData } from 'worker_threads';
+import gd from ${JSON.stringify(new URL('../index.js', import.meta.url).href)};
+
+const img = await gd.createTrueColor(workerData.size, workerData.size);
+img.filledRectangle(0, 0, workerData.size - 1, workerData.size - 1, 0xff0000);
+const png = await img.pngPtrAsync();
+img.destroy();
+parentPort.postMessage(png.length);
+`;
+
+function run(size) {
+  return new Promise((resolve, reject) => {
+    const worker = new Worker(new URL(`data:text/javascript,${encodeURIComponent(script)}`), {
+      workerData: { size },
+    });
+    worker.once('message', resolve);
+    worker.once('error', reject);
+  });
+}
+
+describe('worker_threads', function () {
+  it('loads node-gd in several worker threads at once', async function () {
+    const lengths = await Promise.all([run(50), run(100), run(150), run(200)]);
+
+    lengths.forEach(length => assert.isAbove(length, 0));
+  });
+
+  it('keeps working in the main thread after workers exited', async function () {
+    await run(10);
+    const { default: gd } = await import('../index.js');
+
+    const img = await gd.createTrueColor(10, 10);
+    assert.instanceOf(await img.pngPtrAsync(), Buffer);
+    img.destroy();
+  });
+
+  it('worker.terminate() -- waits for the jobs of the worker', async function () {
+    const worker = new Worker(
+      new URL(
+        `data:text/javascript,${encodeURIComponent(`
+import { parentPort } from 'worker_threads';
+import gd from ${JSON.stringify(new URL('../index.js', import.meta.url).href)};
+
+const img = await gd.createTrueColor(2000, 2000);
+img.filledEllipse(1000, 1000, 1500, 1500, 0x336699);
+const encodes = [0, 1, 2, 3, 4, 5, 6, 7].map(() => img.pngPtrAsync(9));
+parentPort.postMessage('encoding');
+await Promise.all(encodes);
+`)}`
+      )
+    );
+    await new Promise((resolve, reject) => {
+      worker.once('message', resolve);
+      worker.once('error', reject);
+    });
+    await worker.terminate();
+
+    const { default: gd } = await import('../index.js');
+    const img = await gd.createTrueColor(10, 10);
+    assert.instanceOf(await img.pngPtrAsync(), Buffer);
+    img.destroy();
+  });
+
+  it('gd.Image#detach() -- moves an image to a worker thread', async function () {
+    const { default: gd } = await import('../index.js');
+    const img = await gd.createTrueColor(20, 20);
+    img.setPixel(5, 5, 0x00ff00);
+
+    const handle = img.detach();
+    assert.throws(function () {
+      img.getPixel(5, 5);
+    }, /destroyed/);
+
+    const worker = new Worker(
+      new URL(
+        `data:text/javascript,${encodeURIComponent(`
+import { parentPort, workerData } from 'worker_threads';
+import gd from ${JSON.stringify(new URL('../index.js', import.meta.url).href)};
+
+const img = gd.Image.attach(workerData);
+parentPort.postMessage([img.width, img.getPixel(5, 5)]);
+img.destroy();
+`)}`
+      ),
+      { workerData: handle }
+    );
+    const [width, pixel] = await new Promise((resolve, reject) => {
+      worker.once('message', resolve);
+      worker.once('error', reject);
+    });
+
+    assert.strictEqual(width, 20);
+    assert.strictEqual(pixel, 0x00ff00);
+  });
+
+  it('gd.Image.attach() -- throws for a handle which was already attached', async function () {
+    const { default: gd } = await import('../index.js');
+    const handle = (await gd.createTrueColor(10, 10)).detach();
+
+    gd.Image.attach(handle).destroy();
+
+    assert.throws(function () {
+      gd.Image.attach(handle);
+    }, /already attached/);
+    assert.isFalse(gd.Image.discard(handle));
+  });
+});